@@ -108,6 +108,7 @@
 /*************************************************************************************************\
  * Peripheral specific config
  */
+#define dg_configUSE_HW_AES_HASH                (1)
 #define dg_configUSE_HW_I2C                     (1)
 #define dg_configUSE_HW_IRGEN                   (1)
 #define dg_configUSE_HW_QUAD                    (1)
@@ -118,6 +119,7 @@
 #define dg_configUSE_HW_TIMER1                  (1)
 #define dg_configUSE_HW_TIMER2                  (1)
 
+#define dg_configCRYPTO_ADAPTER                 (1)
 #define dg_configGPADC_ADAPTER                  (1)
 #define dg_configI2C_ADAPTER                    (1)
 #define dg_configNVPARAM_ADAPTER                (1)
@@ -162,6 +164,7 @@
 
 /* LMIC */
 #define CFG_sx1276_radio
+#define CFG_hw_aes
 
 #endif /* CUSTOM_CONFIG_QSPI_H_ */
 
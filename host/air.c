@@ -0,0 +1,320 @@
+/*
+ * Radio channel shared by all simulated nodes, and the one gateway that
+ * listens to it.  An uplink is decided when it ends:
+ *  - its SNR at the gateway must reach the demodulation floor of its SF,
+ *  - another uplink on the same channel and SF overlapping it destroys it,
+ *    unless it is at least CAPTURE_DB stronger (capture effect),
+ *  - different SFs are orthogonal,
+ *  - the gateway is half-duplex and hears nothing while it transmits.
+ * Path loss follows the log-distance model of LoRaSim (Bor et al.), also
+ * between nodes, which hear each other when they sense the channel.
+ * Frames between a node and the gateway may also fade, each by its own
+ * normally distributed number of dB.  Channels may be jammed at the
+ * gateway, which then loses every uplink on them.
+ */
+
+#include <err.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lmic/lmic.h"
+#include "host/air.h"
+#include "host/ns.h"
+#include "host/sim.h"
+
+#define NOISE_FLOOR	(-117)	/* dBm in 125 kHz with a 6 dB noise figure */
+#define CAPTURE_DB	6
+#define GW_POWER	14	/* dBm */
+#define MAX_JAMMED	8
+/* Longer than any frame, so nothing on the air can overlap older ones */
+#define MAX_AIRTIME	sec2osticks(16)
+
+struct air_frame {
+	struct sim_frame	 f;
+	const struct sim_node	*src;		/* NULL for the gateway */
+	int			 pending;	/* Uplink not decided yet */
+};
+
+struct air_stats	 air_stats;
+
+static struct air_frame	*frames;
+static int		 nframes, maxframes;
+static u8_t		 next_end = ~0ULL;	/* Of pending uplinks */
+static double		 fading;		/* Standard deviation, dB */
+static u4_t		 fade_rng = 1;
+static u4_t		 jammed[MAX_JAMMED];	/* Hz */
+static int		 njammed;
+
+/* Lowest SNR at which SF7..SF12 demodulate, dB */
+static const s1_t	 snr_floor[] = { -7, -10, -12, -15, -17, -20 };
+
+int
+air_snr_floor(u1_t sf)
+{
+	return snr_floor[sf - 7];
+}
+
+/* Path loss over distance metres */
+int
+air_pathloss(double distance)
+{
+	if (distance < 1)
+		distance = 1;
+	return 127.41 + 10 * 2.08 * log10(distance / 40) + 0.5;
+}
+
+/* Make frames fade by sigma dB, with random numbers from seed */
+void
+air_set_fading(double sigma, u4_t seed)
+{
+	fading = sigma;
+	fade_rng = seed ? seed : 1;
+}
+
+/* Fading of one frame, dB */
+static int
+fade(void)
+{
+	double	u[2];
+	int	i;
+
+	if (fading == 0)
+		return 0;
+	for (i = 0; i < 2; i++) {
+		/* xorshift32 */
+		fade_rng ^= fade_rng << 13;
+		fade_rng ^= fade_rng >> 17;
+		fade_rng ^= fade_rng << 5;
+		u[i] = fade_rng / 4294967296.0;
+	}
+	/* Box-Muller; fade_rng is never 0 */
+	return lround(fading * sqrt(-2 * log(u[0])) * cos(2 * M_PI * u[1]));
+}
+
+/* Jam the channel on freq Hz at the gateway */
+void
+air_jam(u4_t freq)
+{
+	if (njammed == MAX_JAMMED)
+		errx(1, "too many jammed channels");
+	jammed[njammed++] = freq;
+}
+
+void
+air_reset(void)
+{
+	free(frames);
+	frames = NULL;
+	nframes = maxframes = 0;
+	next_end = ~0ULL;
+	memset(&air_stats, 0, sizeof(air_stats));
+}
+
+static struct air_frame *
+add(const struct sim_frame *f)
+{
+	struct air_frame	*a;
+	int			 i;
+
+	for (i = 0; i < nframes; ) {
+		if (!frames[i].pending &&
+		    frames[i].f.end + MAX_AIRTIME < sim_time)
+			frames[i] = frames[--nframes];
+		else
+			i++;
+	}
+	if (nframes == maxframes) {
+		maxframes = maxframes ? 2 * maxframes : 64;
+		if ((frames = reallocarray(frames, maxframes,
+		    sizeof(*frames))) == NULL)
+			err(1, NULL);
+	}
+	a = frames + nframes++;
+	a->f = *f;
+	a->src = NULL;
+	a->pending = 0;
+	return a;
+}
+
+static int
+overlap(const struct sim_frame *a, const struct sim_frame *b)
+{
+	return a->start < b->end && b->start < a->end;
+}
+
+static int
+same_channel(const struct sim_frame *a, const struct sim_frame *b)
+{
+	return a->freq - b->freq + 1000 < 2000;
+}
+
+void
+air_uplink(const struct sim_node *n, const struct sim_frame *f)
+{
+	struct air_frame	*a;
+
+	a = add(f);
+	a->src = n;
+	a->f.rssi = f->power - n->pathloss + fade();
+	a->f.snr = a->f.rssi - NOISE_FLOOR < -128 ? -128 :
+	    a->f.rssi - NOISE_FLOOR > 127 ? 127 : a->f.rssi - NOISE_FLOOR;
+	a->pending = 1;
+	if (f->end < next_end)
+		next_end = f->end;
+	if (f->len > 0 && (f->data[0] & HDR_FTYPE) == HDR_FTYPE_JREQ)
+		air_stats.joins++;
+	else
+		air_stats.uplinks++;
+}
+
+/* Put a gateway transmission on the air, unless it is busy then */
+int
+air_downlink(const struct sim_frame *f)
+{
+	int	i;
+
+	for (i = 0; i < nframes; i++) {
+		if (frames[i].f.iq && overlap(&frames[i].f, f)) {
+			air_stats.dl_busy++;
+			return 0;
+		}
+	}
+	add(f)->f.power = GW_POWER;
+	air_stats.downlinks++;
+	/* Nodes that listen all the time may hear it */
+	for (i = 0; i < sim_nnodes; i++)
+		sx1276_listen(sim_nodes + i);
+	return 1;
+}
+
+/*
+ * Find a gateway transmission for node n, tuned like rx, whose preamble
+ * starts between from and to and is strong enough to be received.
+ */
+int
+air_receive(const struct sim_node *n, const struct sim_frame *rx,
+    u8_t from, u8_t to, struct sim_frame *f)
+{
+	int	i, rssi;
+
+	for (i = 0; i < nframes; i++) {
+		const struct sim_frame	*q = &frames[i].f;
+
+		if (!q->iq || q->sf != rx->sf || q->bw != rx->bw ||
+		    q->iq != rx->iq || !same_channel(q, rx) ||
+		    q->start < from || q->start > to)
+			continue;
+		rssi = q->power - n->pathloss + fade();
+		if (rssi - NOISE_FLOOR < air_snr_floor(q->sf)) {
+			air_stats.dl_weak++;
+			return 0;
+		}
+		*f = *q;
+		f->rssi = rssi;
+		f->snr = rssi - NOISE_FLOOR > 127 ? 127 : rssi - NOISE_FLOOR;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * What node n, tuned like rx, hears between from and to: return the RSSI
+ * of the strongest frame on the channel, or the noise floor.  Set *cad if
+ * one of them has the SF of rx and could be demodulated.
+ */
+int
+air_sense(const struct sim_node *n, const struct sim_frame *rx, u8_t from,
+    u8_t to, int *cad)
+{
+	int	i, rssi, best = NOISE_FLOOR;
+
+	*cad = 0;
+	for (i = 0; i < nframes; i++) {
+		const struct air_frame	*a = &frames[i];
+
+		if (a->src == n || !same_channel(&a->f, rx) ||
+		    a->f.start >= to || a->f.end <= from)
+			continue;
+		rssi = a->f.power - (a->src == NULL ? n->pathloss :
+		    air_pathloss(hypot(a->src->x - n->x, a->src->y - n->y)));
+		if (rssi > best)
+			best = rssi;
+		if (a->f.sf == rx->sf && a->f.bw == rx->bw &&
+		    rssi - NOISE_FLOOR >= air_snr_floor(a->f.sf))
+			*cad = 1;
+	}
+	return best;
+}
+
+/* End of the next uplink to be decided */
+u8_t
+air_next(void)
+{
+	return next_end;
+}
+
+static int
+lost(const struct air_frame *a)
+{
+	int	i;
+
+	for (i = 0; i < njammed; i++) {
+		if (a->f.freq - jammed[i] + 1000 < 2000) {
+			air_stats.lost_jammed++;
+			return 1;
+		}
+	}
+	if (a->f.snr < air_snr_floor(a->f.sf)) {
+		air_stats.lost_weak++;
+		return 1;
+	}
+	for (i = 0; i < nframes; i++) {
+		const struct sim_frame	*b = &frames[i].f;
+
+		if (b == &a->f || !overlap(&a->f, b))
+			continue;
+		if (b->iq) {
+			air_stats.lost_gw_tx++;
+			return 1;
+		}
+		if (same_channel(&a->f, b) && b->sf == a->f.sf &&
+		    a->f.rssi - b->rssi < CAPTURE_DB) {
+			air_stats.lost_collision++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Decide the uplinks that have ended and pass them to the network server */
+void
+air_run(void)
+{
+	struct air_frame	*a;
+	struct sim_frame	 f;
+	int			 i;
+
+	for (;;) {
+		a = NULL;
+		next_end = ~0ULL;
+		for (i = 0; i < nframes; i++) {
+			if (!frames[i].pending)
+				continue;
+			if (frames[i].f.end <= sim_time &&
+			    (a == NULL || frames[i].f.end < a->f.end))
+				a = frames + i;
+			else if (frames[i].f.end < next_end)
+				next_end = frames[i].f.end;
+		}
+		if (a == NULL)
+			break;
+		a->pending = 0;
+		if (lost(a))
+			continue;
+		air_stats.received++;
+		/* The network server may schedule a downlink, i.e. add */
+		f = a->f;
+		ns_uplink(&f);
+	}
+}
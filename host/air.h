@@ -0,0 +1,40 @@
+/* Shared radio channel and gateway of the host simulation */
+
+#ifndef __HOST_AIR_H__
+#define __HOST_AIR_H__
+
+#include "lmic/oslmic.h"
+
+struct sim_frame;
+struct sim_node;
+
+struct air_stats {
+	u4_t	joins;		/* Join requests sent by the nodes */
+	u4_t	uplinks;	/* Data frames sent by the nodes */
+	u4_t	received;	/* Frames the gateway demodulated */
+	u4_t	lost_weak;	/* Below the demodulation floor */
+	u4_t	lost_collision;	/* Destroyed by another frame */
+	u4_t	lost_gw_tx;	/* Gateway was transmitting */
+	u4_t	lost_jammed;	/* On a jammed channel */
+	u4_t	downlinks;	/* Frames sent by the gateway */
+	u4_t	dl_busy;	/* Not sent, gateway already transmitting */
+	u4_t	dl_weak;	/* Sent, but too weak at the node */
+};
+
+extern struct air_stats	air_stats;
+
+int	air_snr_floor(u1_t sf);
+int	air_pathloss(double distance);
+void	air_set_fading(double sigma, u4_t seed);
+void	air_jam(u4_t freq);
+void	air_reset(void);
+void	air_uplink(const struct sim_node *n, const struct sim_frame *f);
+int	air_downlink(const struct sim_frame *f);
+int	air_receive(const struct sim_node *n, const struct sim_frame *rx,
+	    u8_t from, u8_t to, struct sim_frame *f);
+int	air_sense(const struct sim_node *n, const struct sim_frame *rx,
+	    u8_t from, u8_t to, int *cad);
+u8_t	air_next(void);
+void	air_run(void);
+
+#endif /* __HOST_AIR_H__ */
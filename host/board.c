@@ -0,0 +1,229 @@
+/*
+ * Board and SDK services the firmware expects, reduced to what the
+ * simulated node needs: a GPS feeding NMEA sentences, a temperature
+ * sensor, a battery that may be on external power and the I/O expander
+ * with nothing fitted.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <ad_battery.h>
+#include <hw_uart.h>
+#include <hw_usb_charger.h>
+#include <osal.h>
+#include <sys_trng.h>
+
+#include "ble.h"
+#include "hw/hw.h"
+#include "hw/i2c.h"
+#include "hw/iox.h"
+#include "hw/led.h"
+#include "lmic/oslmic.h"
+#include "lora/ad_lora.h"
+#include "host/sim.h"
+
+#define GPS_PERIOD	sec2osticks(1)
+#define BAT_MVOLT	3300
+
+void
+led_init(void)
+{
+}
+
+void
+led_notify(uint8_t s)
+{
+	(void)s;
+}
+
+void
+ad_lora_init(void)
+{
+}
+
+void
+ad_lora_suspend_sleep(int id, ostime_t period)
+{
+	(void)id;
+	(void)period;
+}
+
+void
+ad_lora_allow_sleep(int id)
+{
+	(void)id;
+}
+
+void
+ble_on(void)
+{
+}
+
+bool
+ble_is_suota_ongoing(void)
+{
+	return false;
+}
+
+bool
+cm_lp_clk_is_avail(void)
+{
+	return true;
+}
+
+void
+hw_cpm_reboot_system(void)
+{
+	sim_reboot();
+}
+
+void
+sys_trng_get_bytes(uint8_t *buf, size_t len)
+{
+	u4_t	x = sim_node->rng;
+
+	while (len--) {
+		/* xorshift32 */
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		*buf++ = x;
+	}
+	sim_node->rng = x;
+}
+
+/* I/O expander: all inputs low, i.e. no region jumpers fitted */
+int
+iox_setconf(int conf)
+{
+	(void)conf;
+	return 0;
+}
+
+int
+iox_setpins(int pins)
+{
+	(void)pins;
+	return 0;
+}
+
+int
+iox_getpins(void)
+{
+	return 0;
+}
+
+void
+i2c_init(void)
+{
+}
+
+/*
+ * PCT2075: a slow triangle wave between 10 and 30 degrees, or if steady,
+ * 21 degrees flickering by the last bit now and then.
+ */
+int
+i2c_read(uint8_t addr, uint8_t reg, uint8_t *buf, size_t len)
+{
+	u4_t	min, t;
+
+	(void)reg;
+	if (addr != HW_SENSOR_TEMP_I2C_ADDR || len < 2)
+		return -1;
+	sim_node->sampled = sim_time;
+	min = (u4_t)(sim_time / sec2osticks(60)) % 80;
+	if (sim_node->steady)
+		t = (21 << 8) + (min % 7 == 0) * (1 << 5);
+	else
+		t = (10 << 8) + (min < 40 ? min : 80 - min) * (1 << 7);
+	buf[0] = t >> 8;
+	buf[1] = t & 0xe0;
+	return 0;
+}
+
+int
+i2c_write(uint8_t addr, uint8_t reg, uint8_t *buf, size_t len)
+{
+	(void)reg;
+	(void)buf;
+	(void)len;
+	return addr == HW_SENSOR_TEMP_I2C_ADDR ? 0 : -1;
+}
+
+battery_source
+ad_battery_open(void)
+{
+	return 0;
+}
+
+uint16_t
+ad_battery_read(battery_source src)
+{
+	(void)src;
+	return BAT_MVOLT;
+}
+
+uint16_t
+ad_battery_raw_to_mvolt(battery_source src, uint32_t raw)
+{
+	(void)src;
+	return raw;
+}
+
+void
+ad_battery_close(battery_source src)
+{
+	(void)src;
+}
+
+bool
+hw_charger_check_vbus(void)
+{
+	return sim_node->vbus;
+}
+
+void
+hw_uart_init(int id, const uart_config *cfg)
+{
+	(void)id;
+	(void)cfg;
+}
+
+/* Start the next GPGGA sentence once the previous one has been read */
+static void
+gps_feed(struct sim_gps *gps)
+{
+	u4_t	s;
+	int	crc, i;
+
+	if (gps->pos < gps->len || sim_time < gps->next)
+		return;
+	s = sim_time / sec2osticks(1);
+	gps->len = snprintf(gps->line, sizeof(gps->line),
+	    "$GPGGA,%02u%02u%02u.000,5231.1618,N,01324.2888,E,1,8,1.10,"
+	    "105.3,M,44.7,M,,*", s / 3600 % 24, s / 60 % 60, s % 60);
+	for (crc = 0, i = 1; i < gps->len - 1; i++)
+		crc ^= gps->line[i];
+	gps->len += snprintf(gps->line + gps->len,
+	    sizeof(gps->line) - gps->len, "%02X\r\n", crc);
+	gps->pos = 0;
+	gps->next = sim_time + GPS_PERIOD;
+}
+
+bool
+hw_uart_read_buf_empty(int id)
+{
+	(void)id;
+	gps_feed(&sim_node->gps);
+	return sim_node->gps.pos >= sim_node->gps.len;
+}
+
+uint8_t
+hw_uart_read(int id)
+{
+	(void)id;
+	if (hw_uart_read_buf_empty(id))
+		return 0;
+	return sim_node->gps.line[sim_node->gps.pos++];
+}
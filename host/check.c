@@ -0,0 +1,235 @@
+/*
+ * Host build: check the tables and codings of the firmware against
+ * their reference, run by make check.
+ *
+ * usage: check
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lmic/lmic.h"
+#include "lora/delta.h"
+#include "lora/util.h"
+#include "host/decode.h"
+
+/* hw/aes.c, from host/hwaes.c */
+u4_t	hw_os_aes(u1_t mode, xref2u1_t buf, u2_t len);
+
+static u4_t	rng;
+
+static u4_t
+rand32(void)
+{
+	/* xorshift32 */
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+/* The airtime table of LMIC must match its formula, for every frame */
+static void
+check_airtime(void)
+{
+	int	rps, len;
+
+	for (rps = 0; rps <= 0xff; rps++) {
+		if (getSf(rps) == SFrfu || getBw(rps) == BWrfu)
+			continue;
+		for (len = 0; len <= 0xff; len++) {
+			if (calcAirTime(rps, len) !=
+			    calcAirTimeFormula(rps, len))
+				errx(1, "airtime of rps %02x len %d: %d, not "
+				    "%d", rps, len, calcAirTime(rps, len),
+				    calcAirTimeFormula(rps, len));
+		}
+	}
+}
+
+/* Run os_aes() of either kind with key and aux, on a copy of buf */
+static u4_t
+aes_with(u4_t (*aes)(u1_t, xref2u1_t, u2_t), const u1_t *key,
+    const u1_t *aux, u1_t mode, const u1_t *buf, u1_t *dst, int len)
+{
+	memcpy(AESkey, key, 16);
+	memcpy(AESaux, aux, 16);
+	memcpy(dst, buf, len);
+	return aes(mode, dst, len);
+}
+
+/*
+ * The AES/HASH engine path of hw/aes.c must match the software AES for
+ * frames of every length up to the longest, for the MIC with and
+ * without B0, CTR and ECB.
+ */
+static void
+check_aes(void)
+{
+	static const u1_t	 modes[] = {
+		AES_MIC, AES_MIC | AES_MICNOAUX, AES_CTR, AES_ENC,
+	};
+	u1_t			 key[16], aux[16], buf[MAX_LEN_FRAME];
+	u1_t			 sw[MAX_LEN_FRAME], hw[MAX_LEN_FRAME];
+	u4_t			 micsw, michw;
+	int			 len, i, m;
+
+	rng = 1;
+	for (len = 1; len <= MAX_LEN_FRAME; len++) {
+		for (i = 0; i < 16; i++)
+			key[i] = rand32();
+		for (i = 0; i < len; i++)
+			buf[i] = rand32();
+		for (m = 0; m < (int)ARRAY_SIZE(modes); m++) {
+			if (modes[m] == AES_ENC && len % 16 != 0)
+				continue;
+			memset(aux, 0, sizeof(aux));
+			aux[0] = modes[m] == AES_CTR ? 0x01 : 0x49;
+			aux[15] = modes[m] == AES_CTR ? 1 : len;
+			micsw = aes_with(os_aes, key, aux, modes[m], buf, sw,
+			    len);
+			michw = aes_with(hw_os_aes, key, aux, modes[m], buf,
+			    hw, len);
+			if ((modes[m] & AES_MIC ? micsw != michw :
+			    memcmp(sw, hw, len) != 0))
+				errx(1, "AES engine, mode %02x, %d bytes: "
+				    "not as in software", modes[m], len);
+		}
+	}
+}
+
+/*
+ * Delta codings as doc/PROTO has them, for a backend to check its
+ * decoder against: its example first, then deltas of deltas, negative
+ * samples, wrapping around and a lone sample.
+ */
+static const struct delta_vector {
+	u1_t	fmt;			/* With the mode coded */
+	u1_t	n;
+	u1_t	samples[7 * 4];
+	u1_t	len;
+	u1_t	coding[16];
+} delta_vectors[] = {
+	{ 0x02, 7, { 0x14, 0x00, 0x14, 0x00, 0x14, 0x80, 0x15, 0x00,
+	    0x15, 0x80, 0x15, 0x80, 0x15, 0x20 },
+	  8, { 0x07, 0x14, 0x00, 0x05, 0x04, 0x80, 0x88, 0x50 } },
+	{ 0x11, 6, { 0x0a, 0x0d, 0x13, 0x1c, 0x28, 0x37 },
+	  6, { 0x06, 0x0a, 0x00, 0x03, 0xb6, 0x6d } },
+	{ 0x02, 4, { 0x00, 0x10, 0x00, 0x08, 0xff, 0xf8, 0xff, 0xe8 },
+	  6, { 0x04, 0x00, 0x10, 0x03, 0x02, 0x3d } },
+	{ 0x0c, 3, { 0xfe, 0xff, 0xff, 0x7f, 0x01, 0x00, 0x00, 0x80,
+	    0x04, 0x00, 0x00, 0x80 },
+	  8, { 0x03, 0xfe, 0xff, 0xff, 0x7f, 0x00, 0x03, 0x36 } },
+	{ 0x01, 1, { 0x2a },
+	  4, { 0x01, 0x2a, 0x00, 0x00 } },
+};
+
+/* The record of the example in doc/PROTO, the first vector above */
+static const u1_t	delta_record[] = {
+	0x5e, 0x02, 0x02, 0x3c, 0x00, 0x6e, 0x01, 0x07, 0x14, 0x00, 0x05,
+	0x04, 0x80, 0x88, 0x50,
+};
+
+static void
+check_delta_reading(const struct decode_reading *r, void *arg)
+{
+	const struct delta_vector	*v = delta_vectors;
+	int				*i = arg;
+
+	if (*i >= v->n || r->type != 0x02 || r->age != 366 - 60 * *i ||
+	    r->len != 2 || memcmp(r->data, v->samples + *i * 2, 2) != 0)
+		errx(1, "delta record of doc/PROTO, sample %d", *i);
+	(*i)++;
+}
+
+/* The encoder and the decoder must both match the vectors */
+static void
+check_delta_vectors(void)
+{
+	const struct delta_vector	*v;
+	u1_t				 dst[MAX_LEN_PAYLOAD], out[256 * 4];
+	u1_t				 fmt;
+	int				 i, slen;
+
+	for (v = delta_vectors; v < delta_vectors + ARRAY_SIZE(delta_vectors);
+	    v++) {
+		slen = v->fmt & DELTA_LEN_MASK;
+		i = v - delta_vectors;
+		if (decode_deltas(v->coding, v->len, v->fmt, out, 256) !=
+		    v->n || memcmp(out, v->samples, v->n * slen) != 0)
+			errx(1, "delta vector %d does not decode", i);
+		fmt = v->fmt & ~DELTA_DOD;
+		if (delta_encode(dst, sizeof(dst), v->samples, v->n,
+		    &fmt) != v->len || fmt != v->fmt ||
+		    memcmp(dst, v->coding, v->len) != 0)
+			errx(1, "delta vector %d codes otherwise", i);
+	}
+	i = 0;
+	if (decode_uplink(delta_record, sizeof(delta_record),
+	    check_delta_reading, &i) != delta_vectors[0].n ||
+	    i != delta_vectors[0].n)
+		errx(1, "delta record of doc/PROTO does not decode");
+}
+
+/* Delta coded samples must decode to what was coded, at any room */
+static void
+check_deltas(void)
+{
+	u1_t	s[64 * 4], dst[MAX_LEN_PAYLOAD], out[256 * 4], fmt, f;
+	u4_t	v;
+	int	trace, n, room, len, k, i, j, slen;
+
+	rng = 1;
+	for (trace = 0; trace < 5; trace++) {
+		for (f = 1; f <= (4 | DELTA_LE); f++) {
+			if ((slen = f & DELTA_LEN_MASK) < 1 || slen > 4)
+				continue;
+			for (i = 0, v = rand32(); i < 64; i++) {
+				if (trace == 1)		/* Ramp */
+					v += 32;
+				else if (trace == 2)	/* Random walk */
+					v += rand32() % 5 - 2;
+				else if (trace == 3)	/* Noise */
+					v = rand32();
+				else if (trace == 4)	/* Parabola */
+					v += 3 * i;
+				for (j = 0; j < slen; j++)
+					s[i * slen + (f & DELTA_LE ? j :
+					    slen - 1 - j)] = v >> (8 * j);
+			}
+			for (n = 1; n <= 64; n++) {
+				for (room = 0; room <= MAX_LEN_PAYLOAD; room++) {
+					fmt = f;
+					if ((len = delta_encode(dst, room, s, n,
+					    &fmt)) == 0)
+						continue;
+					k = decode_deltas(dst, len, fmt, out,
+					    256);
+					if (len > room || k < 1 || k > n ||
+					    memcmp(out, s, k * slen) != 0)
+						errx(1, "delta coding of trace "
+						    "%d, format %02x, %d "
+						    "samples in %d bytes",
+						    trace, f, n, room);
+				}
+			}
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	(void)argv;
+	if (argc != 1) {
+		fprintf(stderr, "usage: check\n");
+		return 1;
+	}
+	check_airtime();
+	check_aes();
+	check_deltas();
+	check_delta_vectors();
+	return 0;
+}
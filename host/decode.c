@@ -0,0 +1,164 @@
+/*
+ * Reference decoder of the uplinks of the sensor protocol, see doc/PROTO.
+ * It goes through the records of a payload and hands every sensor
+ * reading in them, one at a time, to the caller: plain sensor data, and
+ * each sample of sensor series and of delta coded ones.  It depends on
+ * nothing of the firmware, so that a backend may take it as it is.
+ */
+
+#include <string.h>
+
+#include "host/decode.h"
+
+#define INFO_SENSOR_DATA	0x1
+#define INFO_SENSOR_SERIES	0x4
+#define INFO_SENSOR_DELTAS	0x5
+
+/* Series and delta coded records */
+#define SERIES_TYPE		0
+#define SERIES_FORMAT		1	/* Sample length, or delta format */
+#define SERIES_INTERVAL		2
+#define SERIES_AGE		4
+#define SERIES_HDR_LEN		6
+
+/* Delta format */
+#define FMT_LEN_MASK		0x07
+#define FMT_LE			0x08
+#define FMT_DOD			0x10
+
+static u4_t
+rlsbf2(const u1_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+/* The low len bytes of v, sign extended */
+static s4_t
+sext(u4_t v, int len)
+{
+	int	sh = 32 - 8 * len;
+
+	return (s4_t)(v << sh) >> sh;
+}
+
+static void
+put(u1_t *p, u4_t v, u1_t fmt)
+{
+	int	i, len = fmt & FMT_LEN_MASK;
+
+	for (i = 0; i < len; i++)
+		p[fmt & FMT_LE ? i : len - 1 - i] = v >> (8 * i);
+}
+
+/*
+ * Decode the delta coding of p, of len bytes, into at most max samples
+ * of the given format.  Return the number of samples, -1 if malformed.
+ */
+int
+decode_deltas(const u1_t *p, int len, u1_t fmt, u1_t *samples, int max)
+{
+	const u1_t	*b;
+	u4_t		 v = 0, z;
+	s4_t		 d = 0, x;
+	int		 slen = fmt & FMT_LEN_MASK, n, shift, width, i, j;
+	int		 pos = 0;
+
+	if (slen < 1 || slen > 4 || len < 1 + slen + 2)
+		return -1;
+	n = p[0];
+	shift = p[1 + slen];
+	width = p[2 + slen];
+	b = p + 3 + slen;
+	if (n < 1 || n > max || shift > 31 || width > 32 ||
+	    3 + slen + ((n - 1) * width + 7) / 8 != len)
+		return -1;
+	memcpy(samples, p + 1, slen);
+	for (i = 0; i < slen; i++)
+		v |= (u4_t)p[1 + (fmt & FMT_LE ? i : slen - 1 - i)] << (8 * i);
+	for (i = 1; i < n; i++) {
+		for (z = 0, j = 0; j < width; j++, pos++)
+			z |= (u4_t)(b[pos / 8] >> (pos % 8) & 1) << j;
+		x = (s4_t)(((z >> 1) ^ -(z & 1)) << shift);
+		d = fmt & FMT_DOD ? sext((u4_t)d + (u4_t)x, slen) :
+		    sext((u4_t)x, slen);
+		v += (u4_t)d;
+		put(samples + i * slen, v, fmt);
+	}
+	return n;
+}
+
+/*
+ * Hand every sensor reading in the payload p, of len bytes, to fn unless
+ * it is NULL.  Return the number of readings, -1 if the payload is
+ * malformed.
+ */
+int
+decode_uplink(const u1_t *p, int len, decode_fn *fn, void *arg)
+{
+	struct decode_reading	 r;
+	u1_t			 samples[256 * 4];
+	const u1_t		*v;
+	int			 readings = 0, hlen, vlen, slen, n, i;
+
+	while (len > 0) {
+		hlen = 1;
+		vlen = *p & 0x0f;
+		if (vlen == 0x0f) {
+			if (len < 2)
+				return -1;
+			hlen = 2;
+			vlen = p[1] & 0x3f;
+		}
+		if (hlen + vlen > len)
+			return -1;
+		v = p + hlen;
+		switch (*p >> 4) {
+		case INFO_SENSOR_DATA:
+			if (vlen < 1)
+				return -1;
+			r.type = v[0];
+			r.age = 0;
+			r.len = vlen - 1;
+			memcpy(r.data, v + 1, r.len);
+			if (fn != NULL)
+				fn(&r, arg);
+			readings++;
+			break;
+		case INFO_SENSOR_SERIES:
+		case INFO_SENSOR_DELTAS:
+			if (vlen < SERIES_HDR_LEN)
+				return -1;
+			if (*p >> 4 == INFO_SENSOR_SERIES) {
+				slen = v[SERIES_FORMAT];
+				if (slen == 0 ||
+				    (vlen - SERIES_HDR_LEN) % slen != 0)
+					return -1;
+				n = (vlen - SERIES_HDR_LEN) / slen;
+				memcpy(samples, v + SERIES_HDR_LEN, n * slen);
+			} else {
+				slen = v[SERIES_FORMAT] & FMT_LEN_MASK;
+				n = decode_deltas(v + SERIES_HDR_LEN,
+				    vlen - SERIES_HDR_LEN, v[SERIES_FORMAT],
+				    samples, sizeof(samples) / 4);
+				if (n == -1)
+					return -1;
+			}
+			r.type = v[SERIES_TYPE];
+			r.len = slen;
+			for (i = 0; i < n; i++) {
+				r.age = rlsbf2(v + SERIES_AGE) -
+				    i * rlsbf2(v + SERIES_INTERVAL);
+				memcpy(r.data, samples + i * slen, slen);
+				if (fn != NULL)
+					fn(&r, arg);
+			}
+			readings += n;
+			break;
+		default:
+			break;
+		}
+		p += hlen + vlen;
+		len -= hlen + vlen;
+	}
+	return readings;
+}
@@ -0,0 +1,21 @@
+/* Decoder of the uplinks of the sensor protocol, as a backend would do */
+
+#ifndef __HOST_DECODE_H__
+#define __HOST_DECODE_H__
+
+#include "lmic/lmic.h"
+
+struct decode_reading {
+	u1_t	type;		/* Sensor type */
+	s4_t	age;		/* Seconds taken before the frame was queued */
+	u1_t	len;
+	u1_t	data[MAX_LEN_PAYLOAD];
+};
+
+typedef void	decode_fn(const struct decode_reading *, void *);
+
+int	decode_deltas(const u1_t *p, int len, u1_t fmt, u1_t *samples,
+	    int max);
+int	decode_uplink(const u1_t *p, int len, decode_fn *fn, void *arg);
+
+#endif /* __HOST_DECODE_H__ */
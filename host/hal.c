@@ -0,0 +1,207 @@
+/*
+ * Virtual-time HAL for the host build.  Sleeping and waiting advance
+ * the simulated clock to the wake-up time, or to the next radio interrupt
+ * if that comes first, so a day of operation takes a fraction of a second.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "oslmic.h"
+#include "hal.h"
+#include "host/sim.h"
+#include "sensor/sensor.h"
+
+/* As on the target */
+#define MAX_WDOG_SLEEP	sec2osticks(2)
+#define MIN_SLEEP	(2 * 64)
+#define MIN_WFI		2
+
+PRIVILEGED_DATA static u4_t			waituntil;
+PRIVILEGED_DATA static struct hal_sleep_stats	sleep_stats;
+
+uint64_t
+rtc_get(void)
+{
+	return sim_time;
+}
+
+uint64_t
+rtc_get_fromISR(void)
+{
+	return sim_time;
+}
+
+void
+hw_spi_set_cs_low(int id)
+{
+	(void)id;
+	sx1276_select(&sim_node->radio, 1);
+}
+
+void
+hw_spi_set_cs_high(int id)
+{
+	(void)id;
+	sx1276_select(&sim_node->radio, 0);
+}
+
+void
+hal_uart_rx(void)
+{
+}
+
+void
+hal_queue_init()
+{
+}
+
+void
+hal_periph_init()
+{
+	sensor_init();
+}
+
+void
+hal_init()
+{
+	sx1276_reset(&sim_node->radio);
+}
+
+u1_t
+hal_spi(u1_t outval)
+{
+	return sx1276_spi(&sim_node->radio, outval);
+}
+
+void
+hal_spi_write(const u1_t *buf, u1_t len)
+{
+	while (len--)
+		sx1276_spi(&sim_node->radio, *buf++);
+}
+
+void
+hal_spi_read(u1_t *buf, u1_t len)
+{
+	while (len--)
+		*buf++ = sx1276_spi(&sim_node->radio, 0x00);
+}
+
+__dead void
+hal_failed()
+{
+	fprintf(stderr, "hal failed at %llu\n", (unsigned long long)sim_time);
+	abort();
+}
+
+/*
+ * Advance the clock to time, stopping early at a pending radio interrupt
+ * and handling it the way the target's wake-up interrupt would.  Other
+ * nodes run in the meantime.
+ */
+static void
+advance(u4_t time)
+{
+	s4_t	dt = time - hal_ticks();
+	u8_t	until = sim_time + (dt > 0 ? dt : 0);
+	u8_t	irq = sim_node->radio.irq_time;
+
+	if (irq != 0 && irq < until)
+		until = irq > sim_time ? irq : sim_time;
+	sim_sleep(until);
+	irq = sim_node->radio.irq_time;
+	if (irq != 0 && irq <= sim_time && sx1276_irq(&sim_node->radio))
+		radio_irq_handler(hal_ticks());
+}
+
+const struct hal_sleep_stats *
+hal_sleepStats()
+{
+	return &sleep_stats;
+}
+
+void
+hal_countTx()
+{
+	sleep_stats.txs++;
+}
+
+u1_t
+hal_checkTimer(u4_t targettime)
+{
+	s4_t	dt;
+
+	dt = targettime - hal_ticks();
+	if (dt < 5) {
+		// Expiration time is nigh.  The target spins until it has
+		// passed; let virtual time catch up the same way, or jobs
+		// that wait for their start time never see it come.
+		if (dt >= 0)
+			hal_waitUntil(targettime + 1);
+		return 1;
+	} else {
+		// Set wake-up time for hal_sleep()
+		waituntil = targettime;
+		return 0;
+	}
+}
+
+void
+hal_setShortSleep()
+{
+	waituntil = hal_ticks() + MAX_WDOG_SLEEP;
+}
+
+void
+hal_sleep()
+{
+	s4_t	dt = waituntil - hal_ticks();
+	u8_t	start = sim_time;
+
+	if (dt <= 0)
+		return;
+	if (dt <= MIN_SLEEP) {
+		// Too short for the OS to sleep: WFI until
+		// hal_checkTimer() takes over
+		if (dt > 4) {
+			advance(waituntil - 4);
+			sim_node->wfi += sim_time - start;
+			sleep_stats.wfi += sim_time - start;
+			sim_node->wakeups++;
+		}
+		return;
+	}
+	sleep_stats.sleeps++;
+	if (dt >= MAX_WDOG_SLEEP)
+		sleep_stats.long_sleeps++;
+	advance(waituntil);
+	sim_node->wakeups++;
+	sleep_stats.wakeups_avoided += (u4_t)(sim_time - start - 1) /
+	    MAX_WDOG_SLEEP;
+	// Power cycles hit a node asleep, as it nearly always is
+	if (sim_node->reboot_period != 0 && sim_time >= sim_node->reboot_at) {
+		sim_node->reboot_at = sim_time + sim_node->reboot_period;
+		sim_reboot();
+	}
+}
+
+/* Sleep in WFI until a tick before time, then spin */
+void
+hal_waitUntil(u4_t time)
+{
+	u8_t	start = sim_time;
+
+	if ((s4_t)(time - hal_ticks()) >= MIN_WFI) {
+		advance(time - 1);
+		sim_node->wfi += sim_time - start;
+		sleep_stats.wfi += sim_time - start;
+		// Woken by the radio
+		if ((s4_t)(time - 1 - hal_ticks()) > 0)
+			return;
+		start = sim_time;
+	}
+	advance(time);
+	sim_node->busy += sim_time - start;
+	sleep_stats.spin += sim_time - start;
+}
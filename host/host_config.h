@@ -0,0 +1,13 @@
+/* Host build configuration, the counterpart of custom_config.h */
+
+#ifndef __HOST_CONFIG_H__
+#define __HOST_CONFIG_H__
+
+/* LMIC */
+#define CFG_sx1276_radio
+
+/* With -x, timed jobs get no slack, to see how many wake-ups it saves */
+extern int	sim_noslack;
+#define OS_JOB_SLACK(slack)	(sim_noslack ? 0 : (slack))
+
+#endif /* __HOST_CONFIG_H__ */
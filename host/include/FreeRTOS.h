@@ -0,0 +1,9 @@
+/* Host stand-in for FreeRTOS: the firmware runs as a single task */
+
+#ifndef __HOST_FREERTOS_H__
+#define __HOST_FREERTOS_H__
+
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+
+#endif /* __HOST_FREERTOS_H__ */
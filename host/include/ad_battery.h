@@ -0,0 +1,15 @@
+/* Host stand-in for the SDK battery adapter */
+
+#ifndef __HOST_AD_BATTERY_H__
+#define __HOST_AD_BATTERY_H__
+
+#include <stdint.h>
+
+typedef void	*battery_source;
+
+battery_source	ad_battery_open(void);
+uint16_t	ad_battery_read(battery_source src);
+uint16_t	ad_battery_raw_to_mvolt(battery_source src, uint32_t raw);
+void		ad_battery_close(battery_source src);
+
+#endif /* __HOST_AD_BATTERY_H__ */
@@ -0,0 +1,13 @@
+/* Host stand-in for the SDK crypto adapter */
+
+#ifndef __HOST_AD_CRYPTO_H__
+#define __HOST_AD_CRYPTO_H__
+
+#include <stdint.h>
+
+#define OS_MUTEX_TAKEN	1
+
+int	ad_crypto_acquire_aes_hash(uint32_t timeout);
+void	ad_crypto_release_aes_hash(void);
+
+#endif /* __HOST_AD_CRYPTO_H__ */
@@ -0,0 +1,30 @@
+/* Host stand-in for the SDK NVMS adapter: partitions live in memory */
+
+#ifndef __HOST_AD_NVMS_H__
+#define __HOST_AD_NVMS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+	NVMS_FIRMWARE_PART,
+	NVMS_PARAM_PART,
+	NVMS_BIN_PART,
+	NVMS_LOG_PART,
+	NVMS_GENERIC_PART,
+	NVMS_PARTS,
+} nvms_partition_id_t;
+
+typedef const struct nvms_part	*nvms_t;
+
+nvms_t		ad_nvms_open(nvms_partition_id_t id);
+size_t		ad_nvms_get_size(nvms_t handle);
+int		ad_nvms_read(nvms_t handle, uint32_t addr, uint8_t *buf,
+		    uint32_t len);
+int		ad_nvms_write(nvms_t handle, uint32_t addr, const uint8_t *buf,
+		    uint32_t size);
+bool		ad_nvms_erase_region(nvms_t handle, uint32_t addr,
+		    size_t size);
+
+#endif /* __HOST_AD_NVMS_H__ */
@@ -0,0 +1,22 @@
+/* Host stand-in for the SDK NVPARAM adapter */
+
+#ifndef __HOST_AD_NVPARAM_H__
+#define __HOST_AD_NVPARAM_H__
+
+#include <stdint.h>
+
+#include <ad_nvms.h>
+
+typedef const struct nvparam_area	*nvparam_t;
+
+nvparam_t	ad_nvparam_open(const char *name);
+uint16_t	ad_nvparam_get_length(nvparam_t param, uint8_t tag,
+		    uint16_t *max_len);
+uint16_t	ad_nvparam_read(nvparam_t param, uint8_t tag, uint16_t length,
+		    void *data);
+uint16_t	ad_nvparam_read_offset(nvparam_t param, uint8_t tag,
+		    uint16_t offset, uint16_t length, void *data);
+uint16_t	ad_nvparam_write(nvparam_t param, uint8_t tag, uint16_t length,
+		    const void *data);
+
+#endif /* __HOST_AD_NVPARAM_H__ */
@@ -0,0 +1,45 @@
+/*
+ * Host stand-in for the SDK NVPARAM area definitions.  The area macros
+ * expand to nothing, except in host/nvms.c which defines
+ * NVPARAM_AREA_TABLES to turn platform_nvparam.h into lookup tables.
+ */
+
+#ifndef __HOST_AD_NVPARAM_DEFS_H__
+#define __HOST_AD_NVPARAM_DEFS_H__
+
+#include <stdint.h>
+
+#include <ad_nvms.h>
+
+struct nvparam_param {
+	uint8_t		tag;
+	uint16_t	offset;
+	uint16_t	length;
+	uint8_t		flags;
+};
+
+#define NVPARAM_PARAM_FLAG_VARPARAM	0x01
+
+#ifdef NVPARAM_AREA_TABLES
+
+#define NVPARAM_AREA(name, part, off)					\
+	static const uint32_t	name ## _area_offset = (off);		\
+	static const nvms_partition_id_t name ## _area_part = (part);	\
+	static const struct nvparam_param name ## _area_params[] = {
+#define NVPARAM_PARAM(tag, off, len)					\
+		{ (tag), (off), (len), 0 },
+#define NVPARAM_VARPARAM(tag, off, len)					\
+		{ (tag), (off), (len), NVPARAM_PARAM_FLAG_VARPARAM },
+#define NVPARAM_AREA_END()						\
+	};
+
+#else
+
+#define NVPARAM_AREA(name, part, off)
+#define NVPARAM_PARAM(tag, off, len)
+#define NVPARAM_VARPARAM(tag, off, len)
+#define NVPARAM_AREA_END()
+
+#endif /* NVPARAM_AREA_TABLES */
+
+#endif /* __HOST_AD_NVPARAM_DEFS_H__ */
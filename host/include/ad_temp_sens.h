@@ -0,0 +1,14 @@
+/* Host stand-in for the SDK temperature sensor adapter */
+
+#ifndef __HOST_AD_TEMP_SENS_H__
+#define __HOST_AD_TEMP_SENS_H__
+
+#include <stdint.h>
+
+typedef void	*tempsens_source;
+
+tempsens_source	ad_tempsens_open(void);
+int		ad_tempsens_read(tempsens_source src);
+void		ad_tempsens_close(tempsens_source src);
+
+#endif /* __HOST_AD_TEMP_SENS_H__ */
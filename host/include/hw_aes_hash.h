@@ -0,0 +1,32 @@
+/* Host stand-in for the SDK AES/HASH engine driver, see host/hwaes.c */
+
+#ifndef __HOST_HW_AES_HASH_H__
+#define __HOST_HW_AES_HASH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+	HW_AES_128,
+} hw_aes_hash_key_size;
+
+typedef enum {
+	HW_AES_HASH_KEY_EXP_BY_HW,
+} hw_aes_hash_key_exp_t;
+
+void	hw_aes_hash_enable_clock(void);
+void	hw_aes_hash_disable_clock(void);
+void	hw_aes_hash_keys_load(hw_aes_hash_key_size size, const uint8_t *key,
+	    hw_aes_hash_key_exp_t exp);
+void	hw_aes_hash_cfg_aes_ecb(hw_aes_hash_key_size size);
+void	hw_aes_hash_cfg_aes_cbc(hw_aes_hash_key_size size);
+void	hw_aes_hash_cfg_aes_ctr(hw_aes_hash_key_size size);
+void	hw_aes_hash_store_iv(const uint8_t *iv);
+void	hw_aes_hash_store_ic(const uint8_t *ic);
+void	hw_aes_hash_cfg_dma(const uint8_t *src, uint8_t *dst,
+	    unsigned int len);
+void	hw_aes_hash_mark_input_block_as_last(void);
+void	hw_aes_hash_encrypt(void);
+bool	hw_aes_hash_is_active(void);
+
+#endif /* __HOST_HW_AES_HASH_H__ */
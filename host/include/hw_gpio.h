@@ -0,0 +1,41 @@
+/* Host stand-in for the DA1468x GPIO driver */
+
+#ifndef __HOST_HW_GPIO_H__
+#define __HOST_HW_GPIO_H__
+
+typedef enum {
+	HW_GPIO_PORT_0,
+	HW_GPIO_PORT_1,
+	HW_GPIO_PORT_2,
+	HW_GPIO_PORT_3,
+	HW_GPIO_PORT_4,
+} HW_GPIO_PORT;
+
+typedef enum {
+	HW_GPIO_PIN_0,
+	HW_GPIO_PIN_1,
+	HW_GPIO_PIN_2,
+	HW_GPIO_PIN_3,
+	HW_GPIO_PIN_4,
+	HW_GPIO_PIN_5,
+	HW_GPIO_PIN_6,
+	HW_GPIO_PIN_7,
+} HW_GPIO_PIN;
+
+typedef enum {
+	HW_GPIO_MODE_INPUT,
+	HW_GPIO_MODE_OUTPUT,
+} HW_GPIO_MODE;
+
+typedef enum {
+	HW_GPIO_FUNC_GPIO,
+	HW_GPIO_FUNC_UART2_RX,
+	HW_GPIO_FUNC_UART2_TX,
+} HW_GPIO_FUNC;
+
+#define hw_gpio_set_pin_function(port, pin, mode, func)	((void)0)
+#define hw_gpio_configure_pin(port, pin, mode, func, high)	((void)0)
+#define hw_gpio_set_active(port, pin)				((void)0)
+#define hw_gpio_set_inactive(port, pin)				((void)0)
+
+#endif /* __HOST_HW_GPIO_H__ */
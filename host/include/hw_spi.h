@@ -0,0 +1,12 @@
+/* Host stand-in for the DA1468x SPI driver */
+
+#ifndef __HOST_HW_SPI_H__
+#define __HOST_HW_SPI_H__
+
+#define HW_SPI1		1
+#define HW_SPI2		2
+
+void	hw_spi_set_cs_low(int id);
+void	hw_spi_set_cs_high(int id);
+
+#endif /* __HOST_HW_SPI_H__ */
@@ -0,0 +1,43 @@
+/* Host stand-in for the DA1468x UART driver */
+
+#ifndef __HOST_HW_UART_H__
+#define __HOST_HW_UART_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HW_UART1	1
+#define HW_UART2	2
+
+typedef enum {
+	HW_UART_BAUDRATE_9600	= 9600,
+	HW_UART_BAUDRATE_115200	= 115200,
+} HW_UART_BAUDRATE;
+
+typedef enum {
+	HW_UART_DATABITS_8	= 3,
+} HW_UART_DATABITS;
+
+typedef enum {
+	HW_UART_PARITY_NONE	= 0,
+} HW_UART_PARITY;
+
+typedef enum {
+	HW_UART_STOPBITS_1	= 0,
+} HW_UART_STOPBITS;
+
+typedef struct {
+	HW_UART_BAUDRATE	baud_rate;
+	HW_UART_DATABITS	data:2;
+	HW_UART_PARITY		parity:2;
+	HW_UART_STOPBITS	stop:1;
+	uint8_t			auto_flow_control:1;
+	uint8_t			use_fifo:1;
+	uint8_t			use_dma:1;
+} uart_config;
+
+void	hw_uart_init(int id, const uart_config *cfg);
+bool	hw_uart_read_buf_empty(int id);
+uint8_t	hw_uart_read(int id);
+
+#endif /* __HOST_HW_UART_H__ */
@@ -0,0 +1,10 @@
+/* Host stand-in for the SDK USB charger driver */
+
+#ifndef __HOST_HW_USB_CHARGER_H__
+#define __HOST_HW_USB_CHARGER_H__
+
+#include <stdbool.h>
+
+bool	hw_charger_check_vbus(void);
+
+#endif /* __HOST_HW_USB_CHARGER_H__ */
@@ -0,0 +1,10 @@
+/* Host stand-in for the SDK OS abstraction layer */
+
+#ifndef __HOST_OSAL_H__
+#define __HOST_OSAL_H__
+
+#include <stdbool.h>
+
+bool	cm_lp_clk_is_avail(void);
+
+#endif /* __HOST_OSAL_H__ */
@@ -0,0 +1,28 @@
+/* Host stand-in for the Dialog SDK definitions */
+
+#ifndef __HOST_SDK_DEFS_H__
+#define __HOST_SDK_DEFS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <hw_gpio.h>
+
+/*
+ * Firmware RAM is collected in its own sections so that the simulator
+ * can reset it on reboot, like the retention RAM on the target.
+ */
+#define PRIVILEGED_DATA			__attribute__((section("fwbss")))
+#define INITIALISED_PRIVILEGED_DATA	__attribute__((section("fwdata")))
+
+#define OS_ASSERT(cond)	do {						\
+	if (!(cond))							\
+		hal_failed();						\
+} while (0)
+
+void	hw_cpm_reboot_system(void);
+
+#endif /* __HOST_SDK_DEFS_H__ */
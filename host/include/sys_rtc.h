@@ -0,0 +1,11 @@
+/* Host stand-in for the SDK RTC: the simulated clock */
+
+#ifndef __HOST_SYS_RTC_H__
+#define __HOST_SYS_RTC_H__
+
+#include <stdint.h>
+
+uint64_t	rtc_get(void);
+uint64_t	rtc_get_fromISR(void);
+
+#endif /* __HOST_SYS_RTC_H__ */
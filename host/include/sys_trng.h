@@ -0,0 +1,11 @@
+/* Host stand-in for the SDK true random number generator */
+
+#ifndef __HOST_SYS_TRNG_H__
+#define __HOST_SYS_TRNG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+void	sys_trng_get_bytes(uint8_t *buf, size_t len);
+
+#endif /* __HOST_SYS_TRNG_H__ */
@@ -0,0 +1,8 @@
+/* Host stand-in for FreeRTOS tasks */
+
+#ifndef __HOST_TASK_H__
+#define __HOST_TASK_H__
+
+#include <FreeRTOS.h>
+
+#endif /* __HOST_TASK_H__ */
@@ -0,0 +1,203 @@
+/*
+ * Benchmark of the timed jobs of LMIC: how long it takes to schedule,
+ * cancel and run n of them, kept in the binary heap of lmic/oslmic.c and
+ * in the sorted list it replaced, for n from 10 to 200.
+ *
+ * usage: jobbench [-r rounds]
+ *
+ * The jobs get random deadlines within an hour.  Insert schedules the n
+ * jobs, cancel clears them in random order, expire takes the first one
+ * due until none is left, as os_runloop() does.  Times are in ns per
+ * job on the host; only how the two compare carries over to the target.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* The most a u1_t heap index allows */
+#define OS_MAX_TIMED_JOBS	255
+
+#include "lmic/oslmic.c"
+#include "lora/util.h"
+
+#define MAX_JOBS	200
+
+/* What lmic/oslmic.c needs besides the timed jobs */
+void		hal_init(void) {}
+void		radio_init(void) {}
+void		LMIC_init(void) {}
+void		hal_sleep(void) {}
+void		hal_setShortSleep(void) {}
+uint64_t	rtc_get(void) { return 0; }
+u1_t		hal_checkTimer(u4_t time) { (void)time; return 0; }
+int		sim_noslack;
+
+void
+sys_trng_get_bytes(uint8_t *buf, size_t len)
+{
+	while (len-- > 0)
+		*buf++ = rand();
+}
+
+void
+hal_failed(void)
+{
+	errx(1, "too many jobs");
+}
+
+/* The sorted list of lmic/oslmic.c before the heap */
+static osjob_t	*scheduledjobs;
+
+static void
+list_set(osjob_t *job, ostime_t time)
+{
+	osjob_t	**pnext;
+
+	unlinkjob(&scheduledjobs, job);
+	job->deadline = time;
+	job->next = NULL;
+	for (pnext = &scheduledjobs; *pnext; pnext = &(*pnext)->next) {
+		if ((*pnext)->deadline - time > 0) {
+			job->next = *pnext;
+			break;
+		}
+	}
+	*pnext = job;
+}
+
+static void
+list_clear(osjob_t *job)
+{
+	unlinkjob(&scheduledjobs, job);
+}
+
+static osjob_t *
+list_first(void)
+{
+	osjob_t	*j = scheduledjobs;
+
+	scheduledjobs = j->next;
+	return j;
+}
+
+static void
+heap_set(osjob_t *job, ostime_t time)
+{
+	os_setTimedCallback(job, time, NULL);
+}
+
+static void
+heap_clear(osjob_t *job)
+{
+	os_clearCallback(job);
+}
+
+static osjob_t *
+heap_first(void)
+{
+	osjob_t	*j = OS.timedjobs[0];
+
+	heapremove(j);
+	return j;
+}
+
+struct sched {
+	const char	*name;
+	void		(*set)(osjob_t *, ostime_t);
+	void		(*clear)(osjob_t *);
+	osjob_t		*(*first)(void);
+};
+
+static const struct sched	scheds[] = {
+	{ "list", list_set, list_clear, list_first },
+	{ "heap", heap_set, heap_clear, heap_first },
+};
+
+enum { INSERT, CANCEL, EXPIRE, OPS };
+
+static osjob_t	jobs[MAX_JOBS];
+static ostime_t	times[MAX_JOBS];
+static int	order[MAX_JOBS];
+
+static double
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Add the time of every operation on n jobs to ns[], in ns */
+static void
+round_of(const struct sched *s, int n, double *ns)
+{
+	double	t;
+	int	i, j, k;
+
+	for (i = 0; i < n; i++) {
+		times[i] = rand() % sec2osticks(60 * 60);
+		order[i] = i;
+	}
+	for (i = n - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		k = order[i];
+		order[i] = order[j];
+		order[j] = k;
+	}
+	t = now();
+	for (i = 0; i < n; i++)
+		s->set(jobs + i, times[i]);
+	ns[INSERT] += now() - t;
+	t = now();
+	for (i = 0; i < n; i++)
+		s->clear(jobs + order[i]);
+	ns[CANCEL] += now() - t;
+	for (i = 0; i < n; i++)
+		s->set(jobs + i, times[i]);
+	t = now();
+	for (i = 0; i < n; i++)
+		s->first();
+	ns[EXPIRE] += now() - t;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int	 sizes[] = { 10, 20, 50, 100, 200 };
+	const struct sched	*s;
+	const char		*errstr;
+	double			 ns[OPS];
+	int			 c, rounds = 10000, i, r, op;
+
+	while ((c = getopt(argc, argv, "r:")) != -1) {
+		switch (c) {
+		case 'r':
+			rounds = strtonum(optarg, 1, 1000000, &errstr);
+			if (errstr != NULL)
+				errx(1, "rounds %s: %s", optarg, errstr);
+			break;
+		default:
+			fprintf(stderr, "usage: jobbench [-r rounds]\n");
+			return 1;
+		}
+	}
+	printf("jobs  sched   insert   cancel   expire (ns per job)\n");
+	for (i = 0; i < (int)ARRAY_SIZE(sizes); i++) {
+		for (s = scheds; s < scheds + ARRAY_SIZE(scheds); s++) {
+			srand(1);
+			for (op = 0; op < OPS; op++)
+				ns[op] = 0;
+			for (r = 0; r < rounds; r++)
+				round_of(s, sizes[i], ns);
+			printf("%4d  %s", sizes[i], s->name);
+			for (op = 0; op < OPS; op++)
+				printf(" %8.1f", ns[op] / rounds / sizes[i]);
+			printf("\n");
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,479 @@
+/*
+ * Host build: run the firmware on a network of simulated nodes sharing
+ * one gateway, in virtual time, and print how the network performed for
+ * every combination of sensor period and minimum spreading factor given.
+ *
+ * usage: minimal [-acktvx] [-b seconds] [-d seconds] [-f sf,...] [-g dB]
+ *     [-h seconds] [-j kHz,...] [-m samples] [-n nodes] [-p seconds,...]
+ *     [-q seconds] [-r metres] [-s seed]
+ *
+ * The nodes use EU868, or KR920 with -k, where they listen before talk.
+ * With -a, the nodes also pick their data rate and TX power themselves,
+ * unless in KR920.
+ * With -b, every node is power cycled that often.
+ * With -c, the nodes are on external power, so listen in class C.
+ * With -q, the application sends every node a command that often.
+ * With -g, frames fade by that many dB (standard deviation).
+ * With -j, the gateway loses every uplink on those channels.
+ * With -m, the nodes send up to that many samples of each sensor at once.
+ * With -h, the nodes send only readings that changed by more than their
+ * deadband, but at least that often.
+ * With -t, the temperature holds steady, as indoors.
+ * With -x, timed jobs run on their deadline, without the slack that lets
+ * them share wake-ups.
+ */
+
+#include <err.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys_trng.h>
+
+#include "lmic/lmic.h"
+#include "lora/lora.h"
+#include "lora/param.h"
+#include "lora/util.h"
+#include "host/air.h"
+#include "host/ns.h"
+#include "host/sim.h"
+#include "sensor/sensor.h"
+
+#define DEFAULT_DURATION	(24 * 60 * 60)
+#define DEFAULT_RADIUS		400	/* m */
+#define MAX_NODES		1024
+#define MAX_RUNS		16
+/* Nodes are switched on at random times within this */
+#define BOOT_SPREAD		sec2osticks(10 * 60)
+/* Nodes are spread around the gateway by this angle */
+#define GOLDEN_ANGLE		2.39996323	/* rad */
+
+/* Energy model: SX1276 and a sleeping DA14680 on a 3.3 V supply */
+#define VSUPPLY			3.3	/* V */
+#define MCU_ACTIVE_MA		4.0
+#define MCU_WFI_MA		1.2	/* Core clock gated, XTAL16M on */
+#define MCU_SLEEP_MA		0.012
+static const double	mode_ma[SX1276_MODES] = {
+	0.0002,		/* Sleep */
+	1.6,		/* Standby */
+	5.8,		/* FSTX */
+	0,		/* TX, see tx_ma */
+	5.8,		/* FSRX */
+	11.5,		/* RX continuous */
+	11.5,		/* RX single */
+	11.5,		/* CAD */
+};
+/* TX on PA_BOOST by output power, interpolated from the datasheet */
+static const double	tx_ma[SX1276_POWERS] = {
+	[2] = 24, 25, 26, 27, 28, 30, 31, 33, 34, 36, 39, 41, 44, 58, 73, 87,
+};
+
+struct result {
+	u4_t	period;		/* s */
+	u1_t	min_sf;
+	double	pdr;		/* % */
+	double	airtime;	/* s per node */
+	double	energy;		/* J per node */
+	double	per_byte;	/* uJ per delivered payload byte */
+};
+
+static FILE	*out;
+static u4_t	 rng;
+static u1_t	 region = REGION_EU;
+static u4_t	 reboot_period;	/* s */
+static u1_t	 device_adr;
+static u1_t	 vbus;
+static u1_t	 batch;
+static u4_t	 heartbeat;	/* s */
+static u1_t	 steady;
+static u4_t	 cmd_period;	/* s */
+static double	 fading;	/* dB */
+
+static u4_t
+rand32(void)
+{
+	/* xorshift32 */
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static double
+secs(u8_t ticks)
+{
+	return (double)ticks / OSTICKS_PER_SEC;
+}
+
+/* Set the period index param to the index matching the given period */
+static void
+set_period(int param, ostime_t (*get)(void), u4_t period, const char *what)
+{
+	u1_t	idx;
+
+	for (idx = 0; idx < 0xff; idx++) {
+		if (param_set(param, &idx, sizeof(idx)) != 0)
+			errx(1, "cannot set %s", what);
+		if (get() == sec2osticks(period))
+			return;
+	}
+	errx(1, "%s of %u s not supported", what, period);
+}
+
+/*
+ * Give node n an identity and a place within radius of the gateway, and
+ * register it with the network server.
+ */
+static void
+provision(struct sim_node *n, u4_t seed, u4_t period, u1_t min_sf,
+    int radius)
+{
+	u1_t	eui[6] = { 0x78, 0xaf, 0x58, 0x00, 0x00, 0x00 };
+	u1_t	deveui[8], devkey[16];
+	double	d;
+	int	i;
+
+	sim_select(n);
+	n->rng = seed + n->idx * 0x9e3779b9;
+	if (n->rng == 0)
+		n->rng = 1;
+	d = radius * sqrt(rand32() / 4294967296.0);
+	n->pathloss = air_pathloss(d);
+	n->x = d * cos(n->idx * GOLDEN_ANGLE);
+	n->y = d * sin(n->idx * GOLDEN_ANGLE);
+
+	eui[3] = n->idx >> 8;
+	eui[4] = n->idx;
+	eui[5] = seed;
+	sys_trng_get_bytes(devkey, sizeof(devkey));
+	if (param_set(PARAM_DEV_EUI, eui, sizeof(eui)) != 0 ||
+	    param_set(PARAM_DEV_KEY, devkey, sizeof(devkey)) != 0 ||
+	    param_set(PARAM_LORA_REGION, &region, sizeof(region)) != 0 ||
+	    (min_sf && param_set(PARAM_MIN_SF, &min_sf, sizeof(min_sf)) != 0) ||
+	    param_set(PARAM_DEVICE_ADR, &device_adr, sizeof(device_adr)) != 0 ||
+	    param_set(PARAM_SENSOR_BATCH, &batch, sizeof(batch)) != 0)
+		errx(1, "cannot provision node");
+	if (period)
+		set_period(PARAM_SENSOR_PERIOD, sensor_period, period,
+		    "sensor period");
+	if (heartbeat)
+		set_period(PARAM_HEARTBEAT, sensor_heartbeat, heartbeat,
+		    "heartbeat");
+	n->vbus = vbus;
+	n->steady = steady;
+	os_getDevEui(deveui);
+	ns_add_device(deveui, devkey, 12 - (min_sf ? min_sf : 7), vbus);
+	/* Count what the firmware writes, not the factory settings */
+	for (i = 0; i < NVMS_PARTS; i++)
+		n->nvms.writes[i] = n->nvms.erases[i] = 0;
+}
+
+static double
+energy(const struct sim_node *n, u8_t t)
+{
+	const struct sx1276	*r = &n->radio;
+	double			 mas = 0;	/* mA s */
+	int			 i;
+
+	for (i = 0; i < SX1276_MODES; i++)
+		mas += mode_ma[i] * secs(r->mode_ticks[i]);
+	for (i = 0; i < SX1276_POWERS; i++)
+		mas += tx_ma[i] * secs(r->tx_ticks[i]);
+	mas += MCU_ACTIVE_MA * secs(n->busy) + MCU_WFI_MA * secs(n->wfi) +
+	    MCU_SLEEP_MA * secs(t - n->busy - n->wfi);
+	return mas / 1000 * VSUPPLY;
+}
+
+static void
+run(struct result *res, int nnodes, u4_t period, u1_t min_sf, int radius,
+    u4_t seed, long long duration)
+{
+	struct sim_node			*n;
+	const struct hal_sleep_stats	*ss;
+	u8_t				 t, tx, maxtx = 0, rx = 0, busy = 0;
+	u8_t				 wfi = 0, age = 0, maxage = 0;
+	u4_t				 reboots = 0, rxframes = 0, rxtouts = 0;
+	u4_t				 sleeps = 0, longs = 0, avoided = 0;
+	u4_t				 wakeups = 0;
+	u4_t				 nvms_writes = 0, nvms_erases = 0;
+	u4_t				 cads = 0, cadbusy = 0, readings = 0;
+	double				 joules = 0;
+	int				 i;
+
+	memset(res, 0, sizeof(*res));
+	rng = seed;
+	sim_init(nnodes);
+	air_set_fading(fading, seed);
+	ns_set_commands(cmd_period, seed);
+	if (region == REGION_KR)
+		ns_set_rx2(FREQ_DNW2_KR);
+	for (n = sim_nodes; n < sim_nodes + nnodes; n++) {
+		provision(n, seed, period, min_sf, radius);
+		sim_start(n, 1 + rand32() % BOOT_SPREAD);
+		if (reboot_period) {
+			n->reboot_period = (u8_t)reboot_period *
+			    OSTICKS_PER_SEC;
+			n->reboot_at = n->wake + rand32() % n->reboot_period;
+		}
+	}
+	sim_select(sim_nodes);
+	res->period = osticks2ms(sensor_period()) / 1000;
+	res->min_sf = min_sf ? min_sf : 7;
+
+	t = (u8_t)duration * OSTICKS_PER_SEC;
+	sim_run(1 + t);
+
+	for (n = sim_nodes; n < sim_nodes + nnodes; n++) {
+		sim_select(n);
+		sx1276_account(&n->radio);
+		ss = hal_sleepStats();
+		sleeps += ss->sleeps;
+		longs += ss->long_sleeps;
+		avoided += ss->wakeups_avoided;
+		wakeups += n->wakeups;
+		tx = n->radio.mode_ticks[SX1276_MODE_TX];
+		if (tx > maxtx)
+			maxtx = tx;
+		rx += n->radio.mode_ticks[SX1276_MODE_RX] +
+		    n->radio.mode_ticks[SX1276_MODE_RX_SINGLE];
+		rxframes += n->radio.rx_frames;
+		rxtouts += n->radio.rx_timeouts;
+		cads += n->radio.cads;
+		cadbusy += n->radio.cad_detected;
+		busy += n->busy;
+		wfi += n->wfi;
+		age += n->data_age;
+		if (n->max_data_age > maxage)
+			maxage = n->max_data_age;
+		readings += n->data_sent;
+		reboots += n->reboots;
+		for (i = 0; i < NVMS_PARTS; i++) {
+			nvms_writes += n->nvms.writes[i];
+			nvms_erases += n->nvms.erases[i];
+		}
+		joules += energy(n, t);
+		res->airtime += secs(tx);
+	}
+	res->airtime /= nnodes;
+	res->energy = joules / nnodes;
+	res->pdr = air_stats.uplinks ?
+	    100.0 * ns_stats.uplinks / air_stats.uplinks : 0;
+	res->per_byte = ns_stats.uplink_bytes ?
+	    joules * 1e6 / ns_stats.uplink_bytes : 0;
+
+	fprintf(out, "nodes          %d within %d m\n", nnodes, radius);
+	fprintf(out, "sensor period  %u s\n", res->period);
+	fprintf(out, "min SF         %u\n", res->min_sf);
+	fprintf(out, "fading         %.0f dB\n", fading);
+	fprintf(out, "time           %.0f s\n", secs(sim_time));
+	fprintf(out, "reboots        %u\n", reboots);
+	fprintf(out, "joins          %u sent, %u accepted\n",
+	    air_stats.joins, ns_stats.join_accepts);
+	fprintf(out, "uplinks        %u sent, %u delivered (%.1f%%, %u "
+	    "payload bytes)\n", air_stats.uplinks, ns_stats.uplinks, res->pdr,
+	    ns_stats.uplink_bytes);
+	fprintf(out, "readings       %u delivered, %.2f per uplink, %.2f "
+	    "payload bytes each\n", ns_stats.readings, ns_stats.uplinks ?
+	    (double)ns_stats.readings / ns_stats.uplinks : 0,
+	    ns_stats.readings ?
+	    (double)ns_stats.uplink_bytes / ns_stats.readings : 0);
+	fprintf(out, "lost           %u too weak, %u collisions, %u while "
+	    "gateway sent, %u jammed\n", air_stats.lost_weak,
+	    air_stats.lost_collision, air_stats.lost_gw_tx,
+	    air_stats.lost_jammed);
+	fprintf(out, "bad frames     %u, %u payloads not decoded\n",
+	    ns_stats.bad_frames, ns_stats.bad_payloads);
+	fprintf(out, "downlinks      %u sent, %u gateway busy, %u received, "
+	    "%u rx timeouts\n", ns_stats.downlinks, air_stats.dl_busy,
+	    rxframes, rxtouts);
+	fprintf(out, "adr            %u requests\n", ns_stats.adr_requests);
+	fprintf(out, "commands       %u queued, %u heard after %.1f s (max "
+	    "%.1f s)\n", ns_stats.commands, ns_stats.commands_heard,
+	    ns_stats.commands_heard ?
+	    secs(ns_stats.command_wait) / ns_stats.commands_heard : 0,
+	    secs(ns_stats.max_command_wait));
+	fprintf(out, "radio tx       %.3f s per node (max %.3f s)\n",
+	    res->airtime, secs(maxtx));
+	fprintf(out, "radio rx       %.3f s per node\n", secs(rx) / nnodes);
+	fprintf(out, "energy         %.3f J per node, %.1f uJ per delivered "
+	    "byte\n", res->energy, res->per_byte);
+	fprintf(out, "per uplink     %.1f mJ per delivered uplink\n",
+	    ns_stats.uplinks ? joules * 1e3 / ns_stats.uplinks : 0);
+	fprintf(out, "lbt            %u CADs, %u busy\n", cads, cadbusy);
+	fprintf(out, "data age       %.3f s per reading (max %.3f s)\n",
+	    readings ? secs(age) / readings : 0, secs(maxage));
+	fprintf(out, "sleeps         %u (%u long, %u watchdog wake-ups "
+	    "avoided)\n", sleeps, longs, avoided);
+	fprintf(out, "wake-ups       %.1f per node per hour%s\n",
+	    wakeups * 3600 / secs(t) / nnodes,
+	    sim_noslack ? ", timed jobs without slack" : "");
+	fprintf(out, "busy-wait      %.3f s, %.3f s in WFI, %.0f us per "
+	    "uplink\n", secs(busy), secs(wfi), air_stats.uplinks ?
+	    secs(busy) * 1e6 / air_stats.uplinks : 0);
+	fprintf(out, "nvms writes    %u bytes, %u raw sector erases\n",
+	    nvms_writes, nvms_erases);
+	fflush(out);
+	sim_free();
+}
+
+/* Parse a comma separated list of numbers */
+static int
+parse_list(char *s, long long min, long long max, u4_t *list,
+    const char *what)
+{
+	const char	*errstr;
+	char		*p;
+	int		 n = 0;
+
+	while ((p = strsep(&s, ",")) != NULL) {
+		if (n == MAX_RUNS)
+			errx(1, "too many %ss", what);
+		list[n++] = strtonum(p, min, max, &errstr);
+		if (errstr)
+			errx(1, "%s is %s: %s", what, errstr, p);
+	}
+	return n;
+}
+
+static __dead void
+usage(void)
+{
+	fprintf(stderr, "usage: minimal [-acktvx] [-b seconds] [-d seconds] "
+	    "[-f sf,...] [-g dB]\n"
+	    "               [-h seconds] [-j kHz,...] [-m samples] "
+	    "[-n nodes]\n"
+	    "               [-p seconds,...] [-q seconds] [-r metres] "
+	    "[-s seed]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct result	 res[MAX_RUNS * MAX_RUNS], *r;
+	const char	*errstr;
+	long long	 duration = DEFAULT_DURATION;
+	u4_t		 seed = 1, periods[MAX_RUNS] = { 0 }, sfs[MAX_RUNS] = { 0 };
+	u4_t		 jam[MAX_RUNS];
+	int		 ch, verbose = 0, nnodes = 1, radius = DEFAULT_RADIUS;
+	int		 nperiods = 1, nsfs = 1, njam, i, j;
+
+	while ((ch = getopt(argc, argv, "ab:cd:f:g:h:j:km:n:p:q:r:s:tvx")) != -1) {
+		switch (ch) {
+		case 'a':
+			device_adr = 1;
+			break;
+		case 'b':
+			reboot_period = strtonum(optarg, 1,
+			    365 * 24 * 60 * 60, &errstr);
+			if (errstr)
+				errx(1, "reboot period is %s: %s", errstr,
+				    optarg);
+			break;
+		case 'c':
+			vbus = 1;
+			break;
+		case 'd':
+			duration = strtonum(optarg, 1, 365 * 24 * 60 * 60,
+			    &errstr);
+			if (errstr)
+				errx(1, "duration is %s: %s", errstr, optarg);
+			break;
+		case 'f':
+			nsfs = parse_list(optarg, 7, 12, sfs, "min SF");
+			break;
+		case 'g':
+			fading = strtonum(optarg, 0, 20, &errstr);
+			if (errstr)
+				errx(1, "fading is %s: %s", errstr, optarg);
+			break;
+		case 'h':
+			heartbeat = strtonum(optarg, 1, 24 * 60 * 60, &errstr);
+			if (errstr)
+				errx(1, "heartbeat is %s: %s", errstr, optarg);
+			break;
+		case 'j':
+			njam = parse_list(optarg, 1, 1000000, jam, "channel");
+			for (i = 0; i < njam; i++)
+				air_jam(jam[i] * 1000);
+			break;
+		case 'k':
+			region = REGION_KR;
+			break;
+		case 'm':
+			batch = strtonum(optarg, 1, 254, &errstr);
+			if (errstr)
+				errx(1, "samples is %s: %s", errstr, optarg);
+			break;
+		case 'n':
+			nnodes = strtonum(optarg, 1, MAX_NODES, &errstr);
+			if (errstr)
+				errx(1, "nodes is %s: %s", errstr, optarg);
+			break;
+		case 'p':
+			nperiods = parse_list(optarg, 1, 24 * 60 * 60,
+			    periods, "sensor period");
+			break;
+		case 'q':
+			cmd_period = strtonum(optarg, 1, 365 * 24 * 60 * 60,
+			    &errstr);
+			if (errstr)
+				errx(1, "command period is %s: %s", errstr,
+				    optarg);
+			break;
+		case 'r':
+			radius = strtonum(optarg, 1, 100000, &errstr);
+			if (errstr)
+				errx(1, "radius is %s: %s", errstr, optarg);
+			break;
+		case 's':
+			seed = strtonum(optarg, 1, UINT32_MAX, &errstr);
+			if (errstr)
+				errx(1, "seed is %s: %s", errstr, optarg);
+			break;
+		case 't':
+			steady = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'x':
+			sim_noslack = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	/* The summary always goes to stdout, firmware debug output with -v */
+	if ((out = fdopen(dup(STDOUT_FILENO), "w")) == NULL)
+		err(1, "fdopen");
+	if (!verbose && freopen("/dev/null", "w", stdout) == NULL)
+		err(1, "/dev/null");
+
+	r = res;
+	for (i = 0; i < nperiods; i++) {
+		for (j = 0; j < nsfs; j++) {
+			if (r != res)
+				fprintf(out, "\n");
+			run(r++, nnodes, periods[i], sfs[j], radius, seed,
+			    duration);
+		}
+	}
+	if (r - res > 1) {
+		fprintf(out, "\nperiod  min SF     PDR  airtime/node  "
+		    "energy/node  uJ/byte\n");
+		for (i = 0; i < r - res; i++) {
+			fprintf(out, "%5u s  %6u  %5.1f%%  %10.3f s  "
+			    "%9.3f J  %7.1f\n", res[i].period, res[i].min_sf,
+			    res[i].pdr, res[i].airtime, res[i].energy,
+			    res[i].per_byte);
+		}
+	}
+	return 0;
+}
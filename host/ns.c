@@ -0,0 +1,582 @@
+/*
+ * Stand-in LoRaWAN 1.0 network server for the host build.  Accepts
+ * joins from known devices, checks and decrypts their uplinks, and
+ * answers when a device asks for it (confirmed frame, ADR acknowledgement
+ * request, link check) or when ADR wants to change its data rate or TX
+ * power.  Answers go out in RX1, or in RX2 if the gateway is busy then.
+ *
+ * The application may also queue a command for every device now and
+ * then.  It goes with the answer to the next uplink, and to devices in
+ * class C also at once on RX2, again every CMD_RETRY until they hear it.
+ *
+ * ADR follows the usual network server algorithm: take the best SNR of
+ * the last ADR_HISTORY uplinks, subtract the demodulation floor of the
+ * SF and an installation margin, and spend every ADR_STEP dB left on a
+ * faster data rate first and a lower TX power after that.
+ */
+
+#include "lmic/lmic.h"
+#include "host/air.h"
+#include "host/decode.h"
+#include "host/ns.h"
+#include "host/refaes.h"
+#include "host/sim.h"
+#include "lora/util.h"
+
+#define NS_MAX_DEVICES	1024
+#define NETID		0x000013
+
+#define DL_POWER	14	/* dBm */
+
+#define ADR_HISTORY	20
+#define ADR_MARGIN	10	/* dB */
+#define ADR_STEP	3	/* dB per data rate or TX power step */
+#define ADR_CHMASK	0x003f	/* Channels the firmware enables in EU868 */
+#define ADR_MAX_DR	5	/* SF7 */
+#define ADR_DEFAULT_POW	1	/* 14 dBm */
+#define ADR_MAX_POW	5	/* 2 dBm */
+
+#define CMD_PORT	1
+#define CMD_RETRY	sec2osticks(30)
+/* Get the sensor period, see doc/PROTO */
+static const u1_t	command[] = { 0x01, 0x03 };
+
+struct ns_device {
+	u1_t		deveui[8];
+	struct refaes	devkey;
+	struct refaes	nwkskey;
+	struct refaes	appskey;
+	u4_t		devaddr;
+	u4_t		fcntup;
+	u4_t		fcntdn;
+	u1_t		session;	/* Joined and heard from since */
+	u1_t		max_dr;		/* Fastest data rate the device uses */
+	u1_t		pow;		/* TX power index last requested */
+	s1_t		snr[ADR_HISTORY];
+	u1_t		nsnr;		/* SNRs recorded since the last change */
+	u1_t		class_c;	/* Listens between uplinks */
+	u8_t		cmd_queued;	/* Command waiting since, 0: none */
+	u8_t		cmd_next;	/* Time to queue or send it next */
+};
+
+struct ns_stats		ns_stats;
+
+static struct ns_device	devices[NS_MAX_DEVICES];
+static int		ndevices;
+static u4_t		appnonce;
+static u4_t		rx2_freq;
+static u8_t		cmd_period;	/* Mean ticks between commands */
+static u8_t		cmd_next = ~0ULL;	/* Earliest of the devices */
+static u4_t		cmd_rng = 1;
+
+void
+ns_reset(void)
+{
+	ndevices = 0;
+	appnonce = 0;
+	rx2_freq = FREQ_DNW2_EU;
+	cmd_period = 0;
+	cmd_next = ~0ULL;
+	memset(&ns_stats, 0, sizeof(ns_stats));
+}
+
+/* Frequency of RX2, which the region sets */
+void
+ns_set_rx2(u4_t freq)
+{
+	rx2_freq = freq;
+}
+
+/*
+ * Have the application queue a command for every device period seconds
+ * apart on average, at times drawn with seed.  Call before adding them.
+ */
+void
+ns_set_commands(u4_t period, u4_t seed)
+{
+	cmd_period = (u8_t)period * OSTICKS_PER_SEC;
+	cmd_rng = seed ? seed : 1;
+}
+
+/* Queue the next command of dev at random, cmd_period from now on average */
+static void
+cmd_schedule(struct ns_device *dev)
+{
+	/* xorshift32 */
+	cmd_rng ^= cmd_rng << 13;
+	cmd_rng ^= cmd_rng >> 17;
+	cmd_rng ^= cmd_rng << 5;
+	dev->cmd_next = sim_time + 1 +
+	    (u8_t)(cmd_rng / 4294967296.0 * 2 * cmd_period);
+	if (dev->cmd_next < cmd_next)
+		cmd_next = dev->cmd_next;
+}
+
+void
+ns_add_device(const u1_t *deveui, const u1_t *devkey, u1_t max_dr,
+    int class_c)
+{
+	struct ns_device	*dev;
+
+	if (ndevices >= NS_MAX_DEVICES)
+		hal_failed();
+	dev = devices + ndevices++;
+	memset(dev, 0, sizeof(*dev));
+	memcpy(dev->deveui, deveui, sizeof(dev->deveui));
+	refaes_init(&dev->devkey, devkey);
+	dev->max_dr = max_dr < ADR_MAX_DR ? max_dr : ADR_MAX_DR;
+	dev->class_c = class_c;
+	dev->cmd_next = ~0ULL;
+	if (cmd_period)
+		cmd_schedule(dev);
+}
+
+static struct ns_device *
+device(u4_t devaddr)
+{
+	struct ns_device	*dev;
+
+	for (dev = devices; dev < devices + ndevices; dev++) {
+		if (dev->devaddr == devaddr && devaddr != 0)
+			return dev;
+	}
+	return NULL;
+}
+
+static int
+mic_ok(const struct refaes *key, const u1_t *b0, const u1_t *msg, int len)
+{
+	u1_t	buf[16 + MAX_LEN_FRAME], mac[16];
+	int	off = 0;
+
+	if (b0) {
+		memcpy(buf, b0, 16);
+		off = 16;
+	}
+	memcpy(buf + off, msg, len);
+	refaes_cmac(key, buf, off + len, mac);
+	return memcmp(mac, msg + len, 4) == 0;
+}
+
+static void
+append_mic(const struct refaes *key, const u1_t *b0, u1_t *msg, int len)
+{
+	u1_t	buf[16 + MAX_LEN_FRAME], mac[16];
+	int	off = 0;
+
+	if (b0) {
+		memcpy(buf, b0, 16);
+		off = 16;
+	}
+	memcpy(buf + off, msg, len);
+	refaes_cmac(key, buf, off + len, mac);
+	memcpy(msg + len, mac, 4);
+}
+
+static void
+block(u1_t *b, u1_t first, int dndir, u4_t devaddr, u4_t fcnt, u1_t last)
+{
+	memset(b, 0, 16);
+	b[0] = first;
+	b[5] = dndir;
+	os_wlsbf4(b + 6, devaddr);
+	os_wlsbf4(b + 10, fcnt);
+	b[15] = last;
+}
+
+static void
+cipher(const struct refaes *key, int dndir, u4_t devaddr, u4_t fcnt,
+    u1_t *data, int len)
+{
+	u1_t	a[16];
+	int	i, n;
+
+	for (n = 1; len > 0; n++) {
+		block(a, 0x01, dndir, devaddr, fcnt, n);
+		refaes_encrypt(key, a);
+		for (i = 0; i < 16 && i < len; i++)
+			data[i] ^= a[i];
+		data += 16;
+		len -= 16;
+	}
+}
+
+/*
+ * Hand a downlink to the gateway for RX1 of the uplink, or RX2 if the
+ * gateway already transmits then.
+ */
+static void
+schedule(const struct sim_frame *up, int delay, const u1_t *data, int len)
+{
+	struct sim_frame	dl;
+
+	memset(&dl, 0, sizeof(dl));
+	dl.freq = up->freq;
+	dl.sf = up->sf;
+	dl.bw = up->bw;
+	dl.cr = up->cr;
+	dl.iq = 1;
+	dl.power = DL_POWER;
+	dl.len = len;
+	memcpy(dl.data, data, len);
+	dl.start = up->end + sec2osticks(delay);
+	dl.end = dl.start + sx1276_airtime(&dl);
+	if (air_downlink(&dl)) {
+		ns_stats.downlinks++;
+		return;
+	}
+	dl.freq = rx2_freq;
+	dl.sf = 12;
+	dl.bw = 125;
+	dl.start = up->end + sec2osticks(delay + DELAY_EXTDNW2);
+	dl.end = dl.start + sx1276_airtime(&dl);
+	if (air_downlink(&dl))
+		ns_stats.downlinks++;
+}
+
+/* Append the command queued for dev as the payload of downlink dn */
+static int
+add_command(struct ns_device *dev, u1_t *dn, int dnlen)
+{
+	dn[dnlen++] = CMD_PORT;
+	memcpy(dn + dnlen, command, sizeof(command));
+	cipher(&dev->appskey, 1, dev->devaddr, dev->fcntdn, dn + dnlen,
+	    sizeof(command));
+	return dnlen + sizeof(command);
+}
+
+/*
+ * Fill in the header of downlink dn to dev, but for FCtrl, and append
+ * the MIC.  Return the length of the frame.
+ */
+static int
+seal(struct ns_device *dev, u1_t *dn, int dnlen)
+{
+	u1_t	b0[16];
+
+	dn[OFF_DAT_HDR] = HDR_FTYPE_DADN | HDR_MAJOR_V1;
+	os_wlsbf4(dn + OFF_DAT_ADDR, dev->devaddr);
+	os_wlsbf2(dn + OFF_DAT_SEQNO, dev->fcntdn);
+	block(b0, 0x49, 1, dev->devaddr, dev->fcntdn, dnlen);
+	append_mic(&dev->nwkskey, b0, dn, dnlen);
+	dev->fcntdn++;
+	return dnlen + 4;
+}
+
+static void
+session_key(struct refaes *key, const struct refaes *devkey, u1_t type,
+    const u1_t *nonces, u2_t devnonce)
+{
+	u1_t	b[16] = { type };
+
+	memcpy(b + 1, nonces, LEN_ARTNONCE + LEN_NETID);
+	os_wlsbf2(b + 1 + LEN_ARTNONCE + LEN_NETID, devnonce);
+	refaes_encrypt(devkey, b);
+	refaes_init(key, b);
+}
+
+static void
+join(const struct sim_frame *f)
+{
+	struct ns_device	*dev;
+	u1_t			ja[LEN_JA];
+	int			i;
+
+	if (f->len != LEN_JR)
+		goto bad;
+	for (dev = devices; dev < devices + ndevices; dev++) {
+		if (memcmp(dev->deveui, f->data + OFF_JR_DEVEUI, 8) == 0)
+			break;
+	}
+	if (dev == devices + ndevices ||
+	    !mic_ok(&dev->devkey, NULL, f->data, OFF_JR_MIC))
+		goto bad;
+	ns_stats.join_requests++;
+
+	appnonce++;
+	memset(ja, 0, sizeof(ja));
+	ja[OFF_JA_HDR] = HDR_FTYPE_JACC | HDR_MAJOR_V1;
+	ja[OFF_JA_ARTNONCE + 0] = appnonce;
+	ja[OFF_JA_ARTNONCE + 1] = appnonce >> 8;
+	ja[OFF_JA_ARTNONCE + 2] = appnonce >> 16;
+	ja[OFF_JA_NETID + 0] = NETID;
+	ja[OFF_JA_NETID + 1] = NETID >> 8;
+	ja[OFF_JA_NETID + 2] = NETID >> 16;
+	dev->devaddr = (NETID & 0x7f) << 25 | (dev - devices + 1);
+	os_wlsbf4(ja + OFF_JA_DEVADDR, dev->devaddr);
+	ja[OFF_JA_RXDLY] = DELAY_DNW1;
+	append_mic(&dev->devkey, NULL, ja, LEN_JA - 4);
+
+	session_key(&dev->nwkskey, &dev->devkey, 0x01, ja + OFF_JA_ARTNONCE,
+	    os_rlsbf2(f->data + OFF_JR_DEVNONCE));
+	session_key(&dev->appskey, &dev->devkey, 0x02, ja + OFF_JA_ARTNONCE,
+	    os_rlsbf2(f->data + OFF_JR_DEVNONCE));
+	dev->fcntup = 0;
+	dev->fcntdn = 0;
+	dev->session = 0;
+	dev->nsnr = 0;
+	dev->pow = ADR_DEFAULT_POW;
+
+	/* The device encrypts the join accept to decrypt it */
+	for (i = 1; i < LEN_JA; i += 16)
+		refaes_decrypt(&dev->devkey, ja + i);
+	schedule(f, DELAY_JACC1, ja, LEN_JA);
+	ns_stats.join_accepts++;
+	return;
+bad:
+	ns_stats.bad_frames++;
+}
+
+/* Length of uplink MAC commands, including the CID */
+static int
+cmdlen(u1_t cid)
+{
+	switch (cid) {
+	case MCMD_LCHK_REQ:
+	case MCMD_DCAP_ANS:
+	case MCMD_TXPS_ANS:
+		return 1;
+	case MCMD_LADR_ANS:
+	case MCMD_DN2P_ANS:
+	case MCMD_SNCH_ANS:
+		return 2;
+	case MCMD_DEVS_ANS:
+		return 3;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Record the SNR of an uplink with ADR enabled and append a LinkADRReq
+ * to the answer in opts if the device should change its settings.
+ * Return the length of the command.
+ */
+static int
+adr(struct ns_device *dev, const struct sim_frame *f, u1_t *opts)
+{
+	int	i, dr, pow, margin, nstep;
+
+	dev->snr[dev->nsnr++ % ADR_HISTORY] = f->snr;
+	if (dev->nsnr < ADR_HISTORY)
+		return 0;
+	dev->nsnr = ADR_HISTORY;
+	margin = dev->snr[0];
+	for (i = 1; i < ADR_HISTORY; i++) {
+		if (dev->snr[i] > margin)
+			margin = dev->snr[i];
+	}
+	margin -= air_snr_floor(f->sf) + ADR_MARGIN;
+	/* Round down, also when negative */
+	nstep = margin >= 0 ? margin / ADR_STEP :
+	    -((-margin + ADR_STEP - 1) / ADR_STEP);
+
+	/* The data rate shows in the frame, the TX power does not */
+	dr = 12 - f->sf;
+	pow = dev->pow;
+	for (; nstep > 0 && dr < dev->max_dr; nstep--)
+		dr++;
+	for (; nstep > 0 && pow < ADR_MAX_POW; nstep--)
+		pow++;
+	for (; nstep < 0 && pow > ADR_DEFAULT_POW; nstep++)
+		pow--;
+	if (dr == 12 - f->sf && pow == dev->pow)
+		return 0;
+
+	opts[0] = MCMD_LADR_REQ;
+	opts[1] = dr << MCMD_LADR_DR_SHIFT | pow << MCMD_LADR_POW_SHIFT;
+	os_wlsbf2(opts + 2, ADR_CHMASK);
+	opts[4] = 0;
+	/* Start over at the new settings */
+	dev->pow = pow;
+	dev->nsnr = 0;
+	ns_stats.adr_requests++;
+	return 5;
+}
+
+static void
+data(const struct sim_frame *f)
+{
+	struct ns_device	*dev;
+	const u1_t		*opts;
+	u1_t			 b0[16], dn[MAX_LEN_FRAME];
+	u4_t			 devaddr, fcnt;
+	int			 i, len, optlen, dnlen, reply;
+
+	len = f->len - 4;
+	if (len < OFF_DAT_OPTS)
+		goto bad;
+	devaddr = os_rlsbf4(f->data + OFF_DAT_ADDR);
+	if ((dev = device(devaddr)) == NULL)
+		goto bad;
+	/* Extend the counter to the closest value not below the last one */
+	fcnt = os_rlsbf2(f->data + OFF_DAT_SEQNO);
+	if (dev->session) {
+		fcnt |= (dev->fcntup - 1) & ~0xffff;
+		if (fcnt < dev->fcntup - 1)
+			fcnt += 0x10000;
+	}
+	block(b0, 0x49, 0, devaddr, fcnt, len);
+	if (!mic_ok(&dev->nwkskey, b0, f->data, len))
+		goto bad;
+	reply = (f->data[OFF_DAT_HDR] & HDR_FTYPE) == HDR_FTYPE_DCUP ||
+	    (f->data[OFF_DAT_FCT] & FCT_ADRARQ);
+	if (!dev->session || fcnt >= dev->fcntup) {
+		/* New frame, not a retransmission */
+		optlen = f->data[OFF_DAT_FCT] & FCT_OPTLEN;
+		if (len > OFF_DAT_OPTS + optlen + 1) {
+			u1_t	payload[MAX_LEN_FRAME];
+			u1_t	port = f->data[OFF_DAT_OPTS + optlen];
+			int	plen = len - OFF_DAT_OPTS - optlen - 1, n;
+
+			memcpy(payload, f->data + OFF_DAT_OPTS + optlen + 1,
+			    plen);
+			cipher(port ? &dev->appskey : &dev->nwkskey, 0,
+			    devaddr, fcnt, payload, plen);
+			ns_stats.uplink_bytes += plen;
+			if (port == CMD_PORT && (n = decode_uplink(payload,
+			    plen, NULL, NULL)) != -1)
+				ns_stats.readings += n;
+			else if (port == CMD_PORT)
+				ns_stats.bad_payloads++;
+		}
+		ns_stats.uplinks++;
+	}
+	dev->session = 1;
+	dev->fcntup = fcnt + 1;
+
+	/* Answer MAC commands piggybacked in FOpts */
+	dnlen = OFF_DAT_OPTS;
+	opts = f->data + OFF_DAT_OPTS;
+	optlen = f->data[OFF_DAT_FCT] & FCT_OPTLEN;
+	for (i = 0; i < optlen && cmdlen(opts[i]) > 0; i += cmdlen(opts[i])) {
+		if (opts[i] == MCMD_LCHK_REQ) {
+			dn[dnlen++] = MCMD_LCHK_ANS;
+			dn[dnlen++] = f->snr > air_snr_floor(f->sf) ?
+			    f->snr - air_snr_floor(f->sf) : 0;
+			dn[dnlen++] = 1;
+			reply = 1;
+		}
+	}
+	if (f->data[OFF_DAT_FCT] & FCT_ADREN) {
+		int	adrlen = adr(dev, f, dn + dnlen);
+
+		dnlen += adrlen;
+		reply |= adrlen > 0;
+	}
+	dn[OFF_DAT_FCT] = (dnlen - OFF_DAT_OPTS) |
+	    ((f->data[OFF_DAT_HDR] & HDR_FTYPE) == HDR_FTYPE_DCUP ?
+	    FCT_ACK : 0);
+	/* A command waiting goes along */
+	if (dev->cmd_queued) {
+		dnlen = add_command(dev, dn, dnlen);
+		reply = 1;
+	}
+	if (!reply)
+		return;
+	schedule(f, DELAY_DNW1, dn, seal(dev, dn, dnlen));
+	return;
+bad:
+	ns_stats.bad_frames++;
+}
+
+void
+ns_uplink(const struct sim_frame *f)
+{
+	if (f->iq || f->len == 0)
+		return;
+	switch (f->data[0] & HDR_FTYPE) {
+	case HDR_FTYPE_JREQ:
+		join(f);
+		break;
+	case HDR_FTYPE_DAUP:
+	case HDR_FTYPE_DCUP:
+		data(f);
+		break;
+	default:
+		ns_stats.bad_frames++;
+		break;
+	}
+}
+
+/* Send the command queued for dev in class C, on RX2 now */
+static void
+send_command(struct ns_device *dev)
+{
+	struct sim_frame	dl;
+	u1_t			dn[MAX_LEN_FRAME];
+
+	memset(&dl, 0, sizeof(dl));
+	dl.freq = rx2_freq;
+	dl.sf = 12;
+	dl.bw = 125;
+	dl.cr = 1;
+	dl.iq = 1;
+	dl.power = DL_POWER;
+	dn[OFF_DAT_FCT] = 0;
+	dl.len = seal(dev, dn, add_command(dev, dn, OFF_DAT_OPTS));
+	memcpy(dl.data, dn, dl.len);
+	dl.start = sim_time;
+	dl.end = dl.start + sx1276_airtime(&dl);
+	if (air_downlink(&dl))
+		ns_stats.downlinks++;
+}
+
+/* Time of the next command to queue or send */
+u8_t
+ns_next(void)
+{
+	return cmd_next;
+}
+
+/* Queue the commands that are due, and send those for class C devices */
+void
+ns_run(void)
+{
+	struct ns_device	*dev;
+
+	if (sim_time < cmd_next)
+		return;
+	cmd_next = ~0ULL;
+	for (dev = devices; dev < devices + ndevices; dev++) {
+		if (dev->cmd_next <= sim_time) {
+			if (!dev->cmd_queued) {
+				dev->cmd_queued = sim_time;
+				ns_stats.commands++;
+			}
+			/* Else it waits for the next uplink */
+			dev->cmd_next = ~0ULL;
+			if (dev->class_c && dev->session) {
+				send_command(dev);
+				dev->cmd_next = sim_time + CMD_RETRY;
+			}
+		}
+		if (dev->cmd_next < cmd_next)
+			cmd_next = dev->cmd_next;
+	}
+}
+
+/*
+ * A device received the downlink data: if it is the command queued for
+ * it, i.e. has a payload, note how long that took and queue the next.
+ */
+void
+ns_heard(const u1_t *data, int len)
+{
+	struct ns_device	*dev;
+	u8_t			 wait;
+
+	if (len < OFF_DAT_OPTS + 4 ||
+	    (data[OFF_DAT_HDR] & HDR_FTYPE) != HDR_FTYPE_DADN ||
+	    len <= OFF_DAT_OPTS + (data[OFF_DAT_FCT] & FCT_OPTLEN) + 4 ||
+	    (dev = device(os_rlsbf4(data + OFF_DAT_ADDR))) == NULL ||
+	    !dev->cmd_queued)
+		return;
+	wait = sim_time - dev->cmd_queued;
+	ns_stats.commands_heard++;
+	ns_stats.command_wait += wait;
+	if (wait > ns_stats.max_command_wait)
+		ns_stats.max_command_wait = wait;
+	dev->cmd_queued = 0;
+	cmd_schedule(dev);
+}
@@ -0,0 +1,38 @@
+/* Stand-in LoRaWAN network server for the host build */
+
+#ifndef __HOST_NS_H__
+#define __HOST_NS_H__
+
+#include "lmic/oslmic.h"
+
+struct sim_frame;
+
+struct ns_stats {
+	u4_t	join_requests;
+	u4_t	join_accepts;
+	u4_t	uplinks;		/* Data frames accepted */
+	u4_t	uplink_bytes;		/* Application payload in those */
+	u4_t	readings;		/* Sensor readings in those */
+	u4_t	bad_payloads;		/* Not decoded */
+	u4_t	bad_frames;		/* Unknown device, bad MIC, replay */
+	u4_t	downlinks;
+	u4_t	adr_requests;		/* LinkADRReq sent */
+	u4_t	commands;		/* Queued by the application */
+	u4_t	commands_heard;		/* Received by their device */
+	u8_t	command_wait;		/* Ticks from queuing to that */
+	u8_t	max_command_wait;
+};
+
+extern struct ns_stats	ns_stats;
+
+void	ns_reset(void);
+void	ns_set_rx2(u4_t freq);
+void	ns_set_commands(u4_t period, u4_t seed);
+void	ns_add_device(const u1_t *deveui, const u1_t *devkey, u1_t max_dr,
+	    int class_c);
+void	ns_uplink(const struct sim_frame *f);
+void	ns_heard(const u1_t *data, int len);
+u8_t	ns_next(void);
+void	ns_run(void);
+
+#endif /* __HOST_NS_H__ */
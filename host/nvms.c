@@ -0,0 +1,215 @@
+/* In-memory NVMS and NVPARAM for the host build */
+
+#include <string.h>
+
+#define NVPARAM_AREA_TABLES
+#include <ad_nvparam.h>
+#include <platform_nvparam.h>
+
+#include "host/nvms.h"
+#include "host/sim.h"
+#include "lora/util.h"
+
+struct nvms_part {
+	nvms_partition_id_t	id;
+	bool			ves;	/* Behind VES on the target */
+};
+
+/* As in the partition tables of the SDK, with dg_configNVMS_VES */
+static const struct nvms_part	parts[NVMS_PARTS] = {
+	[NVMS_FIRMWARE_PART]	= { NVMS_FIRMWARE_PART },
+	[NVMS_PARAM_PART]	= { NVMS_PARAM_PART },
+	[NVMS_BIN_PART]		= { NVMS_BIN_PART },
+	[NVMS_LOG_PART]		= { NVMS_LOG_PART },
+	[NVMS_GENERIC_PART]	= { NVMS_GENERIC_PART, true },
+};
+
+struct nvparam_area {
+	const char			*name;
+	nvms_partition_id_t		 part;
+	uint32_t			 offset;
+	const struct nvparam_param	*params;
+	int				 nparams;
+};
+
+#define AREA(name)	{						\
+	#name, name ## _area_part, name ## _area_offset,		\
+	name ## _area_params, ARRAY_SIZE(name ## _area_params)		\
+}
+
+static const struct nvparam_area	areas[] = {
+	AREA(ble_platform),
+	AREA(ble_app),
+};
+
+void
+nvms_format(struct nvms *nvms)
+{
+	memset(nvms, 0, sizeof(*nvms));
+	memset(nvms->mem, 0xff, sizeof(nvms->mem));
+	nvms->formatted = true;
+}
+
+static uint8_t *
+nvms_mem(nvms_t handle, uint32_t addr, uint32_t len)
+{
+	if (!sim_node->nvms.formatted)
+		nvms_format(&sim_node->nvms);
+	if (handle == NULL || addr > NVMS_PART_SIZE ||
+	    len > NVMS_PART_SIZE - addr)
+		return NULL;
+	return sim_node->nvms.mem[handle->id] + addr;
+}
+
+nvms_t
+ad_nvms_open(nvms_partition_id_t id)
+{
+	if (id >= NVMS_PARTS)
+		return NULL;
+	return &parts[id];
+}
+
+size_t
+ad_nvms_get_size(nvms_t handle)
+{
+	return handle ? NVMS_PART_SIZE : 0;
+}
+
+int
+ad_nvms_read(nvms_t handle, uint32_t addr, uint8_t *buf, uint32_t len)
+{
+	uint8_t	*mem;
+
+	if ((mem = nvms_mem(handle, addr, len)) == NULL)
+		return -1;
+	memcpy(buf, mem, len);
+	return len;
+}
+
+/*
+ * Count the sectors from addr to addr + size as erased.  VES remaps
+ * writes and erases on a schedule of its own, which is not modelled, so
+ * only raw partitions count.
+ */
+static void
+nvms_erased(nvms_t handle, uint32_t addr, uint32_t size)
+{
+	if (size == 0 || handle->ves)
+		return;
+	sim_node->nvms.erases[handle->id] +=
+	    (addr + size - 1) / NVMS_SECTOR_SIZE - addr / NVMS_SECTOR_SIZE + 1;
+}
+
+/*
+ * Like the SDK's driver for flash partitions, erase and rewrite the
+ * sectors where a write would need to set bits.
+ */
+int
+ad_nvms_write(nvms_t handle, uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+	uint8_t		*mem;
+	uint32_t	 i, first = size, last = 0;
+
+	if ((mem = nvms_mem(handle, addr, size)) == NULL)
+		return -1;
+	for (i = 0; i < size; i++) {
+		if ((mem[i] & buf[i]) != buf[i]) {
+			if (first == size)
+				first = i;
+			last = i;
+		}
+	}
+	if (first != size)
+		nvms_erased(handle, addr + first, last - first + 1);
+	memcpy(mem, buf, size);
+	sim_node->nvms.writes[handle->id] += size;
+	return size;
+}
+
+bool
+ad_nvms_erase_region(nvms_t handle, uint32_t addr, size_t size)
+{
+	uint8_t	*mem;
+
+	if ((mem = nvms_mem(handle, addr, size)) == NULL)
+		return false;
+	memset(mem, 0xff, size);
+	nvms_erased(handle, addr, size);
+	return true;
+}
+
+nvparam_t
+ad_nvparam_open(const char *name)
+{
+	int	i;
+
+	for (i = 0; i < (int)ARRAY_SIZE(areas); i++) {
+		if (strcmp(areas[i].name, name) == 0)
+			return &areas[i];
+	}
+	return NULL;
+}
+
+static const struct nvparam_param *
+find_param(nvparam_t area, uint8_t tag)
+{
+	int	i;
+
+	if (area == NULL)
+		return NULL;
+	for (i = 0; i < area->nparams; i++) {
+		if (area->params[i].tag == tag)
+			return &area->params[i];
+	}
+	return NULL;
+}
+
+uint16_t
+ad_nvparam_get_length(nvparam_t area, uint8_t tag, uint16_t *max_len)
+{
+	const struct nvparam_param	*p;
+
+	if ((p = find_param(area, tag)) == NULL)
+		return 0;
+	if (max_len)
+		*max_len = p->length;
+	return p->length;
+}
+
+uint16_t
+ad_nvparam_read_offset(nvparam_t area, uint8_t tag, uint16_t offset,
+    uint16_t length, void *data)
+{
+	const struct nvparam_param	*p;
+
+	if ((p = find_param(area, tag)) == NULL || offset >= p->length)
+		return 0;
+	if (length > p->length - offset)
+		length = p->length - offset;
+	if (ad_nvms_read(ad_nvms_open(area->part),
+	    area->offset + p->offset + offset, data, length) < 0)
+		return 0;
+	return length;
+}
+
+uint16_t
+ad_nvparam_read(nvparam_t area, uint8_t tag, uint16_t length, void *data)
+{
+	return ad_nvparam_read_offset(area, tag, 0, length, data);
+}
+
+uint16_t
+ad_nvparam_write(nvparam_t area, uint8_t tag, uint16_t length,
+    const void *data)
+{
+	const struct nvparam_param	*p;
+
+	if ((p = find_param(area, tag)) == NULL)
+		return 0;
+	if (length > p->length)
+		length = p->length;
+	if (ad_nvms_write(ad_nvms_open(area->part), area->offset + p->offset,
+	    data, length) < 0)
+		return 0;
+	return length;
+}
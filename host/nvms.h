@@ -0,0 +1,24 @@
+/* In-memory NVMS backing the host build */
+
+#ifndef __HOST_NVMS_H__
+#define __HOST_NVMS_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <ad_nvms.h>
+
+#define NVMS_PART_SIZE		0x3000
+#define NVMS_SECTOR_SIZE	0x1000
+
+/* Flash contents of one node; survives reboots */
+struct nvms {
+	bool		formatted;
+	uint32_t	writes[NVMS_PARTS];	/* Bytes written */
+	uint32_t	erases[NVMS_PARTS];	/* Sectors erased, not in VES */
+	uint8_t		mem[NVMS_PARTS][NVMS_PART_SIZE];
+};
+
+void	nvms_format(struct nvms *nvms);
+
+#endif /* __HOST_NVMS_H__ */
@@ -0,0 +1,169 @@
+/*
+ * Byte-oriented reference AES-128 (FIPS-197) and CMAC (RFC 4493).
+ * Independent of lmic/aes.c so that the host network server checks
+ * the firmware's crypto rather than reusing it.
+ */
+
+#include "host/refaes.h"
+
+static u1_t	sbox[256], isbox[256];
+
+static u1_t
+xtime(u1_t x)
+{
+	return (x << 1) ^ (x & 0x80 ? 0x1b : 0);
+}
+
+static u1_t
+mul(u1_t a, u1_t b)
+{
+	u1_t	p = 0;
+
+	while (b) {
+		if (b & 1)
+			p ^= a;
+		a = xtime(a);
+		b >>= 1;
+	}
+	return p;
+}
+
+static void
+init_sbox(void)
+{
+	int	i, j;
+	u1_t	inv, s;
+
+	for (i = 0; i < 256; i++) {
+		for (inv = 0, j = 1; i && j < 256; j++) {
+			if (mul(i, j) == 1) {
+				inv = j;
+				break;
+			}
+		}
+		s = inv;
+		for (j = 1; j <= 4; j++)
+			s ^= (u1_t)(inv << j | inv >> (8 - j));
+		sbox[i] = s ^ 0x63;
+		isbox[sbox[i]] = i;
+	}
+}
+
+void
+refaes_init(struct refaes *ctx, const u1_t *key)
+{
+	u1_t	t[4], rcon = 1;
+	int	i;
+
+	if (sbox[0] == 0)
+		init_sbox();
+	memcpy(ctx->rk[0], key, 16);
+	for (i = 1; i < 11; i++) {
+		t[0] = sbox[ctx->rk[i - 1][13]] ^ rcon;
+		t[1] = sbox[ctx->rk[i - 1][14]];
+		t[2] = sbox[ctx->rk[i - 1][15]];
+		t[3] = sbox[ctx->rk[i - 1][12]];
+		rcon = xtime(rcon);
+		for (int j = 0; j < 16; j++) {
+			ctx->rk[i][j] = ctx->rk[i - 1][j] ^
+			    (j < 4 ? t[j] : ctx->rk[i][j - 4]);
+		}
+	}
+}
+
+static void
+add_round_key(u1_t *s, const u1_t *rk)
+{
+	for (int i = 0; i < 16; i++)
+		s[i] ^= rk[i];
+}
+
+void
+refaes_encrypt(const struct refaes *ctx, u1_t *s)
+{
+	u1_t	t[16];
+	int	r, c, i;
+
+	add_round_key(s, ctx->rk[0]);
+	for (r = 1; r < 11; r++) {
+		/* SubBytes and ShiftRows */
+		for (i = 0; i < 16; i++)
+			t[i] = sbox[s[(i + 4 * (i % 4)) % 16]];
+		/* MixColumns */
+		for (c = 0; c < 4 && r < 10; c++) {
+			u1_t	*a = t + 4 * c, x = a[0] ^ a[1] ^ a[2] ^ a[3];
+			u1_t	a0 = a[0];
+
+			a[0] ^= x ^ xtime(a[0] ^ a[1]);
+			a[1] ^= x ^ xtime(a[1] ^ a[2]);
+			a[2] ^= x ^ xtime(a[2] ^ a[3]);
+			a[3] ^= x ^ xtime(a[3] ^ a0);
+		}
+		memcpy(s, t, 16);
+		add_round_key(s, ctx->rk[r]);
+	}
+}
+
+void
+refaes_decrypt(const struct refaes *ctx, u1_t *s)
+{
+	u1_t	t[16];
+	int	r, c, i;
+
+	add_round_key(s, ctx->rk[10]);
+	for (r = 9; r >= 0; r--) {
+		/* InvShiftRows and InvSubBytes */
+		for (i = 0; i < 16; i++)
+			t[(i + 4 * (i % 4)) % 16] = isbox[s[i]];
+		memcpy(s, t, 16);
+		add_round_key(s, ctx->rk[r]);
+		/* InvMixColumns */
+		for (c = 0; c < 4 && r > 0; c++) {
+			u1_t	*a = s + 4 * c;
+
+			memcpy(t, a, 4);
+			for (i = 0; i < 4; i++) {
+				a[i] = mul(t[i], 14) ^
+				    mul(t[(i + 1) % 4], 11) ^
+				    mul(t[(i + 2) % 4], 13) ^
+				    mul(t[(i + 3) % 4], 9);
+			}
+		}
+	}
+}
+
+static void
+shift_left(u1_t *k)
+{
+	u1_t	carry = k[0] & 0x80 ? 0x87 : 0;
+
+	for (int i = 0; i < 15; i++)
+		k[i] = k[i] << 1 | k[i + 1] >> 7;
+	k[15] = k[15] << 1 ^ carry;
+}
+
+void
+refaes_cmac(const struct refaes *ctx, const u1_t *msg, int len, u1_t *mac)
+{
+	u1_t	k[16] = { 0 };
+	int	i;
+
+	refaes_encrypt(ctx, k);
+	shift_left(k);
+	memset(mac, 0, 16);
+	while (len > 16) {
+		for (i = 0; i < 16; i++)
+			mac[i] ^= *msg++;
+		refaes_encrypt(ctx, mac);
+		len -= 16;
+	}
+	if (len < 16) {
+		shift_left(k);
+		mac[len] ^= 0x80;
+	}
+	for (i = 0; i < len; i++)
+		mac[i] ^= msg[i];
+	for (i = 0; i < 16; i++)
+		mac[i] ^= k[i];
+	refaes_encrypt(ctx, mac);
+}
@@ -0,0 +1,18 @@
+/* Byte-oriented reference AES-128 for the host build */
+
+#ifndef __HOST_REFAES_H__
+#define __HOST_REFAES_H__
+
+#include "lmic/oslmic.h"
+
+struct refaes {
+	u1_t	rk[11][16];	/* Round keys */
+};
+
+void	refaes_init(struct refaes *ctx, const u1_t *key);
+void	refaes_encrypt(const struct refaes *ctx, u1_t *block);
+void	refaes_decrypt(const struct refaes *ctx, u1_t *block);
+void	refaes_cmac(const struct refaes *ctx, const u1_t *msg, int len,
+	    u1_t *mac);
+
+#endif /* __HOST_REFAES_H__ */
@@ -0,0 +1,235 @@
+/*
+ * Scheduler of the host simulation.  Every node runs the firmware's main
+ * loop in a coroutine with a stack and a copy of the firmware RAM, i.e. the
+ * PRIVILEGED_DATA sections, of its own; the copy is swapped in when the
+ * node runs.  Nodes sleep until a virtual time, and the scheduler resumes
+ * them and decides frames on the shared channel in time order.
+ */
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lmic/oslmic.h"
+#include "lmic/hal.h"
+#include "lora/lora.h"
+#include "host/air.h"
+#include "host/ns.h"
+#include "host/sim.h"
+
+#define STACK_SIZE	(128 * 1024)
+
+/* Firmware RAM, see sdk_defs.h */
+extern char	__start_fwbss[], __stop_fwbss[];
+extern char	__start_fwdata[], __stop_fwdata[];
+
+#define BSS_SIZE	((size_t)(__stop_fwbss - __start_fwbss))
+#define DATA_SIZE	((size_t)(__stop_fwdata - __start_fwdata))
+
+u8_t			 sim_time;
+struct sim_node		*sim_node;
+struct sim_node		*sim_nodes;
+int			 sim_nnodes;
+int			 sim_noslack;
+
+static u8_t		 sim_stop;
+static char		*fwdata;	/* Initialised data as linked */
+static struct sim_node	*ram_owner;	/* Node whose RAM is loaded */
+static struct sim_node	**heap;		/* Run queue, earliest wake first */
+static ucontext_t	 sched_ctx;
+
+static int
+before(const struct sim_node *a, const struct sim_node *b)
+{
+	return a->wake < b->wake || (a->wake == b->wake && a->idx < b->idx);
+}
+
+static void
+heap_set(int i, struct sim_node *n)
+{
+	heap[i] = n;
+	n->heap = i;
+}
+
+/* Move n to its place in the run queue after its wake time changed */
+static void
+heap_fix(struct sim_node *n)
+{
+	int	i = n->heap, c;
+
+	while (i > 0 && before(n, heap[(i - 1) / 2])) {
+		heap_set(i, heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	while ((c = 2 * i + 1) < sim_nnodes) {
+		if (c + 1 < sim_nnodes && before(heap[c + 1], heap[c]))
+			c++;
+		if (!before(heap[c], n))
+			break;
+		heap_set(i, heap[c]);
+		i = c;
+	}
+	heap_set(i, n);
+}
+
+void
+sim_init(int nnodes)
+{
+	struct sim_node	*n;
+
+	if (fwdata == NULL) {
+		if ((fwdata = malloc(DATA_SIZE)) == NULL)
+			err(1, NULL);
+		memcpy(fwdata, __start_fwdata, DATA_SIZE);
+	}
+	if ((sim_nodes = calloc(nnodes, sizeof(*sim_nodes))) == NULL ||
+	    (heap = calloc(nnodes, sizeof(*heap))) == NULL)
+		err(1, NULL);
+	sim_nnodes = nnodes;
+	sim_time = 1;
+	ram_owner = NULL;
+	for (n = sim_nodes; n < sim_nodes + nnodes; n++) {
+		if ((n->ram = malloc(BSS_SIZE + DATA_SIZE)) == NULL)
+			err(1, NULL);
+		memset(n->ram, 0, BSS_SIZE);
+		memcpy(n->ram + BSS_SIZE, fwdata, DATA_SIZE);
+		n->idx = n - sim_nodes;
+		n->wake = ~0ULL;
+		heap_set(n->idx, n);
+		nvms_format(&n->nvms);
+		sx1276_reset(&n->radio);
+	}
+	air_reset();
+	ns_reset();
+}
+
+void
+sim_free(void)
+{
+	struct sim_node	*n;
+
+	for (n = sim_nodes; n < sim_nodes + sim_nnodes; n++) {
+		free(n->stack);
+		free(n->ram);
+	}
+	free(sim_nodes);
+	free(heap);
+	sim_nodes = sim_node = ram_owner = NULL;
+	heap = NULL;
+	sim_nnodes = 0;
+}
+
+/* Make n the current node and load its firmware RAM */
+void
+sim_select(struct sim_node *n)
+{
+	sim_node = n;
+	if (ram_owner == n)
+		return;
+	if (ram_owner) {
+		memcpy(ram_owner->ram, __start_fwbss, BSS_SIZE);
+		memcpy(ram_owner->ram + BSS_SIZE, __start_fwdata, DATA_SIZE);
+	}
+	memcpy(__start_fwbss, n->ram, BSS_SIZE);
+	memcpy(__start_fwdata, n->ram + BSS_SIZE, DATA_SIZE);
+	ram_owner = n;
+}
+
+/* Power-on and reset: start the firmware from a clean RAM image */
+static void
+node_main(void)
+{
+	setjmp(sim_node->boot);
+	memset(__start_fwbss, 0, BSS_SIZE);
+	memcpy(__start_fwdata, fwdata, DATA_SIZE);
+	hal_periph_init();
+	lora_task_func(NULL);
+	errx(1, "node %d: firmware returned", sim_node->idx);
+}
+
+void
+sim_start(struct sim_node *n, u8_t when)
+{
+	if (n->stack == NULL && (n->stack = malloc(STACK_SIZE)) == NULL)
+		err(1, NULL);
+	if (getcontext(&n->ctx) == -1)
+		err(1, "getcontext");
+	n->ctx.uc_stack.ss_sp = n->stack;
+	n->ctx.uc_stack.ss_size = STACK_SIZE;
+	n->ctx.uc_link = NULL;
+	makecontext(&n->ctx, node_main, 0);
+	n->wake = when;
+	heap_fix(n);
+}
+
+void
+sim_reboot(void)
+{
+	sim_node->reboots++;
+	longjmp(sim_node->boot, 1);
+}
+
+/* Events of the channel and the network server */
+static u8_t
+next_event(void)
+{
+	u8_t	air = air_next(), ns = ns_next();
+
+	return air < ns ? air : ns;
+}
+
+/*
+ * Suspend the current node until the given time.  Carry on without a
+ * context switch if nothing else happens before then.
+ */
+void
+sim_sleep(u8_t until)
+{
+	struct sim_node	*n = sim_node;
+
+	n->wake = until;
+	heap_fix(n);
+	if (heap[0] == n && until < sim_stop && until < next_event()) {
+		sim_time = until;
+		return;
+	}
+	if (swapcontext(&n->ctx, &sched_ctx) == -1)
+		err(1, "swapcontext");
+}
+
+/* Resume the sleeping node n at when, if it would sleep longer */
+void
+sim_wake(struct sim_node *n, u8_t when)
+{
+	if (when < n->wake) {
+		n->wake = when;
+		heap_fix(n);
+	}
+}
+
+/* Run the nodes, the channel and the network server until stop */
+void
+sim_run(u8_t stop)
+{
+	struct sim_node	*n;
+	u8_t		 ev;
+
+	sim_stop = stop;
+	for (;;) {
+		n = heap[0];
+		ev = next_event();
+		if (ev <= n->wake && ev < stop) {
+			sim_time = ev;
+			air_run();
+			ns_run();
+			continue;
+		}
+		if (n->wake >= stop)
+			break;
+		sim_time = n->wake;
+		sim_select(n);
+		if (swapcontext(&sched_ctx, &n->ctx) == -1)
+			err(1, "swapcontext");
+	}
+	sim_time = stop;
+}
@@ -0,0 +1,82 @@
+/* Discrete-event simulation of a network of nodes for the host build */
+
+#ifndef __HOST_SIM_H__
+#define __HOST_SIM_H__
+
+#include <setjmp.h>
+#include <ucontext.h>
+
+#include "lmic/oslmic.h"
+#include "host/nvms.h"
+#include "host/sx1276.h"
+
+/* A frame on the air */
+struct sim_frame {
+	u8_t	start;		/* Start of preamble */
+	u8_t	end;		/* End of last symbol */
+	u4_t	freq;		/* Hz */
+	u1_t	sf;		/* 7..12 */
+	u2_t	bw;		/* kHz */
+	u1_t	cr;		/* 1..4 for 4/5..4/8 */
+	u1_t	crc;		/* Payload CRC present */
+	u1_t	iq;		/* Inverted IQ, i.e. downlink */
+	s1_t	power;		/* TX power, dBm */
+	s2_t	rssi;		/* At the receiver, dBm */
+	s1_t	snr;		/* At the receiver, dB */
+	u1_t	len;
+	u1_t	data[256];
+};
+
+/* GPS receiver feeding NMEA sentences into the UART */
+struct sim_gps {
+	char	line[96];
+	int	pos, len;
+	u8_t	next;		/* Time of the next sentence */
+};
+
+/* Hardware of a simulated node; survives reboots of the firmware */
+struct sim_node {
+	struct sx1276	radio;
+	struct nvms	nvms;
+	struct sim_gps	gps;
+	u4_t		rng;		/* TRNG state */
+	u8_t		busy;		/* Ticks spent busy-waiting */
+	u8_t		wfi;		/* Ticks spent waiting in WFI */
+	u4_t		wakeups;	/* Times the run loop slept and woke */
+	u8_t		sampled;	/* Temperature last read, 0: sent */
+	u8_t		data_age;	/* Ticks from reading to sending */
+	u8_t		max_data_age;
+	u4_t		data_sent;	/* Readings sent */
+	u4_t		reboots;
+	u8_t		reboot_period;	/* Power cycled this often, 0: never */
+	u8_t		reboot_at;
+	u1_t		vbus;		/* On external power */
+	u1_t		steady;		/* Temperature holds, as indoors */
+	int		pathloss;	/* To the gateway, dB */
+	double		x, y;		/* From the gateway, m */
+
+	/* Each node runs the firmware in a coroutine of its own */
+	int		idx;
+	int		heap;		/* Position in the run queue */
+	u8_t		wake;		/* Time to resume at */
+	char		*ram;		/* Firmware RAM while not running */
+	ucontext_t	ctx;
+	void		*stack;
+	jmp_buf		boot;
+};
+
+extern u8_t		 sim_time;	/* Simulated time in ticks */
+extern struct sim_node	*sim_node;	/* Node currently running */
+extern struct sim_node	*sim_nodes;
+extern int		 sim_nnodes;
+
+void	sim_init(int nnodes);
+void	sim_free(void);
+void	sim_select(struct sim_node *n);
+void	sim_start(struct sim_node *n, u8_t when);
+void	sim_run(u8_t stop);
+void	sim_sleep(u8_t until);
+void	sim_wake(struct sim_node *n, u8_t when);
+void	sim_reboot(void) __attribute__((__noreturn__));
+
+#endif /* __HOST_SIM_H__ */
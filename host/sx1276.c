@@ -0,0 +1,375 @@
+/*
+ * Fake SX1276 for the host build.  Keeps a register file and FIFO that
+ * radio.c talks to through hal_spi(), and turns LoRa mode changes into
+ * frames on the shared channel: TX puts the frame on the air, RX looks
+ * for a gateway transmission inside the window, or from then on when
+ * continuous, CAD and the RSSI listen to what the other nodes and the
+ * gateway send.
+ * FSK is not modelled.
+ */
+
+#include "lmic/oslmic.h"
+#include "lmic/lorabase.h"
+#include "host/air.h"
+#include "host/ns.h"
+#include "host/sim.h"
+#include "host/sx1276.h"
+#include "lora/util.h"
+
+#define RegFifo			0x00
+#define RegOpMode		0x01
+#define RegFrfMsb		0x06
+#define RegFrfMid		0x07
+#define RegFrfLsb		0x08
+#define RegPaConfig		0x09
+#define RegFifoAddrPtr		0x0D
+#define RegFifoTxBaseAddr	0x0E
+#define RegFifoRxBaseAddr	0x0F
+#define RegFifoRxCurrentAddr	0x10
+#define RegIrqFlagsMask		0x11
+#define RegIrqFlags		0x12
+#define RegRxNbBytes		0x13
+#define RegPktSnrValue		0x19
+#define RegPktRssiValue		0x1A
+#define RegRssiValue		0x1B
+#define RegModemConfig1		0x1D
+#define RegModemConfig2		0x1E
+#define RegSymbTimeoutLsb	0x1F
+#define RegPreambleMsb		0x20
+#define RegPreambleLsb		0x21
+#define RegPayloadLength	0x22
+#define RegPayloadMaxLength	0x23
+#define RegModemConfig3		0x26
+#define RegInvertIQ		0x33
+#define RegVersion		0x42
+
+#define OPMODE_LORA		0x80
+#define OPMODE_MASK		0x07
+#define OPMODE_SLEEP		0x00
+#define OPMODE_STANDBY		0x01
+#define OPMODE_TX		SX1276_MODE_TX
+#define OPMODE_RX		SX1276_MODE_RX
+#define OPMODE_RX_SINGLE	SX1276_MODE_RX_SINGLE
+#define OPMODE_CAD		SX1276_MODE_CAD
+
+#define IRQ_RXTOUT		0x80
+#define IRQ_RXDONE		0x40
+#define IRQ_TXDONE		0x08
+#define IRQ_CDDONE		0x04
+#define IRQ_CDDETD		0x01
+
+#define NOISE_FLOOR		(-120)	/* dBm */
+/* Symbols a CAD listens for */
+#define CAD_SYMS		2
+/* Preamble symbols the receiver needs to lock on */
+#define MIN_DETECT_SYMS		4
+
+#define ACCESS_IDLE		0
+#define ACCESS_ADDR		1
+#define ACCESS_READ		2
+#define ACCESS_WRITE		3
+
+void
+sx1276_reset(struct sx1276 *r)
+{
+	memset(r->regs, 0, sizeof(r->regs));
+	r->regs[RegOpMode] = 0x09;
+	r->regs[RegFrfMsb] = 0x6c;
+	r->regs[RegFrfMid] = 0x80;
+	r->regs[RegPaConfig] = 0x4f;
+	r->regs[RegModemConfig1] = 0x72;
+	r->regs[RegModemConfig2] = 0x70;
+	r->regs[RegSymbTimeoutLsb] = 0x64;
+	r->regs[RegPreambleLsb] = 0x08;
+	r->regs[RegPayloadLength] = 0x01;
+	r->regs[RegInvertIQ] = 0x27;
+	r->regs[RegVersion] = 0x12;
+	r->access = ACCESS_IDLE;
+	r->mode_since = sim_time;
+	r->irq_time = 0;
+	r->irq_flags = 0;
+}
+
+/* LoRa time on air, in ticks */
+u8_t
+sx1276_airtime(const struct sim_frame *f)
+{
+	s4_t	tsym, npay, de, ih = 0;
+
+	tsym = (1 << f->sf) * 1000 / f->bw;	/* us */
+	de = f->sf >= 11 && f->bw == 125;
+	npay = 8 * f->len - 4 * f->sf + 28 + 16 * f->crc - 20 * ih;
+	npay = npay > 0 ?
+	    (npay + 4 * (f->sf - 2 * de) - 1) / (4 * (f->sf - 2 * de)) *
+	    (f->cr + 4) : 0;
+	npay += 8;
+	return us2osticksRound((STD_PREAMBLE_LEN * 4 + 17) * tsym / 4 +
+	    npay * tsym);
+}
+
+static ostime_t
+symtime(u1_t sf, u2_t bw)
+{
+	return us2osticksRound((1 << sf) * 1000 / bw);
+}
+
+/* Radio settings from the register file, as a frame template */
+static void
+settings(struct sx1276 *r, struct sim_frame *f, int tx)
+{
+	static const u2_t	bws[] = { [7] = 125, [8] = 250, [9] = 500 };
+	u1_t			mc1 = r->regs[RegModemConfig1];
+
+	memset(f, 0, sizeof(*f));
+	f->freq = (u4_t)(((u8_t)r->regs[RegFrfMsb] << 16 |
+	    r->regs[RegFrfMid] << 8 | r->regs[RegFrfLsb]) * 32000000 >> 19);
+	f->sf = r->regs[RegModemConfig2] >> 4;
+	f->bw = (mc1 >> 4) < ARRAY_SIZE(bws) ? bws[mc1 >> 4] : 0;
+	f->cr = (mc1 >> 1) & 0x07;
+	f->crc = (r->regs[RegModemConfig2] & 0x04) != 0;
+	/* Bit 6 inverts RX, clearing bit 0 inverts TX */
+	f->iq = tx ? !(r->regs[RegInvertIQ] & 0x01) :
+	    (r->regs[RegInvertIQ] & 0x40) != 0;
+	f->power = (r->regs[RegPaConfig] & 0x0f) + 2;
+	if (f->bw == 0)
+		hal_failed();
+}
+
+static void
+start_tx(struct sx1276 *r)
+{
+	struct sim_frame	f;
+
+	settings(r, &f, 1);
+	f.len = r->regs[RegPayloadLength];
+	memcpy(f.data, r->fifo + r->regs[RegFifoTxBaseAddr], f.len);
+	f.start = sim_time;
+	f.end = sim_time + sx1276_airtime(&f);
+	r->irq_time = f.end;
+	r->irq_flags = IRQ_TXDONE;
+	r->tx_frames++;
+	/* The first frame after a reading carries it */
+	if (sim_node->sampled) {
+		sim_node->data_age += sim_time - sim_node->sampled;
+		if (sim_time - sim_node->sampled > sim_node->max_data_age)
+			sim_node->max_data_age = sim_time - sim_node->sampled;
+		sim_node->data_sent++;
+		sim_node->sampled = 0;
+	}
+	air_uplink(sim_node, &f);
+}
+
+/* Receive for node n, from the start of the RX mode on */
+static void
+start_rx(struct sx1276 *r, const struct sim_node *n, int single)
+{
+	struct sim_frame	f, dl;
+	ostime_t		tsym;
+	u8_t			from, to;
+	int			syms;
+
+	settings(r, &f, 0);
+	tsym = symtime(f.sf, f.bw);
+	syms = r->regs[RegSymbTimeoutLsb] |
+	    (r->regs[RegModemConfig2] & 0x03) << 8;
+	/*
+	 * Lock on a preamble if at least MIN_DETECT_SYMS of it are left
+	 * and are heard before the symbol timeout.  A frame longer than
+	 * RegPayloadMaxLength fails its header and is dropped.
+	 */
+	from = r->mode_since - (STD_PREAMBLE_LEN - MIN_DETECT_SYMS) * tsym;
+	to = single ? r->mode_since + (syms - MIN_DETECT_SYMS) * tsym : ~0ULL;
+	if (air_receive(n, &f, from, to, &dl) &&
+	    dl.len <= r->regs[RegPayloadMaxLength]) {
+		r->irq_time = dl.end;
+		r->irq_flags = IRQ_RXDONE;
+		r->rx_len = dl.len;
+		r->rx_rssi = dl.rssi;
+		r->rx_snr = dl.snr;
+		memcpy(r->rx_data, dl.data, dl.len);
+	} else if (single) {
+		r->irq_time = r->mode_since + syms * tsym;
+		r->irq_flags = IRQ_RXTOUT;
+	}
+}
+
+/*
+ * The gateway has a new frame to send: let node n hear it if its radio
+ * receives continuously and has not locked on a frame yet.
+ */
+void
+sx1276_listen(struct sim_node *n)
+{
+	struct sx1276	*r = &n->radio;
+
+	if ((r->regs[RegOpMode] & (OPMODE_LORA | OPMODE_MASK)) !=
+	    (OPMODE_LORA | OPMODE_RX) || r->irq_time != 0)
+		return;
+	start_rx(r, n, 0);
+	if (r->irq_time != 0)
+		sim_wake(n, r->irq_time);
+}
+
+static void
+start_cad(struct sx1276 *r)
+{
+	struct sim_frame	f;
+	int			detected;
+
+	settings(r, &f, 0);
+	r->irq_time = sim_time + CAD_SYMS * symtime(f.sf, f.bw);
+	air_sense(sim_node, &f, sim_time, r->irq_time, &detected);
+	r->irq_flags = IRQ_CDDONE | (detected ? IRQ_CDDETD : 0);
+	r->cads++;
+	r->cad_detected += detected;
+}
+
+static u1_t
+rssi(struct sx1276 *r)
+{
+	struct sim_frame	f;
+	int			dbm, detected;
+
+	if ((r->regs[RegOpMode] & OPMODE_MASK) != OPMODE_RX)
+		return NOISE_FLOOR + 164;
+	settings(r, &f, 0);
+	dbm = air_sense(sim_node, &f, sim_time, sim_time + 1, &detected);
+	return (dbm > NOISE_FLOOR ? dbm : NOISE_FLOOR) + 164;
+}
+
+/* Charge the time since the last mode change to the current mode */
+void
+sx1276_account(struct sx1276 *r)
+{
+	u1_t	mode = r->regs[RegOpMode] & OPMODE_MASK;
+	u8_t	dt = sim_time - r->mode_since;
+
+	r->mode_ticks[mode] += dt;
+	if (mode == OPMODE_TX)
+		r->tx_ticks[(r->regs[RegPaConfig] & 0x0f) + 2] += dt;
+	r->mode_since = sim_time;
+}
+
+static void
+set_mode(struct sx1276 *r, u1_t val)
+{
+	sx1276_account(r);
+	r->regs[RegOpMode] = val;
+	r->irq_time = 0;
+	if (!(val & OPMODE_LORA))
+		return;
+	switch (val & OPMODE_MASK) {
+	case OPMODE_TX:
+		start_tx(r);
+		break;
+	case OPMODE_RX:
+		start_rx(r, sim_node, 0);
+		break;
+	case OPMODE_RX_SINGLE:
+		start_rx(r, sim_node, 1);
+		break;
+	case OPMODE_CAD:
+		start_cad(r);
+		break;
+	}
+}
+
+/*
+ * Raise the pending IRQ, the time of which has come.  Return 1 if it
+ * asserts a DIO line, i.e. if the host should run radio_irq_handler().
+ */
+int
+sx1276_irq(struct sx1276 *r)
+{
+	u1_t	flags = r->irq_flags;
+
+	r->irq_time = 0;
+	r->irq_flags = 0;
+	if (flags & IRQ_RXDONE) {
+		memcpy(r->fifo + r->regs[RegFifoRxBaseAddr], r->rx_data,
+		    r->rx_len);
+		r->regs[RegFifoRxCurrentAddr] = r->regs[RegFifoRxBaseAddr];
+		r->regs[RegRxNbBytes] = r->rx_len;
+		/* The SNR saturates; below the noise, the RSSI is the noise */
+		r->regs[RegPktSnrValue] = (u1_t)(r->rx_snr > 31 ? 127 :
+		    r->rx_snr * 4);
+		r->regs[RegPktRssiValue] = (u1_t)((r->rx_snr < 0 ?
+		    r->rx_rssi - r->rx_snr : r->rx_rssi) + 164);
+		r->rx_frames++;
+		ns_heard(r->rx_data, r->rx_len);
+	} else if (flags & IRQ_RXTOUT) {
+		r->rx_timeouts++;
+	}
+	r->regs[RegIrqFlags] |= flags;
+	if ((r->regs[RegOpMode] & OPMODE_MASK) != OPMODE_RX) {
+		sx1276_account(r);
+		r->regs[RegOpMode] = (r->regs[RegOpMode] & ~OPMODE_MASK) |
+		    OPMODE_STANDBY;
+	}
+	return (flags & ~r->regs[RegIrqFlagsMask]) != 0;
+}
+
+static u1_t
+read_reg(struct sx1276 *r, u1_t addr)
+{
+	switch (addr) {
+	case RegFifo:
+		return r->fifo[r->regs[RegFifoAddrPtr]++];
+	case RegRssiValue:
+		return rssi(r);
+	default:
+		return r->regs[addr];
+	}
+}
+
+static void
+write_reg(struct sx1276 *r, u1_t addr, u1_t val)
+{
+	switch (addr) {
+	case RegFifo:
+		r->fifo[r->regs[RegFifoAddrPtr]++] = val;
+		break;
+	case RegOpMode:
+		set_mode(r, val);
+		break;
+	case RegIrqFlags:
+		r->regs[RegIrqFlags] &= ~val;
+		break;
+	case RegVersion:
+		break;
+	default:
+		r->regs[addr] = val;
+		break;
+	}
+}
+
+void
+sx1276_select(struct sx1276 *r, int sel)
+{
+	r->access = sel ? ACCESS_ADDR : ACCESS_IDLE;
+}
+
+u1_t
+sx1276_spi(struct sx1276 *r, u1_t out)
+{
+	u1_t	in = 0;
+
+	switch (r->access) {
+	case ACCESS_ADDR:
+		r->addr = out & 0x7f;
+		r->access = out & 0x80 ? ACCESS_WRITE : ACCESS_READ;
+		return 0;
+	case ACCESS_READ:
+		in = read_reg(r, r->addr);
+		break;
+	case ACCESS_WRITE:
+		write_reg(r, r->addr, out);
+		break;
+	default:
+		hal_failed();
+	}
+	/* Bursts auto-increment the address, except on the FIFO */
+	if (r->addr != RegFifo)
+		r->addr = (r->addr + 1) & 0x7f;
+	return in;
+}
@@ -0,0 +1,49 @@
+/* Fake SX1276 register file behind hal_spi() */
+
+#ifndef __HOST_SX1276_H__
+#define __HOST_SX1276_H__
+
+#include "lmic/oslmic.h"
+
+struct sim_frame;
+struct sim_node;
+
+/* Modes of RegOpMode, indexing mode_ticks */
+#define SX1276_MODES		8
+#define SX1276_MODE_TX		3
+#define SX1276_MODE_RX		5
+#define SX1276_MODE_RX_SINGLE	6
+#define SX1276_MODE_CAD		7
+/* Output power in dBm on PA_BOOST, indexing tx_ticks */
+#define SX1276_POWERS		18
+
+struct sx1276 {
+	u1_t	regs[0x80];
+	u1_t	fifo[0x100];
+	u1_t	addr;			/* Register of the SPI access */
+	u1_t	access;			/* SPI access state */
+	u8_t	mode_since;		/* Time of the last mode change */
+	u8_t	irq_time;		/* Time of the pending IRQ, 0 if none */
+	u1_t	irq_flags;		/* Flags raised at irq_time */
+	u1_t	rx_len;			/* Frame received at irq_time */
+	s2_t	rx_rssi;
+	s1_t	rx_snr;
+	u1_t	rx_data[0x100];
+	u8_t	mode_ticks[SX1276_MODES];	/* Time spent per mode */
+	u8_t	tx_ticks[SX1276_POWERS];	/* Time in TX per power */
+	u4_t	tx_frames;
+	u4_t	rx_frames;
+	u4_t	rx_timeouts;
+	u4_t	cads;
+	u4_t	cad_detected;
+};
+
+void	sx1276_reset(struct sx1276 *r);
+void	sx1276_select(struct sx1276 *r, int sel);
+u1_t	sx1276_spi(struct sx1276 *r, u1_t out);
+int	sx1276_irq(struct sx1276 *r);
+void	sx1276_account(struct sx1276 *r);
+void	sx1276_listen(struct sim_node *n);
+u8_t	sx1276_airtime(const struct sim_frame *f);
+
+#endif /* __HOST_SX1276_H__ */
@@ -0,0 +1,239 @@
+/*
+ * LMIC's os_aes() on the AES/HASH engine.  The engine expands the key
+ * itself and moves the data by DMA, so a frame costs a little setup
+ * instead of the software key schedule and table lookups per block.
+ * CTR runs as it is; the CMAC is CBC over the message with its last block
+ * masked by the subkey, of which the last output block is the tag.
+ *
+ * The engine is shared with the BLE stack through the crypto adapter.
+ * When it is taken, fall back to the software AES in lmic/aes.c.
+ */
+
+#include <ad_crypto.h>
+#include <hw_aes_hash.h>
+
+#include "lmic/lmic.h"
+#include "hw/aes.h"
+
+#define BLOCK		16
+/* Longest message: the MIC block B0 and a whole frame, padded */
+#define MAX_MSG		((BLOCK + MAX_LEN_FRAME + BLOCK - 1) & ~(BLOCK - 1))
+
+/* Only used within a call, so it need not be retained */
+static uint8_t	msg[MAX_MSG], out[MAX_MSG];
+
+/* Run the configured mode over len bytes of msg into out */
+static void
+aes_run(unsigned int len)
+{
+	hw_aes_hash_cfg_dma(msg, out, len);
+	hw_aes_hash_mark_input_block_as_last();
+	hw_aes_hash_encrypt();
+	while (hw_aes_hash_is_active())
+		;
+}
+
+/* Multiply a CMAC subkey by x in GF(2^128) */
+static void
+aes_dbl(uint8_t *k)
+{
+	uint8_t	carry = k[0] & 0x80 ? 0x87 : 0;
+	int	i;
+
+	for (i = 0; i < BLOCK - 1; i++)
+		k[i] = k[i] << 1 | k[i + 1] >> 7;
+	k[BLOCK - 1] = k[BLOCK - 1] << 1 ^ carry;
+}
+
+static u4_t
+aes_cmac(u1_t mode, const uint8_t *buf, u2_t len)
+{
+	uint8_t	k[BLOCK];
+	int	i, n = 0;
+
+	/* Subkey K1 from the encrypted zero block */
+	memset(msg, 0, BLOCK);
+	hw_aes_hash_cfg_aes_ecb(HW_AES_128);
+	aes_run(BLOCK);
+	memcpy(k, out, BLOCK);
+	aes_dbl(k);
+
+	if (!(mode & AES_MICNOAUX)) {
+		memcpy(msg, AESaux, BLOCK);
+		n = BLOCK;
+	}
+	memcpy(msg + n, buf, len);
+	n += len;
+	if (n == 0 || n % BLOCK != 0) {
+		/* Pad, and use K2 */
+		msg[n++] = 0x80;
+		while (n % BLOCK != 0)
+			msg[n++] = 0;
+		aes_dbl(k);
+	}
+	for (i = 0; i < BLOCK; i++)
+		msg[n - BLOCK + i] ^= k[i];
+
+	memset(k, 0, BLOCK);
+	hw_aes_hash_cfg_aes_cbc(HW_AES_128);
+	hw_aes_hash_store_iv(k);
+	aes_run(n);
+	return os_rmsbf4(out + n - BLOCK);
+}
+
+static void
+aes_ctr(uint8_t *buf, u2_t len)
+{
+	hw_aes_hash_cfg_aes_ctr(HW_AES_128);
+	hw_aes_hash_store_ic(AESaux);
+	memcpy(msg, buf, len);
+	memset(msg + len, 0, -len & (BLOCK - 1));
+	aes_run((len + BLOCK - 1) & ~(BLOCK - 1));
+	memcpy(buf, out, len);
+}
+
+static void
+aes_ecb(uint8_t *buf, u2_t len)
+{
+	hw_aes_hash_cfg_aes_ecb(HW_AES_128);
+	memcpy(msg, buf, len);
+	aes_run(len);
+	memcpy(buf, out, len);
+}
+
+u4_t
+os_aes(u1_t mode, xref2u1_t buf, u2_t len)
+{
+	u4_t	mic = 0;
+
+	if (len > MAX_LEN_FRAME ||
+	    (!(mode & (AES_MIC | AES_CTR)) && len % BLOCK != 0) ||
+	    ad_crypto_acquire_aes_hash(0) != OS_MUTEX_TAKEN)
+		return os_aes_sw(mode, buf, len);
+	hw_aes_hash_enable_clock();
+	hw_aes_hash_keys_load(HW_AES_128, AESkey,
+	    HW_AES_HASH_KEY_EXP_BY_HW);
+	if (mode & AES_MIC)
+		mic = aes_cmac(mode, buf, len);
+	else if (mode & AES_CTR)
+		aes_ctr(buf, len);
+	else
+		aes_ecb(buf, len);
+	hw_aes_hash_disable_clock();
+	ad_crypto_release_aes_hash();
+	return mic;
+}
+
+#ifdef AES_BENCH
+
+#include <stdio.h>
+#include <sys_clock_mgr.h>
+
+/*
+ * Encrypt and sign a frame with the largest payload allowed at SF12 on
+ * each path, timed with SysTick at the CPU clock.  The energy counts
+ * the CPU only, at about 4 mA from 3.3 V, not the engine itself.
+ */
+#define BENCH_PAYLOAD	51
+#define BENCH_RUNS	16
+#define BENCH_UA	4000
+#define BENCH_MV	3300
+
+static const uint8_t	bench_key[BLOCK] = {
+	0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+	0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c,
+};
+
+#define BENCH_LEN	(OFF_DAT_OPTS + 1 + BENCH_PAYLOAD)
+
+static uint32_t
+bench_frame(u4_t (*aes)(u1_t, xref2u1_t, u2_t), uint8_t *frame)
+{
+	memset(AESaux, 0, BLOCK);
+	AESaux[0] = AESaux[15] = 1;
+	memcpy(AESkey, bench_key, BLOCK);
+	aes(AES_CTR, frame + OFF_DAT_OPTS + 1, BENCH_PAYLOAD);
+	memset(AESaux, 0, BLOCK);
+	AESaux[0] = 0x49;
+	AESaux[15] = BENCH_LEN;
+	memcpy(AESkey, bench_key, BLOCK);
+	return aes(AES_MIC, frame, BENCH_LEN);
+}
+
+static uint32_t
+bench_engine(uint8_t *frame)
+{
+	return bench_frame(os_aes, frame);
+}
+
+static uint32_t
+bench_software(uint8_t *frame)
+{
+	return bench_frame(os_aes_sw, frame);
+}
+
+/* Software, with the key expanded once as for a session, in one pass */
+static uint32_t
+bench_seal(uint8_t *frame)
+{
+	static u4_t	sched[AES_SCHED];
+
+	if (sched[0] == 0)
+		os_aesExpand(sched, bench_key);
+	memset(AESaux, 0, BLOCK);
+	AESaux[0] = AESaux[15] = 1;
+	return os_aesSeal(sched, sched, frame, OFF_DAT_OPTS + 1, BENCH_LEN);
+}
+
+static uint32_t
+bench(uint32_t (*run)(uint8_t *), uint8_t *frame, uint32_t *mic)
+{
+	uint32_t	ctrl = SysTick->CTRL, load = SysTick->LOAD;
+	uint32_t	start, cycles = 0;
+	int		i;
+
+	SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+	SysTick->VAL = 0;
+	SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+	for (i = 0; i < BENCH_RUNS; i++) {
+		memset(frame, i, MAX_LEN_FRAME);
+		start = SysTick->VAL;
+		*mic = run(frame);
+		cycles += (start - SysTick->VAL) & SysTick_LOAD_RELOAD_Msk;
+	}
+	SysTick->CTRL = ctrl;
+	SysTick->LOAD = load;
+	return cycles / BENCH_RUNS;
+}
+
+static void
+bench_print(const char *name, uint32_t cycles)
+{
+	uint32_t	mhz = cm_cpu_clk_get();
+
+	/* us times mA times V gives nJ */
+	printf("aes %s: %lu cycles, %lu us, %lu nJ per %d-byte frame\r\n",
+	    name, cycles, cycles / mhz,
+	    cycles / mhz * BENCH_UA / 1000 * BENCH_MV / 1000, BENCH_PAYLOAD);
+}
+
+void
+aes_bench(void)
+{
+	uint8_t		hwframe[MAX_LEN_FRAME], swframe[MAX_LEN_FRAME];
+	uint8_t		sealframe[MAX_LEN_FRAME];
+	uint32_t	hwcycles, swcycles, sealcycles, hwmic, swmic, sealmic;
+
+	hwcycles = bench(bench_engine, hwframe, &hwmic);
+	swcycles = bench(bench_software, swframe, &swmic);
+	sealcycles = bench(bench_seal, sealframe, &sealmic);
+	bench_print("engine", hwcycles);
+	bench_print("software", swcycles);
+	bench_print("software, expanded key", sealcycles);
+	if (hwmic != swmic || memcmp(hwframe, swframe, sizeof(hwframe)) != 0 ||
+	    sealmic != swmic ||
+	    memcmp(sealframe, swframe, sizeof(swframe)) != 0)
+		printf("aes engine and software disagree\r\n");
+}
+
+#endif /* AES_BENCH */
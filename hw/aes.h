@@ -0,0 +1,11 @@
+#ifndef __AES_H__
+#define __AES_H__
+
+/* Compare the crypto engine to software AES once at start-up */
+//#define AES_BENCH
+
+#ifdef AES_BENCH
+void	aes_bench(void);
+#endif
+
+#endif /* __AES_H__ */
@@ -32,7 +32,8 @@ button_cb(osjob_t *job)
 	}
 	else
 	{// If the button is still pressed check until released.
-	  os_setTimedCallback(job, now + ms2osticks(20), button_cb);
+	  os_setTimedCallbackSlack(job, now + ms2osticks(20), ms2osticks(10),
+	      button_cb);
 	}
 }
 
@@ -160,6 +160,48 @@ cmd_reset(int argc, char **argv)
 	hw_cpm_reboot_system();
 }
 
+static void
+cmd_stats(int argc, char **argv)
+{
+	const struct hal_sleep_stats	*ss = hal_sleepStats();
+	const struct hal_irq_stats	*is = hal_irqStats();
+	(void)argc;
+	(void)argv;
+
+	printf("sleeps %lu long %lu wakeups avoided %lu\r\n",
+	    (unsigned long)ss->sleeps, (unsigned long)ss->long_sleeps,
+	    (unsigned long)ss->wakeups_avoided);
+	printf("wait spin %lu us wfi %lu us, spin %lu us per uplink\r\n",
+	    (unsigned long)osticks2us(ss->spin),
+	    (unsigned long)osticks2us(ss->wfi),
+	    ss->txs ? (unsigned long)osticks2us(ss->spin) / ss->txs : 0);
+	printf("radio irqs %lu latency avg %lu max %lu us\r\n",
+	    (unsigned long)is->irqs,
+	    is->irqs ? (unsigned long)osticks2us(is->latency / is->irqs) : 0,
+	    (unsigned long)osticks2us(is->max_latency));
+	printf("next tx in %ld ms, airtime left %lu ms this hour\r\n",
+	    (long)osticks2ms(LMIC_nextTxTime() - os_getTime()),
+	    (unsigned long)osticks2ms(LMIC_airtimeLeft()));
+}
+
+static void
+cmd_chans(int argc, char **argv)
+{
+	const chstat_t	*cs;
+	uint8_t		 chnl;
+	(void)argc;
+	(void)argv;
+
+	for (chnl = 0; (cs = LMIC_chStats(chnl)) != NULL; chnl++) {
+		if (cs->tx == 0 && cs->sensed == 0)
+			continue;
+		printf("chnl %2u tx %u answered %u/%u busy %u/%u "
+		    "rssi %d snr %d weight %u\r\n", chnl, cs->tx, cs->ok,
+		    cs->ask, cs->busy, cs->sensed, cs->rssi, cs->snr / 4,
+		    LMIC_chWeight(chnl));
+	}
+}
+
 struct command {
 	const char	*cmd;
 	const char	 minargs, maxargs;
@@ -167,9 +209,11 @@ struct command {
 };
 
 static const struct command	cmd[] = {
+	{ "chans", 1, 1, cmd_chans },
 	{ "param", 2, 3, cmd_param },
 	{ "reset", 1, 1, cmd_reset },
 	{ "sense", 1, 1, cmd_sense },
+	{ "stats", 1, 1, cmd_stats },
 };
 
 static int
@@ -97,6 +97,11 @@
 
 #define HW_LORA_SPI_NO		2
 
+/* The SX1276 takes up to 10 MHz; override for boards with poor SPI traces */
+#ifndef HW_LORA_SPI_FREQ
+#define HW_LORA_SPI_FREQ		HW_SPI_FREQ_DIV_2	/* 8 MHz */
+#endif
+
 #define __DEFINE_HW_LORA_SPI_INT(x)	HW_SPI ## x
 #define __DEFINE_HW_LORA_SPI(x)		__DEFINE_HW_LORA_SPI_INT(x)
 #define HW_LORA_SPI			__DEFINE_HW_LORA_SPI(HW_LORA_SPI_NO)
@@ -206,9 +206,11 @@ led_cb(osjob_t *job)
 	LED_ENABLE_RED((on ^ red_inverted) && !!(led_status & LED_RED));
 	LED_ENABLE_GREEN(on && !!(led_status & LED_GREEN));
 	LED_ENABLE_BLUE(on && !!(led_status & LED_BLUE));
-	os_setTimedCallback(&led_job, hal_ticks() + delay, led_cb);
+	/* Blink timing may stretch a little to share a wake-up */
+	os_setTimedCallbackSlack(&led_job, hal_ticks() + delay, delay / 8,
+	    led_cb);
 	if (on || red_inverted)
-		ad_lora_suspend_sleep(LORA_SUSPEND_LED, delay);
+		ad_lora_suspend_sleep(LORA_SUSPEND_LED, delay + delay / 8);
 	else
 		ad_lora_allow_sleep(LORA_SUSPEND_LED);
 }
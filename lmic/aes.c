@@ -27,6 +27,10 @@
 
 #include "oslmic.h"
 
+#ifdef CFG_hw_aes
+#define os_aes os_aes_sw
+#endif
+
 #define AES_MICSUB 0x30 // internal use only
 
 static const u4_t AES_RCON[10] = { 
@@ -220,16 +224,16 @@ u4_t AESAUX[16/sizeof(u4_t)];
 u4_t AESKEY[11*16/sizeof(u4_t)];
 
 // generate 1+10 roundkeys for encryption with 128-bit key
-// read 128-bit key from AESKEY in MSBF, generate roundkey words in place
-static void aesroundkeys () {
+// read 128-bit key in MSBF, generate roundkey words into keys (may overlap)
+static void aesroundkeys (u4_t* keys, xref2cu1_t key) {
     int i;
     u4_t b;
 
     for( i=0; i<4; i++) {
-        AESKEY[i] = swapmsbf(AESKEY[i]);
+        keys[i] = os_rmsbf4(key+4*i);
     }
     
-    b = AESKEY[3];
+    b = keys[3];
     for( ; i<44; i++ ) {
         if( i%4==0 ) {
             // b = SubWord(RotWord(b)) xor Rcon[i/4]
@@ -239,13 +243,47 @@ static void aesroundkeys () {
                 (AES_S[   b >> 24 ]      ) ^
                  AES_RCON[(i-4)/4];
         }
-        AESKEY[i] = b ^= AESKEY[i-4];
+        keys[i] = b ^= keys[i-4];
     }
 }
 
-u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len) {
-        
-        aesroundkeys();
+// encrypt block a0-a3 in place with roundkeys ki
+static void aesblock (const u4_t* ki, u4_t* a) {
+    u4_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3];
+    u4_t t0, t1, t2, t3;
+    const u4_t* ke = ki + 8*4;
+
+    a0 ^= ki[0];
+    a1 ^= ki[1];
+    a2 ^= ki[2];
+    a3 ^= ki[3];
+    do {
+        AES_key4 (t1,t2,t3,t0,4);
+        AES_expr4(t1,t2,t3,t0,a0);
+        AES_expr4(t2,t3,t0,t1,a1);
+        AES_expr4(t3,t0,t1,t2,a2);
+        AES_expr4(t0,t1,t2,t3,a3);
+
+        AES_key4 (a1,a2,a3,a0,8);
+        AES_expr4(a1,a2,a3,a0,t0);
+        AES_expr4(a2,a3,a0,a1,t1);
+        AES_expr4(a3,a0,a1,a2,t2);
+        AES_expr4(a0,a1,a2,a3,t3);
+    } while( (ki+=8) < ke );
+
+    AES_key4 (t1,t2,t3,t0,4);
+    AES_expr4(t1,t2,t3,t0,a0);
+    AES_expr4(t2,t3,t0,t1,a1);
+    AES_expr4(t3,t0,t1,t2,a2);
+    AES_expr4(t0,t1,t2,t3,a3);
+
+    AES_expr(a[0],t0,t1,t2,t3,8);
+    AES_expr(a[1],t1,t2,t3,t0,9);
+    AES_expr(a[2],t2,t3,t0,t1,10);
+    AES_expr(a[3],t3,t0,t1,t2,11);
+}
+
+static u4_t aesrun (u1_t mode, const u4_t* keys, xref2u1_t buf, u2_t len) {
 
         if( mode & AES_MICNOAUX ) {
             AESAUX[0] = AESAUX[1] = AESAUX[2] = AESAUX[3] = 0;
@@ -256,10 +294,10 @@ u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len) {
             AESAUX[3] = swapmsbf(AESAUX[3]);
         }
 
-        while( (signed char)len > 0 ) {
+        while( (s2_t)len > 0 ) {  // len wraps below 0 after the last block
             u4_t a0 = 0, a1 = 0, a2 = 0, a3 = 0;
-            u4_t t0, t1 = 0, t2, t3;
-            u4_t *ki, *ke;
+            u4_t t0, t1 = 0;
+            u4_t blk[4];
 
             // load input block
             if( (mode & AES_CTR) || ((mode & AES_MIC) && (mode & AES_MICNOAUX)==0) ) { // load CTR block or first MIC block
@@ -291,36 +329,15 @@ u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len) {
             }
 
             // perform AES encryption on block in a0-a3
-            ki = AESKEY;
-            ke = ki + 8*4;
-            a0 ^= ki[0];
-            a1 ^= ki[1];
-            a2 ^= ki[2];
-            a3 ^= ki[3];
-            do {
-                AES_key4 (t1,t2,t3,t0,4);
-                AES_expr4(t1,t2,t3,t0,a0);
-                AES_expr4(t2,t3,t0,t1,a1);
-                AES_expr4(t3,t0,t1,t2,a2);
-                AES_expr4(t0,t1,t2,t3,a3);
-
-                AES_key4 (a1,a2,a3,a0,8);
-                AES_expr4(a1,a2,a3,a0,t0);
-                AES_expr4(a2,a3,a0,a1,t1);
-                AES_expr4(a3,a0,a1,a2,t2);
-                AES_expr4(a0,a1,a2,a3,t3);
-            } while( (ki+=8) < ke );
-
-            AES_key4 (t1,t2,t3,t0,4);
-            AES_expr4(t1,t2,t3,t0,a0);
-            AES_expr4(t2,t3,t0,t1,a1);
-            AES_expr4(t3,t0,t1,t2,a2);
-            AES_expr4(t0,t1,t2,t3,a3);
-
-            AES_expr(a0,t0,t1,t2,t3,8);
-            AES_expr(a1,t1,t2,t3,t0,9);
-            AES_expr(a2,t2,t3,t0,t1,10);
-            AES_expr(a3,t3,t0,t1,t2,11);
+            blk[0] = a0;
+            blk[1] = a1;
+            blk[2] = a2;
+            blk[3] = a3;
+            aesblock(keys, blk);
+            a0 = blk[0];
+            a1 = blk[1];
+            a2 = blk[2];
+            a3 = blk[3];
             // result of AES encryption in a0-a3
 
             if( mode & AES_MIC ) {
@@ -381,3 +398,74 @@ u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len) {
         return AESAUX[0];
 }
 
+
+u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len) {
+    aesroundkeys(AESKEY, AESkey);
+    return aesrun(mode, AESKEY, buf, len);
+}
+
+// expand a 128-bit key once, for repeated use with os_aesSched() and os_aesSeal()
+void os_aesExpand (u4_t* sched, xref2cu1_t key) {
+    aesroundkeys(sched, key);
+}
+
+// same as os_aes() but with a key expanded by os_aesExpand()
+u4_t os_aesSched (u1_t mode, const u4_t* sched, xref2u1_t buf, u2_t len) {
+    return aesrun(mode, sched, buf, len);
+}
+
+// Encrypt frame[off..len) in CTR mode with ctrkeys and AESaux as the first
+// counter block, and return the MIC with mickeys over B0|frame[0..len).
+// B0 is AESaux with 0x49 in the first byte and len in the last.
+// Both run in a single pass, each block being encrypted before it is signed.
+u4_t os_aesSeal (const u4_t* ctrkeys, const u4_t* mickeys, xref2u1_t frame, u2_t off, u2_t len) {
+    u4_t ctr[4], ks[4], mic[4], sub[4];
+    int i, j, n, k = 16;
+
+    for( i=0; i<4; i++ ) {
+        ctr[i] = os_rmsbf4(AESaux+4*i);
+        mic[i] = ctr[i];
+    }
+    mic[0] = (mic[0] & 0x00FFFFFF) | 0x49000000;
+    mic[3] = (mic[3] & 0xFFFFFF00) | u1(len);
+    aesblock(mickeys, mic);
+
+    for( i=0; i<len; i+=16 ) {
+        n = (len-i > 16) ? 16 : len-i;
+        for( j=0; j<n; j++ ) {
+            if( i+j >= off ) {
+                if( k == 16 ) { // next key stream block
+                    ks[0] = ctr[0];
+                    ks[1] = ctr[1];
+                    ks[2] = ctr[2];
+                    ks[3] = ctr[3]++;
+                    aesblock(ctrkeys, ks);
+                    k = 0;
+                }
+                frame[i+j] ^= ks[k>>2] >> (24 - 8*(k&3));
+                k++;
+            }
+            mic[j>>2] ^= (u4_t)frame[i+j] << (24 - 8*(j&3));
+        }
+        if( i+16 >= len ) { // last block: mask with CMAC subkey K1, or pad and use K2
+            sub[0] = sub[1] = sub[2] = sub[3] = 0;
+            aesblock(mickeys, sub);
+            for( j = (n == 16) ? 1 : 2; j > 0; j-- ) {
+                u4_t msb = sub[0] >> 31;
+                sub[0] = (sub[0] << 1) | (sub[1] >> 31);
+                sub[1] = (sub[1] << 1) | (sub[2] >> 31);
+                sub[2] = (sub[2] << 1) | (sub[3] >> 31);
+                sub[3] = (sub[3] << 1);
+                if( msb ) sub[3] ^= 0x87;
+            }
+            if( n < 16 )
+                mic[n>>2] ^= 0x80u << (24 - 8*(n&3));
+            mic[0] ^= sub[0];
+            mic[1] ^= sub[1];
+            mic[2] ^= sub[2];
+            mic[3] ^= sub[3];
+        }
+        aesblock(mickeys, mic);
+    }
+    return mic[0];
+}
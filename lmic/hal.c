@@ -1,18 +1,27 @@
 #include <unistd.h>
 
+#include <hw_timer0.h>
 #include <hw_wkup.h>
 #include <sys_power_mgr.h>
 #include <sys_watchdog.h>
 
 #include "oslmic.h"
 #include "hal.h"
+#include "hw/aes.h"
 #include "hw/button.h"
 #include "hw/cons.h"
 #include "hw/i2c.h"
 #include "hw/power.h"
 #include "sensor/sensor.h"
 
-#define WATCHDOG_ALWAYS_ON
+/*
+ * Sleep through the watchdog period with the LoRa task's watchdog suspended
+ * instead of waking every MAX_WDOG_SLEEP ticks to notify it.  The hardware
+ * watchdog keeps running while we sleep and is only fed from the idle task
+ * as long as all other monitored tasks are alive, so a hung system still
+ * resets.  Define WATCHDOG_ALWAYS_ON to get the old behaviour back.
+ */
+//#define WATCHDOG_ALWAYS_ON
 
 #define EV_LORA_DIO	0
 #define EV_BTN_PRESS	1
@@ -22,8 +31,20 @@ struct event {
 	uint32_t	data;
 };
 
+/* Bursts this long and longer go by DMA, shorter ones byte by byte */
+#define SPI_DMA_MIN	8
+
+/*
+ * Waits this many ticks and longer sleep in WFI until timer0, clocked by
+ * the same 32 kHz clock as hal_ticks(), expires; shorter ones spin.
+ */
+#define MIN_WFI		2
+
 PRIVILEGED_DATA static int8_t		wdog_id;
 PRIVILEGED_DATA static QueueHandle_t	hal_queue;
+PRIVILEGED_DATA static volatile bool	spi_done;
+PRIVILEGED_DATA static volatile bool	timer_done;
+PRIVILEGED_DATA static struct hal_irq_stats	irq_stats;
 
 void
 hal_uart_rx(void)
@@ -93,8 +114,11 @@ hal_lora_init(void)
 		.polarity_mode	= HW_SPI_POL_LOW,
 		.phase_mode	= HW_SPI_PHA_MODE_0,
 		.mint_mode	= HW_SPI_MINT_DISABLE,
-		.xtal_freq	= HW_SPI_FREQ_DIV_8,
+		.xtal_freq	= HW_LORA_SPI_FREQ,
 		.fifo_mode	= HW_SPI_FIFO_RX_TX,
+		.use_dma	= 1,
+		/* And 3 for TX; the console UART has 0 and 1 */
+		.rx_dma_channel	= HW_DMA_CHANNEL_2,
 	};
 
 	hw_gpio_configure_pin(   HW_LORA_REST_PORT, HW_LORA_REST_PIN,
@@ -140,12 +164,35 @@ hal_periph_init()
 	sensor_init();
 }
 
+static void
+timer0_cb(void)
+{
+	timer_done = true;
+}
+
+static void
+timer_init(void)
+{
+	timer0_config	cfg = {
+		.clk_src	= HW_TIMER0_CLK_SRC_SLOW,
+		.on_clock_div	= false,
+		.pwm_mode	= HW_TIMER0_MODE_PWM,
+	};
+
+	hw_timer0_init(&cfg);
+	hw_timer0_register_int(timer0_cb);
+}
+
 void
 hal_init()
 {
 	wdog_id = sys_watchdog_register(false);
 	sys_watchdog_notify(wdog_id);
 	wkup_init();
+	timer_init();
+#ifdef AES_BENCH
+	aes_bench();
+#endif
 }
 
 u1_t
@@ -157,6 +204,53 @@ hal_spi(u1_t outval)
 	return hw_spi_fifo_read8(HW_SPI2);
 }
 
+static void
+spi_dma_cb(void *data, uint16_t len)
+{
+	(void)data;
+	(void)len;
+	spi_done = true;
+}
+
+/*
+ * The transfer takes a few microseconds per byte at most, too short to
+ * be worth switching tasks.
+ */
+static void
+spi_dma_wait(void)
+{
+	while (!spi_done)
+		;
+}
+
+void
+hal_spi_write(const u1_t *buf, u1_t len)
+{
+	if (len < SPI_DMA_MIN) {
+		while (len--)
+			hal_spi(*buf++);
+		return;
+	}
+	hw_spi_wait_while_busy(HW_LORA_SPI);
+	spi_done = false;
+	hw_spi_write_buf(HW_LORA_SPI, buf, len, spi_dma_cb, NULL);
+	spi_dma_wait();
+}
+
+void
+hal_spi_read(u1_t *buf, u1_t len)
+{
+	if (len < SPI_DMA_MIN) {
+		while (len--)
+			*buf++ = hal_spi(0x00);
+		return;
+	}
+	hw_spi_wait_while_busy(HW_LORA_SPI);
+	spi_done = false;
+	hw_spi_read_buf(HW_LORA_SPI, buf, len, spi_dma_cb, NULL);
+	spi_dma_wait();
+}
+
 __dead void
 hal_failed()
 {
@@ -166,12 +260,25 @@ hal_failed()
 		;
 }
 
+const struct hal_irq_stats *
+hal_irqStats()
+{
+	return &irq_stats;
+}
+
 void
 hal_handle_event(struct event ev)
 {
+	u4_t	latency;
+
 	switch (ev.ev) {
 	case EV_LORA_DIO:
 		radio_irq_handler(ev.data);
+		latency = hal_ticks() - ev.data;
+		irq_stats.irqs++;
+		irq_stats.latency += latency;
+		if (latency > irq_stats.max_latency)
+			irq_stats.max_latency = latency;
 		break;
 #ifdef FEATURE_USER_BUTTON
 	case EV_BTN_PRESS:
@@ -189,8 +296,23 @@ hal_handle_event(struct event ev)
 #define TIMER_PRECISION	((s4_t)(configSYSTICK_CLOCK_HZ / configTICK_RATE_HZ))
 #define MIN_SLEEP	(2 * TIMER_PRECISION)
 #define MAX_WDOG_SLEEP	sec2osticks(2)
+/* Upper bound for a single sleep with the watchdog suspended */
+#define MAX_LONG_SLEEP	sec2osticks(2 * 60 * 60)
 
 static u4_t	waituntil;
+PRIVILEGED_DATA static struct hal_sleep_stats	sleep_stats;
+
+const struct hal_sleep_stats *
+hal_sleepStats()
+{
+	return &sleep_stats;
+}
+
+void
+hal_countTx()
+{
+	sleep_stats.txs++;
+}
 
 u1_t
 hal_checkTimer(u4_t targettime)
@@ -214,6 +336,24 @@ hal_setShortSleep()
 	waituntil = hal_ticks() + MAX_WDOG_SLEEP;
 }
 
+/*
+ * Sleep in WFI for dt ticks at most, waking early for any interrupt.
+ * Check for the timer and events with interrupts masked, so that one
+ * coming in just before the WFI still ends it.
+ */
+static void
+hal_wfi(s4_t dt)
+{
+	timer_done = false;
+	hw_timer0_set_on_reload(dt > 0xffff ? 0xffff : dt);
+	hw_timer0_enable();
+	__disable_irq();
+	if (!timer_done && !uxQueueMessagesWaitingFromISR(hal_queue))
+		__WFI();
+	__enable_irq();
+	hw_timer0_disable();
+}
+
 void
 hal_sleep()
 {
@@ -222,24 +362,44 @@ hal_sleep()
 	if (dt > MIN_SLEEP) {
 		BaseType_t	ret;
 		struct event	ev;
+		u4_t		start, elapsed;
 
+		sleep_stats.sleeps++;
 		if (dt >= MAX_WDOG_SLEEP) {
 #ifdef WATCHDOG_ALWAYS_ON
 			dt = MAX_WDOG_SLEEP;
 #else
+			if (dt > MAX_LONG_SLEEP)
+				dt = MAX_LONG_SLEEP;
 			sys_watchdog_suspend(wdog_id);
+			sleep_stats.long_sleeps++;
 #endif
 		}
+		start = hal_ticks();
 		// Timer precision is 64 ticks.  Sleep for 64 to
 		// 128 ticks less than specified.
-		// Wait for timer or WKUP_GPIO interrupt
+		// Wait for timer or WKUP_GPIO interrupt.  The OS
+		// programs the wake-up timer for the timeout.
 		ret = xQueueReceive(hal_queue, &ev, dt / TIMER_PRECISION - 1);
 		sys_watchdog_notify_and_resume(wdog_id);
+		// Watchdog wake-ups this sleep would have needed: one per
+		// period that passed whole before the notify above
+		elapsed = hal_ticks() - start;
+		if (elapsed != 0)
+			sleep_stats.wakeups_avoided +=
+			    (elapsed - 1) / MAX_WDOG_SLEEP;
 		if (ret)
 			hal_handle_event(ev);
-	} else {
-		// Busy-wait
-		hal_waitUntil(waituntil - 5);
+	} else if (dt > 5) {
+		struct event	ev;
+		u4_t		start = hal_ticks();
+
+		// Too short for the OS to sleep.  Halt in WFI until
+		// hal_checkTimer() takes over, or an event comes in.
+		hal_wfi(dt - 5);
+		sleep_stats.wfi += hal_ticks() - start;
+		if (xQueueReceive(hal_queue, &ev, 0))
+			hal_handle_event(ev);
 	}
 }
 
@@ -247,12 +407,24 @@ void
 hal_waitUntil(u4_t time)
 {
 	struct event	ev;
+	s4_t		dt;
+	u4_t		start = hal_ticks(), wfi;
 
-	while ((s4_t)(time - hal_ticks()) > 0) {
+	while ((dt = time - hal_ticks()) > 0) {
 		if (xQueueReceive(hal_queue, &ev, 0)) {
+			sleep_stats.spin += hal_ticks() - start;
 			hal_handle_event(ev);
-			break;
+			return;
 		}
 		sys_watchdog_notify(wdog_id);
+		if (dt >= MIN_WFI) {
+			// Wake up to a tick early, and spin the rest
+			wfi = hal_ticks();
+			hal_wfi(dt - 1);
+			wfi = hal_ticks() - wfi;
+			sleep_stats.wfi += wfi;
+			start += wfi;
+		}
 	}
+	sleep_stats.spin += hal_ticks() - start;
 }
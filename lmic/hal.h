@@ -92,6 +92,13 @@ void hal_uart_rx(void);
  */
 u1_t hal_spi (u1_t outval);
 
+/*
+ * perform burst SPI transfer with radio, NSS is driven by the caller.
+ *   - write len bytes from buf, or read len bytes into buf
+ */
+void hal_spi_write (const u1_t* buf, u1_t len);
+void hal_spi_read (u1_t* buf, u1_t len);
+
 /*
  * disable all CPU interrupts.
  *   - might be invoked nested 
@@ -117,6 +124,34 @@ void hal_sleep (void);
 //#define hal_sleep()	__WFI()
 //#define hal_sleep()	__NOP()
 
+/*
+ * sleep statistics.
+ */
+struct hal_sleep_stats {
+    u4_t sleeps;            // sleeps with the CPU idle
+    u4_t long_sleeps;       // sleeps with the watchdog suspended
+    u4_t wakeups_avoided;   // watchdog wake-ups skipped by long sleeps
+    u4_t spin;              // ticks busy-waiting in hal_waitUntil()
+    u4_t wfi;               // ticks waiting with the core in WFI
+    u4_t txs;               // frames sent since boot
+};
+const struct hal_sleep_stats *hal_sleepStats (void);
+
+/*
+ * count a frame sent, for the sleep statistics.
+ */
+void hal_countTx (void);
+
+/*
+ * radio interrupt statistics.
+ */
+struct hal_irq_stats {
+    u4_t irqs;              // radio interrupts handled
+    u4_t latency;           // ticks from interrupt to LMIC callback, summed
+    u4_t max_latency;       // longest of these
+};
+const struct hal_irq_stats *hal_irqStats (void);
+
 /*
  * return 32-bit system time in ticks.
  */
@@ -125,7 +160,8 @@ void hal_sleep (void);
 #define hal_ticks_fromISR()	((u4_t)rtc_get_fromISR())
 
 /*
- * busy-wait until specified timestamp (in ticks) is reached.
+ * wait until specified timestamp (in ticks) is reached, with the core
+ * halted in WFI for all but the last tick.
  */
 void hal_waitUntil (u4_t time);
 
@@ -185,18 +185,47 @@ static void micB0 (u4_t devaddr, u4_t seqno, int dndir, int len) {
 }
 
 
-static int aes_verifyMic (xref2cu1_t key, u4_t devaddr, u4_t seqno, int dndir, xref2u1_t pdu, int len) {
-    micB0(devaddr, seqno, dndir, len);
+// A session key as the AES code takes it: the key itself for the AES
+// engine, which expands it, else its schedule from os_aesExpand()
+#if defined(CFG_hw_aes)
+typedef xref2cu1_t sesskey_t;
+#define NWK_SESSKEY LMIC.nwkKey
+#define ART_SESSKEY LMIC.artKey
+#else
+typedef const u4_t* sesskey_t;
+#define NWK_SESSKEY LMIC.nwkSched
+#define ART_SESSKEY LMIC.artSched
+#endif
+
+// os_aes() with a session key
+static u4_t aes_session (u1_t mode, sesskey_t key, xref2u1_t buf, int len) {
+#if defined(CFG_hw_aes)
     os_copyMem(AESkey,key,16);
-    return os_aes(AES_MIC, pdu, len) == os_rmsbf4(pdu+len);
+    return os_aes(mode, buf, len);
+#else
+    return os_aesSched(mode, key, buf, len);
+#endif
 }
 
 
-static void aes_appendMic (xref2cu1_t key, u4_t devaddr, u4_t seqno, int dndir, xref2u1_t pdu, int len) {
+static void aes_expandSession (void) {
+#if !defined(CFG_hw_aes)
+    os_aesExpand(LMIC.nwkSched, LMIC.nwkKey);
+    os_aesExpand(LMIC.artSched, LMIC.artKey);
+#endif
+}
+
+
+static int aes_verifyMic (sesskey_t key, u4_t devaddr, u4_t seqno, int dndir, xref2u1_t pdu, int len) {
+    micB0(devaddr, seqno, dndir, len);
+    return aes_session(AES_MIC, key, pdu, len) == os_rmsbf4(pdu+len);
+}
+
+
+static void aes_appendMic (sesskey_t key, u4_t devaddr, u4_t seqno, int dndir, xref2u1_t pdu, int len) {
     micB0(devaddr, seqno, dndir, len);
-    os_copyMem(AESkey,key,16);
     // MSB because of internal structure of AES
-    os_wmsbf4(pdu+len, os_aes(AES_MIC, pdu, len));
+    os_wmsbf4(pdu+len, aes_session(AES_MIC, key, pdu, len));
 }
 
 
@@ -218,16 +247,32 @@ static void aes_encrypt (xref2u1_t pdu, int len) {
 }
 
 
-static void aes_cipher (xref2cu1_t key, u4_t devaddr, u4_t seqno, int dndir, xref2u1_t payload, int len) {
-    if( len <= 0 )
-        return;
+static void cipherA1 (u4_t devaddr, u4_t seqno, int dndir) {
     os_clearMem(AESaux, 16);
     AESaux[0] = AESaux[15] = 1; // mode=cipher / dir=down / block counter=1
     AESaux[5] = dndir?1:0;
     os_wlsbf4(AESaux+ 6,devaddr);
     os_wlsbf4(AESaux+10,seqno);
-    os_copyMem(AESkey,key,16);
-    os_aes(AES_CTR, payload, len);
+}
+
+
+static void aes_cipher (sesskey_t key, u4_t devaddr, u4_t seqno, int dndir, xref2u1_t payload, int len) {
+    if( len <= 0 )
+        return;
+    cipherA1(devaddr, seqno, dndir);
+    aes_session(AES_CTR, key, payload, len);
+}
+
+
+// Encrypt the payload of an up frame from off on and append the MIC
+static void aes_seal (sesskey_t key, u4_t devaddr, u4_t seqno, xref2u1_t pdu, int off, int len) {
+#if defined(CFG_hw_aes)
+    aes_cipher(key, devaddr, seqno, /*up*/0, pdu+off, len-off);
+    aes_appendMic(NWK_SESSKEY, devaddr, seqno, /*up*/0, pdu, len);
+#else
+    cipherA1(devaddr, seqno, /*up*/0);
+    os_wmsbf4(pdu+len, os_aesSeal(key, NWK_SESSKEY, pdu, off, len));
+#endif
 }
 
 
@@ -252,12 +297,23 @@ static void aes_sessKeys (u2_t devnonce, xref2cu1_t artnonce, xref2u1_t nwkkey,
 // ================================================================================
 // BEG LORA
 
+#ifdef LMIC_REGION
+// Built for one region: its parameters are constants from the tables
+// below and the code of the other regions is dead
+#define NB()    (((LMIC_REGION) & REGION_WIDEBAND) == 0)
+#define NB_REG  (&nb_reg[(LMIC_REGION) & REGION_MASK])
+#define WB_REG  (&wb_reg[(LMIC_REGION) & REGION_MASK])
+#else
 #define NB()    (LMIC.nb_reg != NULL)
+#define NB_REG  LMIC.nb_reg
+#define WB_REG  LMIC.wb_reg
+#endif
 #define REG(x)  (NB() ? x ## _NB : x ## _WB)
 
 #define maxFrameLen(dr) ((dr)<=(NB() ? DR_SF9_EU : DR_SF11CR_US) ?      \
-    (NB() ? maxFrameLens_NB : LMIC.wb_reg->max_frame_lens)[(dr)] :      \
+    (NB() ? maxFrameLens_NB : WB_REG->max_frame_lens)[(dr)] :      \
     0xFF)
+static const u1_t maxFrameLens_NB [] = { 64,64,64,128 };
 static const u1_t maxFrameLens_US [] = { 24,66,142,255,255,255,255,255,  66,142 };
 static const u1_t maxFrameLens_AU [] = { 64,64,64,128,235,235,235,255,  66,142 };
 
@@ -343,6 +399,7 @@ static const u1_t _DR2RPS_CRC_AU[] = {
 static const s1_t TXPOWLEVELS_EU[] = {
     20, 14, 11, 8, 5, 2, 0,0, 0,0,0,0, 0,0,0,0
 };
+#define DFLT_TXPOW (NB() ? 14 : 20)
 #define pow2dBm(mcmd_ladr_p1) (NB() ? \
     TXPOWLEVELS_EU[(mcmd_ladr_p1&MCMD_LADR_POW_MASK)>>MCMD_LADR_POW_SHIFT] : \
     ((s1_t)(30 - (((mcmd_ladr_p1)&MCMD_LADR_POW_MASK)<<1))))
@@ -405,7 +462,7 @@ static ostime_t dr2hsym_AU(dr_t dr) {
     return DR2HSYM_osticks_AU[((dr&8)>>2)+(dr&7)];
 }
 
-#define dr2hsym(dr) (NB() ? DR2HSYM_osticks_EU[dr] : LMIC.wb_reg->dr2hsym(dr))
+#define dr2hsym(dr) (NB() ? DR2HSYM_osticks_EU[dr] : WB_REG->dr2hsym(dr))
 
 
 //#define LMIC_THREE_CHANNELS
@@ -449,7 +506,12 @@ static const u4_t iniChannelFreq_KR[7] = {
 
 #define LBT_SENSETIME       (ms2osticks(6))
 #define LBT_RSSI_THRESHOLD  (-85)
+#define LBT_RSSI_POLL       (us2osticks(200))
 #define MAX_LBT_RETRIES     16
+#define LBT_CLEAR           0xFF
+// CAD only detects LoRa preambles at the TX spreading factor. Define to
+// sense the RSSI instead where energy detection is required.
+//#define LBT_RSSI
 
 // Narrow band region
 static const struct nb_reg {
@@ -600,7 +662,60 @@ static const struct wb_reg {
     },
 };
 
+// Airtime of the frames that go through the duty cycle, uplinks: LoRa
+// with CR 4/5, CRC and an explicit header, by SF, BW and the number of
+// 5 symbol blocks after the header.  The compiler works it out as
+// calcAirTimeFormula() does below.  The blocks of a frame come from a
+// multiplication by the reciprocal of the bits per block, exact for any
+// length, which keeps both divisions, libgcc calls on the Cortex-M0, off
+// the path of every uplink.  Other frames still take the formula.
+#define AT_SF(sf)           ((sf)+(7-SF7))
+#define AT_Q(sf)            (4*AT_SF(sf) - ((sf) >= SF11 ? 8 : 0))
+#define AT_RECIP(sf)        ((1<<20)/AT_Q(sf) + 1)
+#define AT_SHIFT(sf,bw)     (AT_SF(sf) - (3+2) - (bw))
+#define AT_SFX(sf,bw)       (AT_SHIFT(sf,bw) > 4 ? 4 : AT_SHIFT(sf,bw))
+#define AT_DIV(sf,bw)       (AT_SHIFT(sf,bw) > 4 ? \
+    15625 >> (AT_SHIFT(sf,bw)-4) : 15625)
+#define AT_TIME(sf,bw,nb) \
+    (((((((ostime_t)(nb)*(CR_4_5+5)+8)<<2) + 49) << AT_SFX(sf,bw)) * \
+      OSTICKS_PER_SEC + AT_DIV(sf,bw)/2) / AT_DIV(sf,bw))
+
+#define AT_BLK1(sf,bw,n)    AT_TIME(sf,bw,n)
+#define AT_BLK2(sf,bw,n)    AT_BLK1(sf,bw,n), AT_BLK1(sf,bw,n+1)
+#define AT_BLK4(sf,bw,n)    AT_BLK2(sf,bw,n), AT_BLK2(sf,bw,n+2)
+#define AT_BLK8(sf,bw,n)    AT_BLK4(sf,bw,n), AT_BLK4(sf,bw,n+4)
+#define AT_BLK16(sf,bw,n)   AT_BLK8(sf,bw,n), AT_BLK8(sf,bw,n+8)
+#define AT_BLK32(sf,bw,n)   AT_BLK16(sf,bw,n), AT_BLK16(sf,bw,n+16)
+#define AT_BLKS(sf,bw)      { AT_BLK32(sf,bw,0), AT_BLK32(sf,bw,32), AT_BLK8(sf,bw,64), \
+                              AT_BLK2(sf,bw,72), AT_BLK1(sf,bw,74) }
+#define AT_BWS(sf)          { AT_BLKS(sf,BW125), AT_BLKS(sf,BW250), AT_BLKS(sf,BW500) }
+
+enum { AT_MAX_BLOCKS = 74 };  // of a 255 byte frame at SF7
+
+static const ostime_t airtimeTable[SF12-SF7+1][BW500+1][AT_MAX_BLOCKS+1] = {
+    AT_BWS(SF7), AT_BWS(SF8), AT_BWS(SF9), AT_BWS(SF10), AT_BWS(SF11), AT_BWS(SF12),
+};
+
+// 2^20 over the bits per block, rounded up - for at most 2083 bits the
+// quotient errs by less than 1/48, so it never reaches the next whole
+static const u2_t airtimeRecip[SF12-SF7+1] = {
+    AT_RECIP(SF7), AT_RECIP(SF8), AT_RECIP(SF9), AT_RECIP(SF10), AT_RECIP(SF11), AT_RECIP(SF12),
+};
+
 ostime_t calcAirTime (rps_t rps, u1_t plen) {
+    u1_t sf = getSf(rps);
+    if( sf != FSK && sf <= SF12 && getBw(rps) <= BW500 &&
+        getCr(rps) == CR_4_5 && !getNocrc(rps) && !getIh(rps) ) {
+        int bits = 8*plen - 4*AT_SF(sf) + 28 + 16;
+        u1_t nb = 0;
+        if( bits > 0 )  // rounded up
+            nb = (u4_t)(bits + AT_Q(sf) - 1) * airtimeRecip[sf-SF7] >> 20;
+        return airtimeTable[sf-SF7][getBw(rps)][nb];
+    }
+    return calcAirTimeFormula(rps, plen);
+}
+
+ostime_t calcAirTimeFormula (rps_t rps, u1_t plen) {
     u1_t bw = getBw(rps);  // 0,1,2 = 125,250,500kHz
     u1_t sf = getSf(rps);  // 0=FSK, 1..6 = SF7..12
     if( sf == FSK ) {
@@ -638,7 +753,7 @@ ostime_t calcAirTime (rps_t rps, u1_t plen) {
     return (((ostime_t)tmp << sfx) * OSTICKS_PER_SEC + div/2) / div;
 }
 
-static inline const u1_t *dr2rps ()    { return NB() ? LMIC.nb_reg->dr2rps : LMIC.wb_reg->dr2rps; }
+static inline const u1_t *dr2rps ()    { return NB() ? NB_REG->dr2rps : WB_REG->dr2rps; }
 static inline rps_t updr2rps (dr_t dr) { return (rps_t)dr2rps()[dr+1]; }
 static inline rps_t dndr2rps (dr_t dr) { return setNocrc(updr2rps(dr),1); }
 inline int isFasterDR (dr_t dr1, dr_t dr2) { return dr1 > dr2; }
@@ -703,7 +818,7 @@ static void calcBcnRxWindowFromMillis (u1_t ms, bit_t ini) {
         LMIC.missedBcns = 0;
         LMIC.bcninfo.flags |= BCN_NODRIFT|BCN_NODDIFF;
     }
-    ostime_t hsym = dr2hsym(NB() ? LMIC.nb_reg->bcn_dr : DR_BCN_US);
+    ostime_t hsym = dr2hsym(NB() ? NB_REG->bcn_dr : DR_BCN_US);
     LMIC.bcnRxsyms = MINRX_SYMS + ms2osticksCeil(ms) / hsym;
     LMIC.bcnRxtime = LMIC.bcninfo.txtime + BCN_INTV_osticks - (LMIC.bcnRxsyms-PAMBL_SYMS) * hsym;
 }
@@ -815,7 +930,7 @@ void LMIC_setPingable (u1_t intvExp) {
 
 static u1_t get_hi_dr() {
     u1_t min_sf = 0;
-    u1_t max_sf = NB() ? 12 : LMIC.wb_reg->max_sf;
+    u1_t max_sf = NB() ? 12 : WB_REG->max_sf;
 
     if (param_get(PARAM_MIN_SF, &min_sf, sizeof(min_sf)))
         min_sf &= 0xf;
@@ -840,12 +955,12 @@ static void initDefaultChannels_NB (bit_t join) {
     u1_t su = 0;
 #endif
     u1_t hi_dr = get_hi_dr();
-    for( u1_t fu=0; fu<LMIC.nb_reg->channels; fu++,su++ ) {
-        LMIC.channelFreq[fu]  = LMIC.nb_reg->iniChannelFreq[su];
+    for( u1_t fu=0; fu<NB_REG->channels; fu++,su++ ) {
+        LMIC.channelFreq[fu]  = NB_REG->iniChannelFreq[su];
         LMIC.channelDrMap[fu] = DR_RANGE_MAP(DR_SF12_EU,hi_dr);
     }
 
-    if (LMIC.nb_reg->flags & HAS_DUTYCYCLE) {
+    if (NB_REG->flags & HAS_DUTYCYCLE) {
         LMIC.bands[BAND_MILLI_1].txcap    = 1000;  // 0.1%
         LMIC.bands[BAND_MILLI_1].txpow    = 14;
         LMIC.bands[BAND_MILLI_1].lastchnl = os_getRndU1() % MAX_CHANNELS_EU;
@@ -867,7 +982,7 @@ static void initDefaultChannels_NB (bit_t join) {
         LMIC.bands[BAND_MILLI_2].avail =
         LMIC.bands[BAND_CENTI_2].avail = os_getTime();
     } else {
-        LMIC.txpow = LMIC.nb_reg->dflt_max_eirp;
+        LMIC.txpow = NB_REG->dflt_max_eirp;
     }
 }
 
@@ -879,10 +994,10 @@ static void initDefaultChannels_WB (void) {
     } else {
         for( u1_t i=0; i<4; i++ )
             LMIC.channelMap[i] = 0x0000;
-        LMIC.channelMap[LMIC.wb_reg->freq_125kHz_1stchan / 16] =
-            ((1 << LMIC.wb_reg->freq_125kHz_chans) - 1) <<
-            (LMIC.wb_reg->freq_125kHz_1stchan % 16);
-        LMIC.channelMap[4] = 1 << (LMIC.wb_reg->freq_500kHz_chan - 64);
+        LMIC.channelMap[WB_REG->freq_125kHz_1stchan / 16] =
+            ((1 << WB_REG->freq_125kHz_chans) - 1) <<
+            (WB_REG->freq_125kHz_1stchan % 16);
+        LMIC.channelMap[4] = 1 << (WB_REG->freq_500kHz_chan - 64);
     }
 }
 
@@ -896,17 +1011,17 @@ static void setupDwellTime(u1_t dwelltime) {
 static u4_t convFreq (xref2u1_t ptr) {
     u4_t freq = (os_rlsbf4(ptr-1) >> 8) * 100;
     if (NB()) {
-        if( freq < LMIC.nb_reg->freq_min || freq > LMIC.nb_reg->freq_max )
+        if( freq < NB_REG->freq_min || freq > NB_REG->freq_max )
             freq = 0;
     } else {
-        if( freq < LMIC.wb_reg->freq_min || freq > LMIC.wb_reg->freq_max )
+        if( freq < WB_REG->freq_min || freq > WB_REG->freq_max )
             freq = 0;
     }
     return freq;
 }
 
 bit_t LMIC_setupBand (u1_t bandidx, s1_t txpow, u2_t txcap) {
-    if( !NB() || !(LMIC.nb_reg->flags & HAS_DUTYCYCLE) || bandidx > BAND_AUX )
+    if( !NB() || !(NB_REG->flags & HAS_DUTYCYCLE) || bandidx > BAND_AUX )
         return 0;
     //band_t* b = &LMIC.bands[bandidx];
     xref2band_t b = &LMIC.bands[bandidx];
@@ -949,7 +1064,7 @@ bit_t LMIC_setupChannel_WB (u1_t chidx, u4_t freq, u2_t drmap, s1_t band) {
         return 0; // channels 0..71 are hardwired
     chidx -= 72;
     LMIC.xchFreq[chidx] = freq;
-    LMIC.xchDrMap[chidx] = drmap==0 ? LMIC.wb_reg->drmap : drmap;
+    LMIC.xchDrMap[chidx] = drmap==0 ? WB_REG->drmap : drmap;
     LMIC.channelMap[chidx>>4] |= (1<<(chidx&0xF));
     return 1;
 }
@@ -996,49 +1111,170 @@ static u1_t mapChannels_WB (u1_t chpage, u2_t chmap) {
 
 #define mapChannels(chpage, chmap)  REG(mapChannels)(chpage, chmap)
 
+// Uplink channels are weighed by how they have fared.  An uplink the
+// network has to answer - a join request, a confirmed frame or one
+// with ADRACKReq set - shows whether its channel got through by the
+// downlink it brings or not; and LBT shows how often a channel is busy.
+// The weight, in 1/256, is the square of the share of answers times the
+// share of clear listens.  Both are counted from a success or two more
+// than seen, so that a channel not yet tried weighs in full and a loss
+// to a collision does not count for much, while the weight of a jammed
+// channel falls fast.  Going round the channels as before, one is taken
+// with odds of its weight to the highest one, so that a jammed channel
+// is seldom used but still tried now and then.  The duty cycle bands
+// are chosen as before; the weights only pick the channel within one.
+// The counts are halved past a limit, to forget.
+
+// Answers asked for, and LBT listens, before the counts are halved
+#define CHSTAT_ASKS     16
+#define CHSTAT_SENSES   32
+// Lowest weight, so that a channel is retried once in a while
+#define CHSTAT_MINW     16
+
+static PRIVILEGED_DATA struct {
+    chstat_t    ch[MAX_CHSTATS];
+    u1_t        region;     // the stats are for
+    u1_t        chnl;       // of the last uplink
+    bit_t       asked;      // last uplink awaits an answer
+} chstats;
+
+static u2_t chstatWeight (u1_t chnl) {
+    if( chnl >= MAX_CHSTATS )
+        return 256;
+    const chstat_t* s = &chstats.ch[chnl];
+    u4_t w = (u4_t)(s->ok + 2) * 256 / (s->ask + 2);
+    w = w * w / 256;
+    w = w * (s->sensed - s->busy + 1) / (s->sensed + 1);
+    return w < CHSTAT_MINW ? CHSTAT_MINW : w > 256 ? 256 : w;
+}
+
+// Take a channel of weight w with odds w/wmax, without using up random
+// numbers while all channels weigh the same
+static bit_t chstatPick (u1_t chnl, u2_t wmax) {
+    u2_t w = chstatWeight(chnl);
+    return w >= wmax || (u4_t)os_getRndU1() * wmax < (u4_t)w * 256;
+}
+
+static void chstatTx (bit_t jacc) {
+    u1_t chnl = LMIC.txChnl;
+    if( chnl >= MAX_CHSTATS )
+        return;
+    chstat_t* s = &chstats.ch[chnl];
+    if( s->tx != 0xFFFF )
+        s->tx++;
+    chstats.chnl  = chnl;
+    chstats.asked = jacc
+        || (LMIC.frame[0] & HDR_FTYPE) == HDR_FTYPE_DCUP
+        || (LMIC.frame[OFF_DAT_FCT] & FCT_ADRARQ) != 0;
+    if( chstats.asked && ++s->ask > CHSTAT_ASKS ) {
+        s->ask >>= 1;
+        s->ok  >>= 1;
+    }
+}
+
+// A downlink has been received for the last uplink
+static void chstatRx (void) {
+    chstat_t* s = &chstats.ch[chstats.chnl];
+    if( chstats.asked ) {
+        chstats.asked = 0;
+        s->ok++;
+    }
+    if( (LMIC.txrxFlags & TXRX_DNW1) != 0 ) {
+        s->rssi = LMIC.rssi;
+        s->snr  = LMIC.snr;
+    }
+}
+
+static void chstatSensed (u1_t chnl, bit_t busy) {
+    chstat_t* s = &chstats.ch[chnl];
+    s->busy += busy;
+    if( ++s->sensed > CHSTAT_SENSES ) {
+        s->sensed >>= 1;
+        s->busy   >>= 1;
+    }
+}
+
 u1_t channelAvailable(u1_t chnl) {
-    ostime_t    start, end;
+    ostime_t    end;
     u4_t        freq;
     u1_t        available;
 
     available = 1;
     freq = LMIC.freq;
     LMIC.freq = LMIC.channelFreq[chnl];
-    if (NB() && (LMIC.nb_reg->flags & HAS_DUTYCYCLE))
+    if (NB() && (NB_REG->flags & HAS_DUTYCYCLE))
         LMIC.freq &= ~0x07;
     os_radio(RADIO_RXON);
-    start = os_getTime() + ms2osticks(1);
-    while ((s4_t)(start - os_getTime()) > 0)
-        ;
-    end = start + LBT_SENSETIME;
-	while ((s4_t)(end - os_getTime()) > 0) {
+    hal_waitUntil(os_getTime() + ms2osticks(1));
+    end = os_getTime() + LBT_SENSETIME;
+    while ((s4_t)(end - os_getTime()) > 0) {
         if (radio_rssi() > LBT_RSSI_THRESHOLD) {
             available = 0;
             break;
         }
-	}
+        hal_waitUntil(os_getTime() + LBT_RSSI_POLL);
+    }
     os_radio(RADIO_RST);
     LMIC.freq = freq;
     return available;
 }
 
+static void lbtDone (xref2osjob_t osjob) {
+    (void)osjob;
+    LMIC.opmode &= ~OP_TXRXPEND;
+    chstatSensed(LMIC.txChnl, LMIC.cadBusy);
+    if( !LMIC.cadBusy )
+        LMIC.lbtLeft = LBT_CLEAR;
+    engineUpdate();
+}
+
+// Sense a channel with CAD, lbtDone() runs on the DIO interrupt
+static void channelCad (u1_t chnl) {
+    LMIC.freq = LMIC.channelFreq[chnl];
+    if (NB() && (NB_REG->flags & HAS_DUTYCYCLE))
+        LMIC.freq &= ~0x07;
+    LMIC.cadBusy = 0;
+    LMIC.opmode |= OP_TXRXPEND;
+    LMIC.osjob.func = FUNC_ADDR(lbtDone);
+    os_radio(RADIO_CAD);
+}
+
+// 0: all channels busy, 1: txChnl is clear, 2: no LBT, 3: CAD running
 static u1_t lbtAvailable() {
-    if (LMIC.nb_reg->flags & HAS_LBT) {
-        u4_t chnl = LMIC.txChnl;
-        LMIC.rps = setCr(updr2rps(LMIC.datarate), (cr_t)LMIC.errcr);
-        for( u1_t ci=0; ci<MAX_CHANNELS_EU; ci++ ) {
-            if( (chnl = (chnl+1)) >= MAX_CHANNELS_EU )
-                chnl -=  MAX_CHANNELS_EU;
-            if( (LMIC.channelMap[0] & (1<<chnl)) != 0 && // channel enabled
-                (LMIC.channelDrMap[chnl] & (1<<(LMIC.datarate&0xF))) != 0 &&
-                channelAvailable(chnl) ) {
-                LMIC.txChnl = chnl;
-                return 1;
-            }
+    if( (NB_REG->flags & HAS_LBT) == 0 )
+        return 2;
+    if( LMIC.lbtLeft == LBT_CLEAR ) {
+        LMIC.lbtLeft = 0;
+        return 1;
+    }
+    u1_t chnl = LMIC.txChnl;
+    if( LMIC.lbtLeft == 0 ) { // start a new round at txChnl, lbtLeft-1 channels to go
+        LMIC.lbtLeft = MAX_CHANNELS_EU+1;
+        chnl += MAX_CHANNELS_EU-1;
+    }
+    LMIC.rps = setCr(updr2rps(LMIC.datarate), (cr_t)LMIC.errcr);
+    while( --LMIC.lbtLeft != 0 ) {
+        if( (chnl = (chnl+1)) >= MAX_CHANNELS_EU )
+            chnl -=  MAX_CHANNELS_EU;
+        if( (LMIC.channelMap[0] & (1<<chnl)) == 0 || // channel disabled
+            (LMIC.channelDrMap[chnl] & (1<<(LMIC.datarate&0xF))) == 0 )
+            continue;
+#if !defined(LBT_RSSI)
+        if( getSf(LMIC.rps) != FSK ) {
+            LMIC.txChnl = chnl;
+            channelCad(chnl);
+            return 3;
+        }
+#endif
+        u1_t available = channelAvailable(chnl);
+        chstatSensed(chnl, !available);
+        if( available ) {
+            LMIC.lbtLeft = 0;
+            LMIC.txChnl = chnl;
+            return 1;
         }
-        return 0;
     }
-    return 2;
+    return 0;
 }
 
 static void updateTx_NB (ostime_t txbeg) {
@@ -1048,9 +1284,10 @@ static void updateTx_NB (ostime_t txbeg) {
     // Update channel/global duty cycle stats
     LMIC.freq  = freq & ~(u4_t)7;
     debugf("freq %lu\r\n", LMIC.freq);
-    if (LMIC.nb_reg->flags & HAS_DUTYCYCLE) {
+    if (NB_REG->flags & HAS_DUTYCYCLE) {
         xref2band_t band = &LMIC.bands[freq & 0x7];
-        LMIC.txpow = band->txpow;
+        // ADR may have turned the power down below the band's limit
+        LMIC.txpow = LMIC.adrTxPow < band->txpow ? LMIC.adrTxPow : band->txpow;
         band->avail = txbeg + airtime * band->txcap;
     }
     if( LMIC.globalDutyRate != 0 )
@@ -1060,16 +1297,16 @@ static void updateTx_NB (ostime_t txbeg) {
 static void updateTx_WB (ostime_t txbeg) {
     u1_t chnl = LMIC.txChnl;
     if( chnl < 64 ) {
-        LMIC.freq = LMIC.wb_reg->freq_125kHz_upfbase +
-            chnl * LMIC.wb_reg->freq_125kHz_upfstep;
+        LMIC.freq = WB_REG->freq_125kHz_upfbase +
+            chnl * WB_REG->freq_125kHz_upfstep;
         debugf("freq %lu\r\n", LMIC.freq);
         LMIC.txpow = 30;
         return;
     }
     LMIC.txpow = 26;
     if( chnl < 64+8 ) {
-        LMIC.freq = LMIC.wb_reg->freq_500kHz_upfbase +
-            (chnl-64)*LMIC.wb_reg->freq_500kHz_upfstep;
+        LMIC.freq = WB_REG->freq_500kHz_upfbase +
+            (chnl-64)*WB_REG->freq_500kHz_upfstep;
     } else {
         ASSERT(chnl < 64+8+MAX_XCHANNELS_US);
         LMIC.freq = LMIC.xchFreq[chnl-72];
@@ -1085,9 +1322,84 @@ static void updateTx_WB (ostime_t txbeg) {
 
 #define updateTx(txbeg) REG(updateTx)(txbeg)
 
+// Airtime of the uplinks of the last hour, per duty cycle band and in
+// all, for LMIC_airtimeLeft().  It is kept in slots, the oldest of which
+// drops out as a whole, so the hour is up to a slot longer.
+#define AIRTIME_SLOTS   6
+#define AIRTIME_SLOT    sec2osticks(10*60)
+#define AIRTIME_HOUR    (AIRTIME_SLOTS*AIRTIME_SLOT)
+#define AIRTIME_ALL     MAX_BANDS_EU
+
+static PRIVILEGED_DATA struct {
+    ostime_t    used[MAX_BANDS_EU+1][AIRTIME_SLOTS];
+    ostime_t    start;      // of the current slot
+    u1_t        cur;        // current slot
+} airtime;
+
+static void airtimeAdvance (ostime_t now) {
+    // Also after 2^31 ticks (18 h) without an uplink
+    if( now - airtime.start < 0 || now - airtime.start >= AIRTIME_HOUR ) {
+        os_clearMem((xref2u1_t)&airtime, sizeof(airtime));
+        airtime.start = now;
+        return;
+    }
+    while( now - airtime.start >= AIRTIME_SLOT ) {
+        airtime.cur = (airtime.cur + 1) % AIRTIME_SLOTS;
+        for( u1_t b=0; b<=AIRTIME_ALL; b++ )
+            airtime.used[b][airtime.cur] = 0;
+        airtime.start += AIRTIME_SLOT;
+    }
+}
+
+static ostime_t airtimeUsed (u1_t band) {
+    ostime_t used = 0;
+    for( u1_t i=0; i<AIRTIME_SLOTS; i++ )
+        used += airtime.used[band][i];
+    return used;
+}
+
+static void airtimeTx (ostime_t txbeg) {
+    ostime_t t = calcAirTime(LMIC.rps, LMIC.dataLen);
+    airtimeAdvance(txbeg);
+    airtime.used[AIRTIME_ALL][airtime.cur] += t;
+    if( NB() && (NB_REG->flags & HAS_DUTYCYCLE) )
+        airtime.used[LMIC.channelFreq[LMIC.txChnl] & 0x7][airtime.cur] += t;
+}
+
+static bit_t chnlFeasible_NB (u1_t chnl, u1_t band) {
+    return (LMIC.channelMap[0] & (1<<chnl)) != 0 && // channel enabled
+        (LMIC.channelDrMap[chnl] & (1<<(LMIC.datarate&0xF))) != 0 &&
+        (band == 0xFF || band == (LMIC.channelFreq[chnl] & 0x7)); // in selected band
+}
+
+// Next channel after chnl in band (0xFF: any), weighed; 0xFF if none
+static u1_t nextChnl_NB (u1_t chnl, u1_t band) {
+    u2_t wmax = 0;
+    u1_t best = 0xFF;
+    for( u1_t ci=0; ci<MAX_CHANNELS_EU; ci++ ) {
+        if( chnlFeasible_NB(ci, band) && chstatWeight(ci) > wmax )
+            wmax = chstatWeight(best = ci);
+    }
+    if( best == 0xFF )
+        return best;
+    for( u1_t ci=0; ci<MAX_CHANNELS_EU; ci++ ) {
+        if( (chnl = (chnl+1)) >= MAX_CHANNELS_EU )
+            chnl -=  MAX_CHANNELS_EU;
+        if( chnlFeasible_NB(chnl, band) && chstatPick(chnl, wmax) )
+            return chnl;
+    }
+    return best;
+}
+
 static ostime_t nextTx_NB (ostime_t now) {
-    if (LMIC.nb_reg->flags & HAS_DUTYCYCLE) {
+    if (NB_REG->flags & HAS_DUTYCYCLE) {
         u1_t bmap=0xF;
+        // A band free since long ago is free now; its time would wrap
+        // around into the future after 2^31 ticks (18 h) otherwise
+        for( u1_t bi=0; bi<4; bi++ ) {
+            if( now - LMIC.bands[bi].avail > 0 )
+                LMIC.bands[bi].avail = now;
+        }
         for (;;) {
             ostime_t mintime = now + /*10h*/36000*OSTICKS_PER_SEC;
             u1_t band=0;
@@ -1096,16 +1408,10 @@ static ostime_t nextTx_NB (ostime_t now) {
                     mintime = LMIC.bands[band = bi].avail;
             }
             // Find next channel in given band
-            u1_t chnl = LMIC.bands[band].lastchnl;
-            for( u1_t ci=0; ci<MAX_CHANNELS_EU; ci++ ) {
-                if( (chnl = (chnl+1)) >= MAX_CHANNELS_EU )
-                    chnl -=  MAX_CHANNELS_EU;
-                if( (LMIC.channelMap[0] & (1<<chnl)) != 0 && // channel enabled
-                    (LMIC.channelDrMap[chnl] & (1<<(LMIC.datarate&0xF))) != 0 &&
-                    band == (LMIC.channelFreq[chnl] & 0x7) ) { // in selected band
-                    LMIC.txChnl = LMIC.bands[band].lastchnl = chnl;
-                    return mintime;
-                }
+            u1_t chnl = nextChnl_NB(LMIC.bands[band].lastchnl, band);
+            if( chnl != 0xFF ) {
+                LMIC.txChnl = LMIC.bands[band].lastchnl = chnl;
+                return mintime;
             }
             if( (bmap &= ~(1<<band)) == 0 ) {
                 // No feasible channel  found!
@@ -1113,16 +1419,9 @@ static ostime_t nextTx_NB (ostime_t now) {
             }
         }
     } else {
-        u1_t chnl = LMIC.txChnl;
-        for( u1_t ci=0; ci<MAX_CHANNELS_EU; ci++ ) {
-            if( (chnl = (chnl+1)) >= MAX_CHANNELS_EU )
-                chnl -=  MAX_CHANNELS_EU;
-            if( (LMIC.channelMap[0] & (1<<chnl)) != 0 && // channel enabled
-                (LMIC.channelDrMap[chnl] & (1<<(LMIC.datarate&0xF))) != 0 ) {
-                LMIC.txChnl = chnl;
-                break;
-            }
-        }
+        u1_t chnl = nextChnl_NB(LMIC.txChnl, 0xFF);
+        if( chnl != 0xFF )
+            LMIC.txChnl = chnl;
         return now;
     }
 }
@@ -1134,29 +1433,35 @@ static ostime_t nextTx_WB (ostime_t now) {
         first = 0;
         chans = 64;
     } else {
-        first = LMIC.wb_reg->freq_125kHz_1stchan;
-        chans = LMIC.wb_reg->freq_125kHz_chans;
+        first = WB_REG->freq_125kHz_1stchan;
+        chans = WB_REG->freq_125kHz_chans;
     }
     if( LMIC.chRnd==0 )
         LMIC.chRnd = os_getRndU1() % chans;
-    if( LMIC.datarate >= LMIC.wb_reg->dr_sf8c ) { // 500kHz
-        u1_t map = LMIC.channelMap[64/16]&0xFF;
-        for( u1_t i=0; i<8; i++ ) {
-            if( (map & (1<<(++LMIC.chRnd & 7))) != 0 ) {
-                LMIC.txChnl = 64 + (LMIC.chRnd & 7);
-                return now;
-            }
-        }
-    } else { // 125kHz
-        for( u1_t i=0; i<chans; i++ ) {
-            u1_t chnl = first + (++LMIC.chRnd % chans);
-            if( (LMIC.channelMap[(chnl >> 4)] & (1<<(chnl & 0xF))) != 0 ) {
-                LMIC.txChnl = chnl;
-                return now;
-            }
+    if( LMIC.datarate >= WB_REG->dr_sf8c ) { // 500kHz
+        first = 64;
+        chans = 8;
+    }
+    u2_t wmax = 0;
+    u1_t best = 0xFF;
+    for( u1_t chnl=first; chnl<first+chans; chnl++ ) {
+        if( (LMIC.channelMap[(chnl >> 4)] & (1<<(chnl & 0xF))) != 0 &&
+            chstatWeight(chnl) > wmax )
+            wmax = chstatWeight(best = chnl);
+    }
+    if( best == 0xFF ) {
+        // No feasible channel  found! Keep old one.
+        return now;
+    }
+    for( u1_t i=0; i<chans; i++ ) {
+        u1_t chnl = first + (++LMIC.chRnd % chans);
+        if( (LMIC.channelMap[(chnl >> 4)] & (1<<(chnl & 0xF))) != 0 &&
+            chstatPick(chnl, wmax) ) {
+            LMIC.txChnl = chnl;
+            return now;
         }
     }
-    // No feasible channel  found! Keep old one.
+    LMIC.txChnl = best;
     return now;
 }
 
@@ -1166,24 +1471,24 @@ static void setBcnRxParams (void) {
     LMIC.dataLen = 0;
     if (NB()) {
         LMIC.freq = LMIC.channelFreq[LMIC.bcnChnl];
-        if ((LMIC.nb_reg->flags & HAS_DUTYCYCLE))
+        if ((NB_REG->flags & HAS_DUTYCYCLE))
             LMIC.freq &= ~0x07;
     } else {
-        LMIC.freq = LMIC.wb_reg->freq_500kHz_dnfbase +
-            LMIC.bcnChnl * LMIC.wb_reg->freq_500kHz_dnfstep;
+        LMIC.freq = WB_REG->freq_500kHz_dnfbase +
+            LMIC.bcnChnl * WB_REG->freq_500kHz_dnfstep;
     }
     debugf("freq %lu\r\n", LMIC.freq);
-    LMIC.rps  = setIh(setNocrc(dndr2rps((dr_t)(NB() ? LMIC.nb_reg->bcn_dr :
+    LMIC.rps  = setIh(setNocrc(dndr2rps((dr_t)(NB() ? NB_REG->bcn_dr :
                     DR_BCN_US)),1),REG(LEN_BCN));
 }
 
 #define setRx1Params() do {                                             \
     if (!NB()) {                                                        \
-        LMIC.freq = LMIC.wb_reg->freq_500kHz_dnfbase +                  \
-            (LMIC.txChnl & 0x7) * LMIC.wb_reg->freq_500kHz_dnfstep;     \
-        if( /* TX datarate */LMIC.dndr < LMIC.wb_reg->dr_sf8c )         \
-            LMIC.dndr += LMIC.wb_reg->rx1_dr_offset;                    \
-        else if( LMIC.dndr == LMIC.wb_reg->dr_sf8c )                    \
+        LMIC.freq = WB_REG->freq_500kHz_dnfbase +                  \
+            (LMIC.txChnl & 0x7) * WB_REG->freq_500kHz_dnfstep;     \
+        if( /* TX datarate */LMIC.dndr < WB_REG->dr_sf8c )         \
+            LMIC.dndr += WB_REG->rx1_dr_offset;                    \
+        else if( LMIC.dndr == WB_REG->dr_sf8c )                    \
             LMIC.dndr = DR_SF7CR_US;                                    \
         LMIC.rps = dndr2rps(LMIC.dndr);                                 \
     }                                                                   \
@@ -1194,15 +1499,15 @@ static void initJoinLoop (void) {
 #if CFG_TxContinuousMode
     LMIC.txChnl = 0;
 #else
-    LMIC.txChnl = NB() ? os_getRndU1() % LMIC.nb_reg->channels :
-        (LMIC.region & REGION_FULL) ? 0 : LMIC.wb_reg->freq_125kHz_1stchan;
+    LMIC.txChnl = NB() ? os_getRndU1() % NB_REG->channels :
+        (LMIC.region & REGION_FULL) ? 0 : WB_REG->freq_125kHz_1stchan;
 #endif
-    LMIC.adrTxPow = NB() ? 14 : 20;
+    LMIC.adrTxPow = DFLT_TXPOW;
     setDrJoin(DRCHG_SET, get_hi_dr());
     if (NB())
         initDefaultChannels_NB(1);
     ASSERT((LMIC.opmode & OP_NEXTCHNL)==0);
-    LMIC.txend = NB() && (LMIC.nb_reg->flags & HAS_DUTYCYCLE) ?
+    LMIC.txend = NB() && (NB_REG->flags & HAS_DUTYCYCLE) ?
         LMIC.bands[BAND_MILLI_1].avail + rndDelay(8) : os_getTime();
 }
 
@@ -1212,7 +1517,7 @@ static ostime_t nextJoinState_NB (void) {
 
     // Try 869.x and then 864.x with same DR
     // If both fail try next lower datarate
-    if( ++LMIC.txChnl == LMIC.nb_reg->channels )
+    if( ++LMIC.txChnl == NB_REG->channels )
         LMIC.txChnl = 0;
     if( (++LMIC.txCnt & 1) == 0 ) {
         // Lower DR every 2nd try (having tried 868.x and 864.x with the same DR)
@@ -1226,7 +1531,7 @@ static ostime_t nextJoinState_NB (void) {
     // Move txend to randomize synchronized concurrent joins.
     // Duty cycle is based on txend.
     ostime_t time = os_getTime();
-    if( (LMIC.nb_reg->flags & HAS_DUTYCYCLE) &&
+    if( (NB_REG->flags & HAS_DUTYCYCLE) &&
         time - LMIC.bands[BAND_MILLI_1].avail < 0 )
         time = LMIC.bands[BAND_MILLI_1].avail;
     LMIC.txend = time +
@@ -1246,15 +1551,15 @@ static ostime_t nextJoinState_WB (void) {
     //   SF8C        on a random channel 64..71
     //
     u1_t failed = 0;
-    if( LMIC.datarate != LMIC.wb_reg->dr_sf8c ) {
+    if( LMIC.datarate != WB_REG->dr_sf8c ) {
         LMIC.txChnl = (LMIC.region & REGION_FULL) ? 64+(LMIC.txChnl&7) :
-            LMIC.wb_reg->freq_500kHz_chan;
-        setDrJoin(DRCHG_SET, wb_reg->dr_sf8c);
+            WB_REG->freq_500kHz_chan;
+        setDrJoin(DRCHG_SET, WB_REG->dr_sf8c);
     } else {
         LMIC.txChnl = (LMIC.region & REGION_FULL) ?
             os_getRndU1() & 0x3F :
-            LMIC.wb_reg->freq_125kHz_1stchan +
-            (os_getRndU1() % LMIC.wb_reg->freq_125kHz_chans);
+            WB_REG->freq_125kHz_1stchan +
+            (os_getRndU1() % WB_REG->freq_125kHz_chans);
         s1_t dr = get_hi_dr() - ++LMIC.txCnt;
         if( dr < DR_SF10_US ) {
             dr = DR_SF10_US;
@@ -1308,11 +1613,11 @@ static void stateJustJoined (void) {
     LMIC.pingSetAns  = 0;
     LMIC.upRepeat    = 0;
     LMIC.adrAckReq   = LINK_CHECK_INIT;
-    LMIC.dn2Dr       = NB() ? LMIC.nb_reg->dn2_dr : DR_DNW2_US;
-    LMIC.dn2Freq     = NB() ? LMIC.nb_reg->dn2_freq : FREQ_DNW2_US;
-    LMIC.bcnChnl     = NB() ? LMIC.nb_reg->bcn_chnl : CHNL_BCN_US;
-    LMIC.ping.freq   = NB() ? LMIC.nb_reg->ping_freq : FREQ_PING_US;
-    LMIC.ping.dr     = NB() ? LMIC.nb_reg->ping_dr : DR_PING_US;
+    LMIC.dn2Dr       = NB() ? NB_REG->dn2_dr : DR_DNW2_US;
+    LMIC.dn2Freq     = NB() ? NB_REG->dn2_freq : FREQ_DNW2_US;
+    LMIC.bcnChnl     = NB() ? NB_REG->bcn_chnl : CHNL_BCN_US;
+    LMIC.ping.freq   = NB() ? NB_REG->ping_freq : FREQ_PING_US;
+    LMIC.ping.dr     = NB() ? NB_REG->ping_dr : DR_PING_US;
 }
 
 
@@ -1402,7 +1707,7 @@ static bit_t decodeFrame (void) {
 
     seqno = LMIC.seqnoDn + (u2_t)(seqno - LMIC.seqnoDn);
 
-    if( !aes_verifyMic(LMIC.nwkKey, LMIC.devaddr, seqno, /*dn*/1, d, pend) ) {
+    if( !aes_verifyMic(NWK_SESSKEY, LMIC.devaddr, seqno, /*dn*/1, d, pend) ) {
         EV(spe3Cond, ERR, (e_.reason = EV::spe3Cond_t::CORRUPTED_MIC,
                            e_.eui1   = MAIN::CDEV->getEui(),
                            e_.info1  = Base::lsbf4(&d[pend]),
@@ -1538,7 +1843,7 @@ static bit_t decodeFrame (void) {
         case MCMD_TXPS_REQ: {
             u1_t p1 = opts[oidx+1];
             oidx += 2;
-            if (NB() && (LMIC.nb_reg->flags & HAS_DWELLTIME)) {
+            if (NB() && (NB_REG->flags & HAS_DWELLTIME)) {
                 LMIC.txpow = maxEIRP[p1 & 0x07];
                 setupDwellTime((p1 & 0x30) >> 4);
                 LMIC.txParamSetupAns = 1;
@@ -1603,7 +1908,7 @@ static bit_t decodeFrame (void) {
         // Handle payload only if not a replay
         // Decrypt payload - if any
         if( port >= 0  &&  pend-poff > 0 )
-            aes_cipher(port <= 0 ? LMIC.nwkKey : LMIC.artKey, LMIC.devaddr, seqno, /*dn*/1, d+poff, pend-poff);
+            aes_cipher(port <= 0 ? NWK_SESSKEY : ART_SESSKEY, LMIC.devaddr, seqno, /*dn*/1, d+poff, pend-poff);
 
         EV(dfinfo, DEBUG, (e_.deveui  = MAIN::CDEV->getEui(),
                            e_.devaddr = LMIC.devaddr,
@@ -1654,6 +1959,124 @@ static bit_t decodeFrame (void) {
 // ================================================================================
 // TX/RX transaction support
 
+// Class A windows calibrate themselves.  Downlinks received in RX1/RX2
+// show how far from the nominal time the gateway's frames really start,
+// per data rate: mean and mean deviation, as TCP keeps for the RTT.  The
+// window is centred on the mean and sized to four mean deviations either
+// way, in place of the fixed MINRX_SYMS.  Likewise the time the radio
+// takes to set up after the window's job runs sizes the ramp-up, in
+// place of RX_RAMPUP, to cut the busy wait in rxlora().
+
+// Downlinks to hear at a data rate before its windows are narrowed
+#define RXCAL_SAMPLES   4
+// Timestamp resolution, and crystal drift over the longest RX delay
+#define RXCAL_GUARD     us2osticksCeil(200)
+// Centred on the preamble, a window of n>=4 symbols still sees 4 of its
+// 8 symbols as long as it is off by less than n/2 symbols.
+#define RXCAL_MINSYMS   4
+// Answers missed in a row before the windows that missed them widen again
+#define RXCAL_MISSES    3
+
+static PRIVILEGED_DATA struct {
+    s4_t        off[16];    // mean error per DR [ticks*8]
+    s4_t        dev[16];    // mean deviation of it [ticks*4]
+    u1_t        n[16];      // downlinks heard per DR
+    ostime_t    setup;      // radio setup time [ticks*8]
+    u1_t        nsetup;     // windows set up
+    ostime_t    rampup;     // used for the current window
+    ostime_t    expect;     // nominal start of the downlink
+    dr_t        dr;         // of the current window
+    bit_t       learn;      // current window is a LoRa one, set up by rxcalWindow()
+    u1_t        misses;     // answers missed in a row by RX1 and RX2
+} rxcal;
+
+static ostime_t rxcalRampup (void) {
+    if( rxcal.nsetup < RXCAL_SAMPLES )
+        return RX_RAMPUP;
+    ostime_t rampup = (rxcal.setup >> 3) + RXCAL_GUARD;
+    return rampup < RX_RAMPUP ? rampup : RX_RAMPUP;
+}
+
+// Run func in time to set up the radio for LMIC.rxtime
+static void rxcalSchedule (osjobcb_t func) {
+    rxcal.rampup = rxcalRampup();
+    os_setTimedCallback(&LMIC.osjob, LMIC.rxtime - rxcal.rampup, func);
+}
+
+// Set up a window for a downlink due delay after the end of TX at dr
+static void rxcalWindow (ostime_t delay, dr_t dr, osjobcb_t func) {
+    u1_t     i      = dr & 0xF;
+    ostime_t hsym   = dr2hsym(dr);
+    ostime_t off    = 0;
+    u4_t     rxsyms = MINRX_SYMS;
+
+    if( rxcal.n[i] >= RXCAL_SAMPLES ) {
+        off    = rxcal.off[i] >> 3;
+        rxsyms = (rxcal.dev[i] + RXCAL_GUARD + hsym - 1) / hsym;
+        if( rxsyms < RXCAL_MINSYMS )
+            rxsyms = RXCAL_MINSYMS;
+        else if( rxsyms > 0xFF )
+            rxsyms = 0xFF;
+    }
+    rxcal.expect = LMIC.txend + delay;
+    rxcal.dr     = dr;
+    rxcal.learn  = 1;
+    LMIC.rxtime  = rxcal.expect + off + (PAMBL_SYMS-(s4_t)rxsyms)*hsym;
+    LMIC.rxsyms  = rxsyms;
+    rxcalSchedule(func);
+}
+
+// The radio has been set up for the window - learn how long that took
+static void rxcalSetup (void) {
+    ostime_t setup = rxcal.rampup - LMIC.rxslack;
+    if( setup < 0 )
+        setup = 0;
+    // Follow a longer setup at once, a shorter one slowly
+    if( rxcal.nsetup == 0 || (setup << 3) > rxcal.setup )
+        rxcal.setup = setup << 3;
+    else
+        rxcal.setup -= rxcal.setup >> 4;
+    if( rxcal.nsetup < RXCAL_SAMPLES )
+        rxcal.nsetup++;
+}
+
+// Error of the downlink just received in RX1/RX2, to learn once it checks out
+static ostime_t rxcalError (void) {
+    return LMIC.rxtime - calcAirTime(LMIC.rps, LMIC.dataLen) - rxcal.expect;
+}
+
+static void rxcalLearn (ostime_t err) {
+    u1_t i = rxcal.dr & 0xF;
+    if( (LMIC.txrxFlags & (TXRX_DNW1|TXRX_DNW2)) == 0 || !rxcal.learn )
+        return;
+    if( rxcal.n[i] == 0 ) {
+        rxcal.off[i] = err << 3;
+        rxcal.dev[i] = (err < 0 ? -err : err) << 1;
+    } else {
+        err -= rxcal.off[i] >> 3;
+        rxcal.off[i] += err;
+        rxcal.dev[i] += (err < 0 ? -err : err) - (rxcal.dev[i] >> 2);
+    }
+    if( rxcal.n[i] < RXCAL_SAMPLES )
+        rxcal.n[i]++;
+    rxcal.misses = 0;
+    debugf("rxcal dr %d: off %ld dev %ld setup %ld\r\n", rxcal.dr,
+           rxcal.off[i] >> 3, rxcal.dev[i] >> 2, rxcal.setup >> 3);
+}
+
+// Neither RX1 nor RX2 heard the answer the uplink asked for.  Only
+// downlinks narrow the windows, so if the offset has drifted out of
+// them (temperature, another gateway) they would miss from then on:
+// after RXCAL_MISSES in a row, widen them until they have relearned.
+static void rxcalMissed (void) {
+    if( ++rxcal.misses < RXCAL_MISSES )
+        return;
+    rxcal.misses = 0;
+    rxcal.n[LMIC.dndr & 0xF] = 0;
+    rxcal.n[rxcal.dr & 0xF] = 0;
+    debugf("rxcal dr %d/%d: missed, widened\r\n", LMIC.dndr, rxcal.dr);
+}
+
 
 static void setupRx2 (void) {
     LMIC.txrxFlags = TXRX_DNW2;
@@ -1662,13 +2085,12 @@ static void setupRx2 (void) {
     debugf("freq %lu\r\n", LMIC.freq);
     LMIC.dataLen = 0;
     os_radio(RADIO_RX);
+    rxcalSetup();
 }
 
 
 static void schedRx2 (ostime_t delay, osjobcb_t func) {
-    // Add 1.5 symbols we need 5 out of 8. Try to sync 1.5 symbols into the preamble.
-    LMIC.rxtime = LMIC.txend + delay + (PAMBL_SYMS-MINRX_SYMS)*dr2hsym(LMIC.dn2Dr);
-    os_setTimedCallback(&LMIC.osjob, LMIC.rxtime - RX_RAMPUP, func);
+    rxcalWindow(delay, LMIC.dn2Dr, func);
 }
 
 static void setupRx1 (osjobcb_t func) {
@@ -1678,6 +2100,7 @@ static void setupRx1 (osjobcb_t func) {
     LMIC.dataLen = 0;
     LMIC.osjob.func = func;
     os_radio(RADIO_RX);
+    rxcalSetup();
 }
 
 
@@ -1690,16 +2113,16 @@ static void txDone (ostime_t delay, osjobcb_t func) {
     // Change RX frequency / rps (wideband only) before we increment txChnl
     setRx1Params();
     // LMIC.rxsyms carries the TX datarate (can be != LMIC.datarate [confirm retries etc.])
-    // Setup receive - LMIC.rxtime is preloaded with 1.5 symbols offset to tune
-    // into the middle of the 8 symbols preamble.
+    // Setup receive - until calibrated LMIC.rxtime is preloaded with 1.5 symbols
+    // offset to tune into the middle of the 8 symbols preamble.
     if( NB() && /* TX datarate */LMIC.rxsyms == DR_FSK_EU ) {
         LMIC.rxtime = LMIC.txend + delay - PRERX_FSK*us2osticksRound(160);
         LMIC.rxsyms = RXLEN_FSK;
+        rxcal.learn = 0;  // FSK timing says nothing about the LoRa windows
+        rxcalSchedule(func);
     } else {
-        LMIC.rxtime = LMIC.txend + delay + (PAMBL_SYMS-MINRX_SYMS)*dr2hsym(LMIC.dndr);
-        LMIC.rxsyms = MINRX_SYMS;
+        rxcalWindow(delay, LMIC.dndr, func);
     }
-    os_setTimedCallback(&LMIC.osjob, LMIC.rxtime - RX_RAMPUP, func);
 }
 
 
@@ -1765,6 +2188,8 @@ static bit_t processJoinAccept (void) {
                            e_.info   = mic));
         goto badframe;
     }
+    rxcalLearn(rxcalError());
+    chstatRx();
 
     u4_t addr = os_rlsbf4(LMIC.frame+OFF_JA_DEVADDR);
     LMIC.devaddr = addr;
@@ -1776,8 +2201,8 @@ static bit_t processJoinAccept (void) {
         if (!NB())
             goto badframe;
         dlen = OFF_CFLIST;
-        for( u1_t chidx = LMIC.nb_reg->dflt_channels;
-            chidx<LMIC.nb_reg->dflt_channels + 5;
+        for( u1_t chidx = NB_REG->dflt_channels;
+            chidx<NB_REG->dflt_channels + 5;
             chidx++, dlen+=3 ) {
             u4_t freq = convFreq(&LMIC.frame[dlen]);
             if( freq )
@@ -1787,6 +2212,7 @@ static bit_t processJoinAccept (void) {
 
     // already incremented when JOIN REQ got sent off
     aes_sessKeys(LMIC.devNonce-1, &LMIC.frame[OFF_JA_ARTNONCE], LMIC.nwkKey, LMIC.artKey);
+    aes_expandSession();
     DO_DEVDB(LMIC.netid,   netid);
     DO_DEVDB(LMIC.devaddr, devaddr);
     DO_DEVDB(LMIC.nwkKey,  nwkkey);
@@ -1816,8 +2242,10 @@ static bit_t processJoinAccept (void) {
 
 static void processRx2Jacc (xref2osjob_t osjob) {
     (void)osjob;
-    if( LMIC.dataLen == 0 )
+    if( LMIC.dataLen == 0 ) {
         LMIC.txrxFlags = 0;  // nothing in 1st/2nd DN slot
+        rxcalMissed();
+    }
     processJoinAccept();
 }
 
@@ -1900,6 +2328,36 @@ static void updataDone (xref2osjob_t osjob) {
 // ======================================== 
 
 
+// Bytes of MAC options the next data frame carries - must match buildDataFrame
+static u1_t pendOptsLen (void) {
+    u1_t len = 0;
+    if( (LMIC.opmode & (OP_TRACK|OP_PINGABLE)) == (OP_TRACK|OP_PINGABLE) )
+        len += 2;
+    if( LMIC.dutyCapAns )
+        len += 1;
+    if( LMIC.txParamSetupAns )
+        len += 1;
+    if( LMIC.dn2Ans )
+        len += 2;
+    if( LMIC.devsAns )
+        len += 3;
+    if( LMIC.ladrAns )
+        len += 2;
+    if( LMIC.bcninfoTries > 0 )
+        len += 1;
+    if( LMIC.pingSetAns != 0 )
+        len += 2;
+    if( LMIC.snchAns )
+        len += 2;
+    return len;
+}
+
+// Longest frame allowed at the current datarate
+static u1_t txFrameLen (void) {
+    u1_t len = maxFrameLen(LMIC.datarate);
+    return len < MAX_LEN_FRAME ? len : MAX_LEN_FRAME;
+}
+
 static void buildDataFrame (void) {
     bit_t txdata = ((LMIC.opmode & (OP_TXDATA|OP_POLL)) != OP_POLL);
     u1_t dlen = txdata ? LMIC.pendTxLen : 0;
@@ -1965,9 +2423,13 @@ static void buildDataFrame (void) {
     }
     ASSERT(end <= OFF_DAT_OPTS+16);
 
-    u1_t flen = end + (txdata ? 5+dlen : 4);
-    if( flen > MAX_LEN_FRAME ) {
-        // Options and payload too big - delay payload
+    int  flen = end + (txdata ? 5+dlen : 4);
+    LMIC.pendTxDelayed = LMIC.pendTxDropped = 0;
+    if( flen > txFrameLen() ) {
+        // Options and payload too big - delay payload, unless it is too
+        // big for this datarate even on its own
+        LMIC.pendTxDelayed = OFF_DAT_OPTS+5+dlen <= txFrameLen();
+        LMIC.pendTxDropped = txdata && !LMIC.pendTxDelayed;
         txdata = 0;
         flen = end+4;
     }
@@ -2001,11 +2463,11 @@ static void buildDataFrame (void) {
         }
         LMIC.frame[end] = LMIC.pendTxPort;
         os_copyMem(LMIC.frame+end+1, LMIC.pendTxData, dlen);
-        aes_cipher(LMIC.pendTxPort==0 ? LMIC.nwkKey : LMIC.artKey,
-                   LMIC.devaddr, LMIC.seqnoUp-1,
-                   /*up*/0, LMIC.frame+end+1, dlen);
+        aes_seal(LMIC.pendTxPort==0 ? NWK_SESSKEY : ART_SESSKEY,
+                 LMIC.devaddr, LMIC.seqnoUp-1, LMIC.frame, end+1, flen-4);
+    } else {
+        aes_appendMic(NWK_SESSKEY, LMIC.devaddr, LMIC.seqnoUp-1, /*up*/0, LMIC.frame, flen-4);
     }
-    aes_appendMic(LMIC.nwkKey, LMIC.devaddr, LMIC.seqnoUp-1, /*up*/0, LMIC.frame, flen-4);
 
     EV(dfinfo, DEBUG, (e_.deveui  = MAIN::CDEV->getEui(),
                        e_.devaddr = LMIC.devaddr,
@@ -2192,6 +2654,9 @@ static bit_t processDnData (void) {
     ASSERT((LMIC.opmode & OP_TXRXPEND)!=0);
 
     if( LMIC.dataLen == 0 ) {
+        // A confirmed frame or an ADR ack request asked for an answer
+        if( LMIC.txCnt != 0 || LMIC.adrAckReq >= 0 )
+            rxcalMissed();
       norx:
         if( LMIC.txCnt != 0 ) {
             if( LMIC.txCnt < TXCONF_ATTEMPTS ) {
@@ -2212,7 +2677,7 @@ static bit_t processDnData (void) {
             LMIC.adrAckReq += 1;
         LMIC.dataBeg = LMIC.dataLen = 0;
       txcomplete:
-        LMIC.opmode &= ~(OP_TXDATA|OP_TXRXPEND);
+        LMIC.opmode &= ~(OP_TXRXPEND | (LMIC.pendTxDelayed ? 0 : OP_TXDATA));
         if( (LMIC.txrxFlags & (TXRX_DNW1|TXRX_DNW2|TXRX_PING)) != 0  &&  (LMIC.opmode & OP_LINKDEAD) != 0 ) {
             LMIC.opmode &= ~OP_LINKDEAD;
             reportEvent(EV_LINK_ALIVE);
@@ -2222,11 +2687,15 @@ static bit_t processDnData (void) {
         // assume link is dead - notify application and keep going
         if( LMIC.adrAckReq > LINK_CHECK_DEAD ) {
             // We haven't heard from NWK for some time although we
-            // asked for a response for some time - assume we're disconnected. Lower DR one notch.
+            // asked for a response for some time - assume we're disconnected.
+            // Go back to full power if ADR lowered it, else lower DR one notch.
             EV(devCond, ERR, (e_.reason = EV::devCond_t::LINK_DEAD,
                               e_.eui    = MAIN::CDEV->getEui(),
                               e_.info   = LMIC.adrAckReq));
-            setDrTxpow(DRCHG_NOADRACK, decDR((dr_t)LMIC.datarate), KEEP_TXPOW);
+            if( LMIC.adrTxPow < DFLT_TXPOW )
+                setDrTxpow(DRCHG_NOADRACK, LMIC.datarate, DFLT_TXPOW);
+            else
+                setDrTxpow(DRCHG_NOADRACK, decDR((dr_t)LMIC.datarate), KEEP_TXPOW);
             LMIC.adrAckReq = LINK_CHECK_CONT;
             LMIC.opmode |= OP_REJOIN|OP_LINKDEAD;
             reportEvent(EV_LINK_DEAD);
@@ -2243,11 +2712,14 @@ static bit_t processDnData (void) {
         }
         return 1;
     }
+    ostime_t rxerr = rxcalError();
     if( !decodeFrame() ) {
         if( (LMIC.txrxFlags & TXRX_DNW1) != 0 )
             return 0;
         goto norx;
     }
+    rxcalLearn(rxerr);
+    chstatRx();
     goto txcomplete;
 }
 
@@ -2303,7 +2775,7 @@ static void processBeacon (xref2osjob_t osjob) {
         }
     }
     LMIC.bcnRxtime = LMIC.bcninfo.txtime + BCN_INTV_osticks -
-        calcRxWindow(0, NB() ? LMIC.nb_reg->bcn_dr : DR_BCN_US);
+        calcRxWindow(0, NB() ? NB_REG->bcn_dr : DR_BCN_US);
     LMIC.bcnRxsyms = LMIC.rxsyms;
   rev:
     if (!NB())
@@ -2328,6 +2800,47 @@ static void startRxPing (xref2osjob_t osjob) {
 }
 
 
+// Class C: a frame came in on RX2, or it is time to stop listening
+static void processRxC (xref2osjob_t osjob) {
+    (void)osjob;
+    os_clearCallback(&LMIC.osjob);
+    os_radio(RADIO_RST);
+    LMIC.opmode &= ~OP_RXC;
+    if( LMIC.dataLen != 0 ) {
+        LMIC.txrxFlags = TXRX_DNC;
+        if( decodeFrame() ) {
+            reportEvent(EV_RXCOMPLETE);
+            return;
+        }
+    }
+    engineUpdate();
+}
+
+
+// Class C: listen on RX2 until the given time (0: for good), unless the
+// radio is wanted for something else.  Not while a confirmed uplink
+// waits for its ACK, which only comes in RX1/RX2.
+static bit_t startRxC (ostime_t until) {
+    if( (LMIC.opmode & (OP_CLASSC|OP_TRACK|OP_JOINING)) != OP_CLASSC ||
+        LMIC.devaddr == 0 || LMIC.txCnt != 0 )
+        return 0;
+    LMIC.rps = dndr2rps(LMIC.dn2Dr);
+    if( getSf(LMIC.rps) == FSK )
+        return 0;   // radio.c only scans with LoRa
+    LMIC.freq = LMIC.dn2Freq;
+    LMIC.dataLen = 0;
+    LMIC.opmode |= OP_RXC;
+    if( until != 0 ) {
+        os_setTimedCallback(&LMIC.osjob, until, FUNC_ADDR(processRxC));
+    } else {
+        os_clearCallback(&LMIC.osjob);
+        LMIC.osjob.func = FUNC_ADDR(processRxC);
+    }
+    os_radio(RADIO_RXON);
+    return 1;
+}
+
+
 // Decide what to do next for the MAC layer of a device
 static void engineUpdate (void) {
     static PRIVILEGED_DATA u1_t lbt_retries;
@@ -2336,6 +2849,14 @@ static void engineUpdate (void) {
     if( (LMIC.opmode & (OP_SCAN|OP_TXRXPEND|OP_SHUTDOWN)) != 0 ) 
         return;
 
+    if( (LMIC.opmode & OP_RXC) != 0 ) {
+        // Stop listening in class C, it resumes below if the radio is
+        // still free.  A frame received just now is lost.
+        os_clearCallback(&LMIC.osjob);
+        os_radio(RADIO_RST);
+        LMIC.opmode &= ~OP_RXC;
+    }
+
     if( LMIC.devaddr == 0 && (LMIC.opmode & OP_JOINING) == 0 ) {
         LMIC_startJoining();
         return;
@@ -2390,6 +2911,8 @@ static void engineUpdate (void) {
                 lbt_retries = 0;
                 LMIC.txend = now = os_getTime();
                 break;
+            case 3:
+                return;
             }
             // We could send right now!
             txbeg = now;
@@ -2426,13 +2949,21 @@ static void engineUpdate (void) {
                     // App code might do some stuff after send unaware of RESET.
                     goto reset;
                 }
+                // The counter must be stored before a frame uses it, or
+                // a reboot could reuse it - if that fails, try again later
+                if( !os_reserveSeqnoUp(LMIC.txCnt == 0 ? LMIC.seqnoUp : LMIC.seqnoUp-1) ) {
+                    txbeg = now + 2 * TX_RAMPUP + rndDelay(RETRY_PERIOD_secs);
+                    goto lbtdelay;
+                }
                 buildDataFrame();
                 LMIC.osjob.func = FUNC_ADDR(updataDone);
             }
             LMIC.rps    = setCr(updr2rps(txdr), (cr_t)LMIC.errcr);
             LMIC.dndr   = txdr;  // carry TX datarate (can be != LMIC.datarate) over to txDone/setupRx1
             LMIC.opmode = (LMIC.opmode & ~(OP_POLL|OP_RNDTX)) | OP_TXRXPEND | OP_NEXTCHNL;
+            chstatTx(jacc);
             updateTx(txbeg);
+            airtimeTx(txbeg);
             reportEvent(EV_TXSTART);
             os_radio(RADIO_TX);
             return;
@@ -2446,8 +2977,10 @@ static void engineUpdate (void) {
             txbeg += 1;  // TX delayed by one tick (insignificant amount of time)
     } else {
         // No TX pending - no scheduled RX
-        if( (LMIC.opmode & OP_TRACK) == 0 )
+        if( (LMIC.opmode & OP_TRACK) == 0 ) {
+            startRxC(0);
             return;
+        }
     }
 
     // Are we pingable?
@@ -2489,7 +3022,83 @@ static void engineUpdate (void) {
                        e_.eui    = MAIN::CDEV->getEui(),
                        e_.info   = osticks2ms(txbeg-now),
                        e_.info2  = LMIC.seqnoUp-1));
-    os_setTimedCallback(&LMIC.osjob, txbeg-TX_RAMPUP, FUNC_ADDR(runEngineUpdate));
+    if( !startRxC(txbeg-TX_RAMPUP) )
+        os_setTimedCallback(&LMIC.osjob, txbeg-TX_RAMPUP, FUNC_ADDR(runEngineUpdate));
+}
+
+
+// Sensitivity in dBm of uplinks at data rate dr, 0 if they may not use it
+s2_t LMIC_upSensitivity (dr_t dr) {
+    if( dr > get_hi_dr() || !validDR(dr) )
+        return 0;
+    return getSensitivity(updr2rps(dr));
+}
+
+
+// Whether nextTx_NB() may pick band, having a channel for the data rate
+static bit_t bandFeasible_NB (u1_t band) {
+    for( u1_t ci=0; ci<MAX_CHANNELS_EU; ci++ ) {
+        if( chnlFeasible_NB(ci, band) )
+            return 1;
+    }
+    return 0;
+}
+
+// Earliest time the duty cycle lets the next uplink start
+ostime_t LMIC_nextTxTime (void) {
+    ostime_t now = os_getTime(), txbeg = now;
+    if( NB() && (NB_REG->flags & HAS_DUTYCYCLE) ) {
+        // The band nextTx_NB() picks: the first to become free
+        ostime_t mintime = now + /*10h*/36000*OSTICKS_PER_SEC;
+        for( u1_t bi=0; bi<4; bi++ ) {
+            if( bandFeasible_NB(bi) && mintime - LMIC.bands[bi].avail > 0 )
+                mintime = LMIC.bands[bi].avail;
+        }
+        if( mintime - txbeg > 0 )
+            txbeg = mintime;
+    }
+    if( (LMIC.globalDutyRate != 0 || (LMIC.opmode & OP_RNDTX) != 0) &&
+        LMIC.globalDutyAvail - txbeg > 0 )
+        txbeg = LMIC.globalDutyAvail;
+    return txbeg;
+}
+
+
+// Uplink airtime left to the duty cycle within the last hour, in all
+// the bands nextTx() may use; the hour, less airtime used, if unlimited
+ostime_t LMIC_airtimeLeft (void) {
+    airtimeAdvance(os_getTime());
+    ostime_t left = AIRTIME_HOUR - airtimeUsed(AIRTIME_ALL);
+    if( NB() && (NB_REG->flags & HAS_DUTYCYCLE) ) {
+        ostime_t bands = 0;
+        for( u1_t bi=0; bi<4; bi++ ) {
+            if( LMIC.bands[bi].txcap == 0 || !bandFeasible_NB(bi) )
+                continue;
+            ostime_t l = AIRTIME_HOUR / LMIC.bands[bi].txcap - airtimeUsed(bi);
+            if( l > 0 )
+                bands += l;
+        }
+        if( bands < left )
+            left = bands;
+    }
+    if( LMIC.globalDutyRate != 0 ) {
+        ostime_t l = (AIRTIME_HOUR >> LMIC.globalDutyRate) - airtimeUsed(AIRTIME_ALL);
+        if( l < left )
+            left = l;
+    }
+    return left < 0 ? 0 : left;
+}
+
+
+// Link quality of uplink channel chnl, NULL if there is no such channel
+const chstat_t* LMIC_chStats (u1_t chnl) {
+    return chnl < MAX_CHSTATS ? &chstats.ch[chnl] : NULL;
+}
+
+
+// Odds of picking chnl, 256 being the best, as nextTx() weighs them
+u2_t LMIC_chWeight (u1_t chnl) {
+    return chstatWeight(chnl);
 }
 
 
@@ -2507,7 +3116,7 @@ void LMIC_setDrTxpow (dr_t dr, s1_t txpow) {
 void LMIC_shutdown (void) {
     os_clearCallback(&LMIC.osjob);
     os_radio(RADIO_RST);
-    LMIC.opmode |= OP_SHUTDOWN;
+    LMIC.opmode = (LMIC.opmode & ~OP_RXC) | OP_SHUTDOWN;
 }
 
 
@@ -2519,25 +3128,37 @@ int LMIC_reset (u1_t region) {
     os_clearCallback(&LMIC.osjob);
 
     os_clearMem((xref2u1_t)&LMIC,SIZEOFEXPR(LMIC));
+    // The RX calibration belongs to the old link, as the rest of LMIC
+    os_clearMem((xref2u1_t)&rxcal,sizeof(rxcal));
     if ((region & ~(REGION_MASK | REGION_FLAGS)) != 0 ||
         (region & REGION_MASK) >=
          (region & REGION_WIDEBAND ? ARRAY_SIZE(wb_reg) : ARRAY_SIZE(nb_reg))) {
         return -1;
     }
+#ifdef LMIC_REGION
+    if ((region & ~REGION_FULL) != (LMIC_REGION))
+        return -1;
+#endif
     LMIC.region       =  region;
+    if( chstats.region != region ) {
+        os_clearMem((xref2u1_t)&chstats, sizeof(chstats));
+        chstats.region = region;
+    }
+#ifndef LMIC_REGION
     if (region & REGION_WIDEBAND)
         LMIC.wb_reg = wb_reg + (region & REGION_MASK);
     else
         LMIC.nb_reg = nb_reg + (region & REGION_MASK);
+#endif
     LMIC.devaddr      =  0;
     LMIC.devNonce     =  os_getRndU2();
     LMIC.opmode       =  OP_NONE;
     LMIC.errcr        =  CR_4_5;
     LMIC.adrEnabled   =  FCT_ADREN;
-    LMIC.dn2Dr        =  NB() ? LMIC.nb_reg->dn2_dr : DR_DNW2_US;      // we need this for 2nd DN window of join accept
-    LMIC.dn2Freq      =  NB() ? LMIC.nb_reg->dn2_freq : FREQ_DNW2_US;  // ditto
-    LMIC.ping.freq    =  NB() ? LMIC.nb_reg->ping_freq : FREQ_PING_US; // defaults for ping
-    LMIC.ping.dr      =  NB() ? LMIC.nb_reg->ping_dr : DR_PING_US;     // ditto
+    LMIC.dn2Dr        =  NB() ? NB_REG->dn2_dr : DR_DNW2_US;      // we need this for 2nd DN window of join accept
+    LMIC.dn2Freq      =  NB() ? NB_REG->dn2_freq : FREQ_DNW2_US;  // ditto
+    LMIC.ping.freq    =  NB() ? NB_REG->ping_freq : FREQ_PING_US; // defaults for ping
+    LMIC.ping.dr      =  NB() ? NB_REG->ping_dr : DR_PING_US;     // ditto
     LMIC.ping.intvExp =  0xFF;
     if (!NB())
         initDefaultChannels_WB();
@@ -2560,6 +3181,7 @@ void LMIC_init (void) {
 void LMIC_clrTxData (void) {
     LMIC.opmode &= ~(OP_TXDATA|OP_TXRXPEND|OP_POLL);
     LMIC.pendTxLen = 0;
+    LMIC.pendTxDelayed = 0;
     if( (LMIC.opmode & (OP_JOINING|OP_SCAN)) != 0 ) // do not interfere with JOINING
         return;
     os_clearCallback(&LMIC.osjob);
@@ -2590,6 +3212,14 @@ int LMIC_setTxData2 (u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed) {
 }
 
 
+// Longest payload the next data frame has room for, after the MAC options
+// that wait to go with it
+u1_t LMIC_maxPayload (void) {
+    int len = txFrameLen() - OFF_DAT_OPTS - pendOptsLen() - 5;
+    return len > 0 ? len : 0;
+}
+
+
 // Send a payload-less message to signal device is alive
 void LMIC_sendAlive (void) {
     LMIC.opmode |= OP_POLL;
@@ -2603,6 +3233,20 @@ void LMIC_tryRejoin (void) {
     engineUpdate();
 }
 
+// Keep the receiver on RX2 between TX/RX transactions (class C), so that
+// the network can send at any time.  Downlinks come as EV_RXCOMPLETE.
+// Not with class B, which takes precedence.
+void LMIC_setClassC (bit_t enabled) {
+    if( !enabled == !(LMIC.opmode & OP_CLASSC) )
+        return;
+    if( enabled )
+        LMIC.opmode |= OP_CLASSC;
+    else
+        LMIC.opmode &= ~OP_CLASSC;
+    if( LMIC.devaddr != 0 )
+        engineUpdate();
+}
+
 //! \brief Setup given session keys
 //! and put the MAC in a state as if 
 //! a join request/accept would have negotiated just these keys.
@@ -2624,6 +3268,7 @@ void LMIC_setSession (u4_t netid, devaddr_t devaddr, xref2u1_t nwkKey, xref2u1_t
         os_copyMem(LMIC.nwkKey, nwkKey, 16);
     if( artKey != (xref2u1_t)0 )
         os_copyMem(LMIC.artKey, artKey, 16);
+    aes_expandSession();
 
     if (NB())
         initDefaultChannels_NB(0);
@@ -96,6 +96,19 @@ struct rxsched_t {
 TYPEDEF_xref2rxsched_t;  //!< \internal
 
 
+// Link quality of an uplink channel, as LMIC_chStats() reports it
+enum { MAX_CHSTATS = 72 };          // 0-63 125kHz, 64-71 500kHz
+struct chstat_t {
+    u2_t     tx;        // uplinks sent
+    u1_t     ask;       // of them, ones the network had to answer
+    u1_t     ok;        // of those, ones it answered
+    u1_t     sensed;    // LBT listens
+    u1_t     busy;      // of them, channel found busy
+    s1_t     snr;       // last RX1 downlink [dB*4]
+    s2_t     rssi;      // last RX1 downlink [dBm]
+};
+
+
 //! Parsing and tracking states of beacons.
 enum { BCN_NONE    = 0x00,   //!< No beacon received
        BCN_PARTIAL = 0x01,   //!< Only first (common) part could be decoded (info,lat,lon invalid/previous)
@@ -116,7 +129,7 @@ struct bcninfo_t {
 };
 
 // purpose of receive window - lmic_t.rxState
-enum { RADIO_RST=0, RADIO_TX=1, RADIO_RX=2, RADIO_RXON=3 };
+enum { RADIO_RST=0, RADIO_TX=1, RADIO_RX=2, RADIO_RXON=3, RADIO_CAD=4 };
 // Netid values /  lmic_t.netid
 enum { NETID_NONE=(int)~0U, NETID_MASK=(int)0xFFFFFF };
 // MAC operation modes (lmic_t.opmode).
@@ -135,6 +148,8 @@ enum { OP_NONE     = 0x0000,
        OP_NEXTCHNL = 0x0800, // find a new channel
        OP_LINKDEAD = 0x1000, // link was reported as dead
        OP_TESTMODE = 0x2000, // developer test mode
+       OP_CLASSC   = 0x4000, // listen on RX2 between TX/RX transactions
+       OP_RXC      = 0x8000, // class C listening in progress
 };
 // TX-RX transaction flags - report back to user
 enum { TXRX_ACK    = 0x80,   // confirmed UP frame was acked
@@ -143,7 +158,8 @@ enum { TXRX_ACK    = 0x80,   // confirmed UP frame was acked
        TXRX_PORT   = 0x10,   // set if a frame with a port was RXed, LMIC.frame[LMIC.dataBeg-1] => port
        TXRX_DNW1   = 0x01,   // received in 1st DN slot
        TXRX_DNW2   = 0x02,   // received in 2dn DN slot
-       TXRX_PING   = 0x04 }; // received in a scheduled RX slot
+       TXRX_PING   = 0x04,   // received in a scheduled RX slot
+       TXRX_DNC    = 0x08 }; // received while listening in class C
 // Event types for event callback
 enum _ev_t { EV_SCAN_TIMEOUT=1, EV_BEACON_FOUND,
              EV_BEACON_MISSED, EV_BEACON_TRACKED, EV_JOINING,
@@ -158,6 +174,7 @@ struct lmic_t {
     // Radio settings TX/RX (also accessed by HAL)
     ostime_t    txend;
     ostime_t    rxtime;
+    ostime_t    rxslack;   // left before rxtime once the radio was set up
     u4_t        freq;
     s2_t        rssi;
     s1_t        snr;
@@ -170,8 +187,10 @@ struct lmic_t {
 
     // Channel scheduling
     u1_t        region;
+#ifndef LMIC_REGION
     const struct nb_reg *nb_reg;
     const struct wb_reg *wb_reg;
+#endif
     band_t      bands[MAX_BANDS_EU];
     u4_t        channelFreq[MAX_CHANNELS_EU];
     u2_t        channelDrMap[MAX_CHANNELS_EU];
@@ -180,6 +199,8 @@ struct lmic_t {
     u2_t        channelMap[(72+MAX_XCHANNELS_US+15)/16];  // enabled bits
     u2_t        chRnd;        // channel randomizer
     u1_t        txChnl;          // channel for next TX
+    u1_t        lbtLeft;         // LBT round in progress, LBT_CLEAR: txChnl is clear
+    bit_t       cadBusy;         // last CAD saw a preamble
     u1_t        globalDutyRate;  // max rate: 1/2^k
     ostime_t    globalDutyAvail; // time device can send again
     
@@ -197,11 +218,17 @@ struct lmic_t {
     u1_t        pendTxPort;
     u1_t        pendTxConf;   // confirmed data
     u1_t        pendTxLen;    // +0x80 = confirmed
+    bit_t       pendTxDelayed; // left out of the frame sent, goes with the next
+    bit_t       pendTxDropped; // too long for the data rate, left out for good
     u1_t        pendTxData[MAX_LEN_PAYLOAD];
 
     u2_t        devNonce;     // last generated nonce
     u1_t        nwkKey[16];   // network session key
     u1_t        artKey[16];   // application router session key
+#if !defined(CFG_hw_aes)
+    u4_t        nwkSched[AES_SCHED]; // nwkKey expanded by os_aesExpand()
+    u4_t        artSched[AES_SCHED]; // artKey expanded by os_aesExpand()
+#endif
     devaddr_t   devaddr;
     u4_t        seqnoDn;      // device level down stream seqno
     u4_t        seqnoUp;
@@ -263,6 +290,11 @@ void  LMIC_disableChannel (u1_t channel);
 
 void  LMIC_setDrTxpow   (dr_t dr, s1_t txpow);  // set default/start DR/txpow
 void  LMIC_setAdrMode   (bit_t enabled);        // set ADR mode (if mobile turn off)
+s2_t  LMIC_upSensitivity(dr_t dr);              // dBm, 0 if dr not allowed
+const chstat_t* LMIC_chStats (u1_t chnl);       // NULL if no such channel
+ostime_t LMIC_nextTxTime (void);                // earliest start of next uplink
+ostime_t LMIC_airtimeLeft(void);                // duty cycle airtime in the hour
+u2_t  LMIC_chWeight     (u1_t chnl);            // odds of picking it, 256=full
 bit_t LMIC_startJoining (void);
 
 void  LMIC_shutdown     (void);
@@ -271,6 +303,7 @@ int   LMIC_reset        (u1_t region);
 void  LMIC_clrTxData    (void);
 void  LMIC_setTxData    (void);
 int   LMIC_setTxData2   (u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed);
+u1_t  LMIC_maxPayload   (void);                // room for the next uplink's payload
 void  LMIC_sendAlive    (void);
 
 bit_t LMIC_enableTracking  (u1_t tryBcnInfo);
@@ -279,6 +312,7 @@ void  LMIC_disableTracking (void);
 void  LMIC_stopPingable  (void);
 void  LMIC_setPingable   (u1_t intvExp);
 void  LMIC_tryRejoin     (void);
+void  LMIC_setClassC     (bit_t enabled);
 
 void LMIC_setSession (u4_t netid, devaddr_t devaddr, xref2u1_t nwkKey, xref2u1_t artKey);
 void LMIC_setLinkCheckMode (bit_t enabled);
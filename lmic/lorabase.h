@@ -42,6 +42,13 @@
 #define REGION_FULL     0x10
 #define REGION_WIDEBAND 0x08
 #define REGION_FLAGS    0x18
+// Names for LMIC_REGION, which builds the MAC for one region only
+#define REGION_EU868    REGION_EU
+#define REGION_AS923    REGION_AS1
+#define REGION_KR920    REGION_KR
+#define REGION_IN865    REGION_IN
+#define REGION_US915    REGION_US
+#define REGION_AU915    REGION_AU
 
 enum _cr_t { CR_4_5=0, CR_4_6, CR_4_7, CR_4_8 };
 enum _sf_t { FSK=0, SF7, SF8, SF9, SF10, SF11, SF12, SFrfu };
@@ -60,7 +67,7 @@ enum { DR_PAGE_US915 = 0x10 };
 
 // Global maximum frame length
 enum { STD_PREAMBLE_LEN  =  8 };
-enum { MAX_LEN_FRAME     = 64 };
+enum { MAX_LEN_FRAME     = 255 };
 enum { LEN_DEVNONCE      =  2 };
 enum { LEN_ARTNONCE      =  3 };
 enum { LEN_NETID         =  3 };
@@ -504,8 +511,9 @@ inline int sameSfBw(rps_t r1, rps_t r2) { return ((r1^r2)&0x1F) == 0; }
 
 // Convert between dBm values and power codes (MCMD_LADR_XdBm)
 s1_t pow2dBm (u1_t mcmd_ladr_p1);
-// Calculate airtime
+// Calculate airtime, from a table for uplinks
 ostime_t calcAirTime (rps_t rps, u1_t plen);
+ostime_t calcAirTimeFormula (rps_t rps, u1_t plen);
 // Sensitivity at given SF/BW
 int getSensitivity (rps_t rps);
 
@@ -37,7 +37,8 @@
 
 // RUNTIME STATE
 PRIVILEGED_DATA static struct {
-    osjob_t* scheduledjobs;
+    osjob_t* timedjobs[OS_MAX_TIMED_JOBS]; // binary min-heap on latest run time
+    u1_t     ntimedjobs;
     osjob_t* runnablejobs;
 } OS;
 
@@ -59,10 +60,75 @@ static int unlinkjob (osjob_t** pnext, osjob_t* job) {
     return 0;
 }
 
+// difference of two times, computed unsigned so that it wraps instead of
+// letting the compiler turn (a - b < 0) into (a < b)
+#define TIME_DIFF(a,b) ((s4_t)((u4_t)(a) - (u4_t)(b)))
+// slack granted to timed jobs, the build may take it away
+#ifndef OS_JOB_SLACK
+#define OS_JOB_SLACK(slack) (slack)
+#endif
+// latest time a timed job may run
+#define JOB_LATEST(j) ((ostime_t)((u4_t)(j)->deadline + (u4_t)(j)->slack))
+// ordering of timed jobs (cmp diff, not abs!)
+#define JOB_BEFORE(a,b) (TIME_DIFF(JOB_LATEST(a), JOB_LATEST(b)) < 0)
+
+// place job at heap slot i
+static void heapset (u1_t i, osjob_t* job) {
+    OS.timedjobs[i] = job;
+    job->heapidx = i + 1;
+}
+
+// move job at slot i towards the root while it is due before its parent
+static u1_t heapup (u1_t i) {
+    osjob_t* job = OS.timedjobs[i];
+    while(i > 0) {
+        u1_t p = (i - 1) / 2;
+        if(!JOB_BEFORE(job, OS.timedjobs[p]))
+            break;
+        heapset(i, OS.timedjobs[p]);
+        i = p;
+    }
+    heapset(i, job);
+    return i;
+}
+
+// move job at slot i towards the leaves while a child is due before it
+static void heapdown (u1_t i) {
+    osjob_t* job = OS.timedjobs[i];
+    u1_t n = OS.ntimedjobs;
+    while(2 * i + 1 < n) {
+        u1_t c = 2 * i + 1;
+        if(c + 1 < n && JOB_BEFORE(OS.timedjobs[c+1], OS.timedjobs[c]))
+            c++;
+        if(!JOB_BEFORE(OS.timedjobs[c], job))
+            break;
+        heapset(i, OS.timedjobs[c]);
+        i = c;
+    }
+    heapset(i, job);
+}
+
+// remove job from timer heap, return if removed
+static int heapremove (osjob_t* job) {
+    u1_t i = job->heapidx - 1;
+    // heapidx is not trusted: jobs may live in uninitialised memory
+    if(job->heapidx == 0 || i >= OS.ntimedjobs || OS.timedjobs[i] != job)
+        return 0;
+    job->heapidx = 0;
+    if(i != --OS.ntimedjobs) {
+        heapset(i, OS.timedjobs[OS.ntimedjobs]);
+        if(heapup(i) == i)
+            heapdown(i);
+    }
+    OS.timedjobs[OS.ntimedjobs] = NULL;
+    return 1;
+}
+
 // clear scheduled job
 void os_clearCallback (osjob_t* job) {
     hal_disableIRQs();
-    (void)(unlinkjob(&OS.scheduledjobs, job) || unlinkjob(&OS.runnablejobs, job));
+    if( !heapremove(job) )
+        unlinkjob(&OS.runnablejobs, job);
     hal_enableIRQs();
 }
 
@@ -70,8 +136,9 @@ void os_clearCallback (osjob_t* job) {
 void os_setCallback (osjob_t* job, osjobcb_t cb) {
     osjob_t** pnext;
     hal_disableIRQs();
-    // remove if job was already queued
-    unlinkjob(&OS.runnablejobs, job);
+    // remove if job was already queued, or timed
+    if( !heapremove(job) )
+        unlinkjob(&OS.runnablejobs, job);
     // fill-in job
     job->func = cb;
     job->next = NULL;
@@ -81,28 +148,28 @@ void os_setCallback (osjob_t* job, osjobcb_t cb) {
     hal_enableIRQs();
 }
 
-// schedule timed job
-void os_setTimedCallback (osjob_t* job, ostime_t time, osjobcb_t cb) {
-    osjob_t** pnext;
+// schedule timed job to run between time and time+slack
+void os_setTimedCallbackSlack (osjob_t* job, ostime_t time, ostime_t slack, osjobcb_t cb) {
     hal_disableIRQs();
     // remove if job was already queued
-    unlinkjob(&OS.scheduledjobs, job);
+    heapremove(job);
+    ASSERT(OS.ntimedjobs < OS_MAX_TIMED_JOBS);
     // fill-in job
     job->deadline = time;
+    job->slack = OS_JOB_SLACK(slack);
     job->func = cb;
     job->next = NULL;
     // insert into schedule
-    for(pnext=&OS.scheduledjobs; *pnext; pnext=&((*pnext)->next)) {
-        if((*pnext)->deadline - time > 0) { // (cmp diff, not abs!)
-            // enqueue before next element and stop
-            job->next = *pnext;
-            break;
-        }
-    }
-    *pnext = job;
+    heapset(OS.ntimedjobs, job);
+    heapup(OS.ntimedjobs++);
     hal_enableIRQs();
 }
 
+// schedule timed job
+void os_setTimedCallback (osjob_t* job, ostime_t time, osjobcb_t cb) {
+    os_setTimedCallbackSlack(job, time, 0, cb);
+}
+
 // execute jobs from timer and from run queue
 void os_runloop () {
     while(1) {
@@ -112,10 +179,16 @@ void os_runloop () {
         if(OS.runnablejobs) {
             j = OS.runnablejobs;
             OS.runnablejobs = j->next;
-        } else if(OS.scheduledjobs) {
-            if (hal_checkTimer(OS.scheduledjobs->deadline)) { // check for expired timed jobs
-                j = OS.scheduledjobs;
-                OS.scheduledjobs = j->next;
+        } else if(OS.ntimedjobs) {
+            // Sleep until the first job must run at the latest. Once
+            // awake, run it as soon as its deadline has passed, so that
+            // jobs with overlapping windows share a single wake-up.
+            j = OS.timedjobs[0];
+            if (hal_checkTimer(JOB_LATEST(j)) ||
+                TIME_DIFF(os_getTime(), j->deadline) >= 0) { // check for expired timed jobs
+                heapremove(j);
+            } else {
+                j = NULL;
             }
         } else { // nothing pending
             hal_setShortSleep();
@@ -68,6 +68,7 @@ typedef      struct band_t band_t;
 typedef   struct chnldef_t chnldef_t;
 typedef   struct rxsched_t rxsched_t;
 typedef   struct bcninfo_t bcninfo_t;
+typedef    struct chstat_t chstat_t;
 typedef        const u1_t* xref2cu1_t;
 typedef              u1_t* xref2u1_t;
 #define TYPEDEF_xref2rps_t     typedef         rps_t* xref2rps_t
@@ -94,6 +95,11 @@ u1_t os_getRndU1(void);
 
 typedef s4_t  ostime_t;
 
+// Maximum number of simultaneously pending timed jobs
+#ifndef OS_MAX_TIMED_JOBS
+#define OS_MAX_TIMED_JOBS 32
+#endif
+
 void radio_init (void);
 void radio_irq_handler (ostime_t now);
 s2_t radio_rssi (void);
@@ -139,6 +145,8 @@ struct osjob_t {
     struct osjob_t* next;
     ostime_t deadline;
     osjobcb_t  func;
+    ostime_t slack;  // job may run up to this many ticks after deadline
+    u1_t heapidx;   // position in timer heap plus one, 0 if not scheduled
 };
 TYPEDEF_xref2osjob_t;
 
@@ -154,12 +162,18 @@ void os_getArtEui (xref2u1_t buf);
 #ifndef os_getDevEui
 void os_getDevEui (xref2u1_t buf);
 #endif
+#ifndef os_reserveSeqnoUp
+bit_t os_reserveSeqnoUp (u4_t seqno);  // 0: frame must not use seqno yet
+#endif
 #ifndef os_setCallback
 void os_setCallback (xref2osjob_t job, osjobcb_t cb);
 #endif
 #ifndef os_setTimedCallback
 void os_setTimedCallback (xref2osjob_t job, ostime_t time, osjobcb_t cb);
 #endif
+#ifndef os_setTimedCallbackSlack
+void os_setTimedCallbackSlack (xref2osjob_t job, ostime_t time, ostime_t slack, osjobcb_t cb);
+#endif
 #ifndef os_clearCallback
 void os_clearCallback (xref2osjob_t job);
 #endif
@@ -230,6 +244,15 @@ extern xref2u1_t AESaux;
 #ifndef os_aes
 u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len);
 #endif
+// 44 round key words of an expanded 128-bit key
+#define AES_SCHED     44
+void os_aesExpand (u4_t* sched, xref2cu1_t key);
+u4_t os_aesSched (u1_t mode, const u4_t* sched, xref2u1_t buf, u2_t len);
+u4_t os_aesSeal (const u4_t* ctrkeys, const u4_t* mickeys, xref2u1_t frame, u2_t off, u2_t len);
+#ifdef CFG_hw_aes
+// os_aes() runs on the crypto engine (hw/aes.c) and falls back to this
+u4_t os_aes_sw (u1_t mode, xref2u1_t buf, u2_t len);
+#endif
 
 void print(char *);
 
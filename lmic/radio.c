@@ -240,6 +240,7 @@
 // DIO function mappings                D0D1D2D3
 #define MAP_DIO0_LORA_RXDONE   0x00  // 00------
 #define MAP_DIO0_LORA_TXDONE   0x40  // 01------
+#define MAP_DIO0_LORA_CADDONE  0x80  // 10------
 #define MAP_DIO1_LORA_RXTOUT   0x00  // --00----
 #define MAP_DIO1_LORA_NOP      0x30  // --11----
 #define MAP_DIO2_LORA_NOP      0xC0  // ----11--
@@ -271,7 +272,66 @@
 #endif
 
 
+// Write-through copy of the configuration registers.  Reads are served
+// from it, and writes of the value a register already holds are skipped.
+// Registers 0x0D-0x3F are paged by the modem, so the LoRa ones are only
+// shadowed in LoRa mode and forgotten when the modem changes.  The radio
+// leaves TX, RX and CAD by itself, so the mode bits of RegOpMode are only
+// trusted in sleep and standby; its LoRa bit always is.
+enum { SH_OPMODE, SH_FRFMSB, SH_FRFMID, SH_FRFLSB, SH_PACONFIG, SH_PARAMP,
+       SH_LNA, SH_DIOMAPPING1, SH_PADAC,
+       SH_MC1, SH_MC2, SH_MC3, SH_INVERTIQ, SH_SYNCWORD };
+#define SH_LORAPAGE ((1<<SH_MC1)|(1<<SH_MC2)|(1<<SH_MC3)|(1<<SH_INVERTIQ)|(1<<SH_SYNCWORD))
+
+PRIVILEGED_DATA static struct {
+    u1_t val[SH_SYNCWORD+1];
+    u2_t known;         // bit set: val[] holds what the radio holds
+} shadow;
+
+static int shadowIdx (u1_t addr) {
+    switch (addr) {
+    case RegOpMode:      return SH_OPMODE;
+    case RegFrfMsb:      return SH_FRFMSB;
+    case RegFrfMid:      return SH_FRFMID;
+    case RegFrfLsb:      return SH_FRFLSB;
+    case RegPaConfig:    return SH_PACONFIG;
+    case RegPaRamp:      return SH_PARAMP;
+    case RegLna:         return SH_LNA;
+    case RegDioMapping1: return SH_DIOMAPPING1;
+    case RegPaDac:       return SH_PADAC;
+    }
+    if( (shadow.val[SH_OPMODE] & OPMODE_LORA) == 0 )
+        return -1;
+    switch (addr) {
+    case LORARegModemConfig1: return SH_MC1;
+    case LORARegModemConfig2: return SH_MC2;
+    case LORARegModemConfig3: return SH_MC3;
+    case LORARegInvertIQ:     return SH_INVERTIQ;
+    case LORARegSyncWord:     return SH_SYNCWORD;
+    }
+    return -1;
+}
+
+// record a value the radio holds, return 0 if it held it already
+static bit_t shadowSet (u1_t addr, u1_t data) {
+    int i = shadowIdx(addr);
+
+    if( i < 0 )
+        return 1;
+    if( (shadow.known & (1<<i)) && shadow.val[i] == data )
+        return 0;
+    if( i == SH_OPMODE && ((shadow.val[i] ^ data) & OPMODE_LORA) )
+        shadow.known &= ~SH_LORAPAGE;
+    shadow.val[i] = data;
+    shadow.known |= 1<<i;
+    if( i == SH_OPMODE && (data & OPMODE_MASK) > OPMODE_STANDBY )
+        shadow.known &= ~(1<<i);
+    return 1;
+}
+
 static void writeReg (u1_t addr, u1_t data ) {
+    if( !shadowSet(addr, data) )
+        return;
     hal_pin_nss(0);
     hal_spi(addr | 0x80);
     hal_spi(data);
@@ -279,33 +339,45 @@ static void writeReg (u1_t addr, u1_t data ) {
 }
 
 static u1_t readReg (u1_t addr) {
+    int i = shadowIdx(addr);
+    if( i >= 0 && (shadow.known & (1<<i)) )
+        return shadow.val[i];
     hal_pin_nss(0);
     hal_spi(addr & 0x7F);
     u1_t val = hal_spi(0x00);
     hal_pin_nss(1);
+    shadowSet(addr, val);
     return val;
 }
 
-static void writeBuf (u1_t addr, xref2u1_t buf, u1_t len) {
+// burst access: FIFO, or consecutive registers
+static void writeBuf (u1_t addr, xref2cu1_t buf, u1_t len) {
     hal_pin_nss(0);
     hal_spi(addr | 0x80);
-    for (u1_t i=0; i<len; i++) {
-        hal_spi(buf[i]);
-    }
+    hal_spi_write(buf, len);
     hal_pin_nss(1);
 }
 
 static void readBuf (u1_t addr, xref2u1_t buf, u1_t len) {
     hal_pin_nss(0);
     hal_spi(addr & 0x7F);
+    hal_spi_read(buf, len);
+    hal_pin_nss(1);
+}
+
+// burst write of consecutive registers, unless they all hold buf already
+static void writeRegs (u1_t addr, xref2cu1_t buf, u1_t len) {
+    bit_t changed = 0;
     for (u1_t i=0; i<len; i++) {
-        buf[i] = hal_spi(0x00);
+        changed |= shadowSet(addr+i, buf[i]);
     }
-    hal_pin_nss(1);
+    if( changed )
+        writeBuf(addr, buf, len);
 }
 
 static void opmode (u1_t mode) {
-    writeReg(RegOpMode, (readReg(RegOpMode) & ~OPMODE_MASK) | mode);
+    // the radio changes only the mode bits by itself
+    writeReg(RegOpMode, (shadow.val[SH_OPMODE] & ~OPMODE_MASK) | mode);
 }
 
 static void opmodeLora() {
@@ -407,9 +479,8 @@ static void configLoraModem () {
 static void configChannel () {
     // set frequency: FQ = (FRF * 32 Mhz) / (2 ^ 19)
     u8_t frf = ((u8_t)LMIC.freq << 19) / 32000000;
-    writeReg(RegFrfMsb, (u1_t)(frf>>16));
-    writeReg(RegFrfMid, (u1_t)(frf>> 8));
-    writeReg(RegFrfLsb, (u1_t)(frf>> 0));
+    u1_t buf[3] = { (u1_t)(frf>>16), (u1_t)(frf>>8), (u1_t)frf };
+    writeRegs(RegFrfMsb, buf, 3); // RegFrfMsb, RegFrfMid, RegFrfLsb
 }
 
 
@@ -510,8 +581,8 @@ static void txlora () {
     writeReg(LORARegIrqFlagsMask, ~IRQ_LORA_TXDONE_MASK);
 
     // initialize the payload size and address pointers    
-    writeReg(LORARegFifoTxBaseAddr, 0x00);
-    writeReg(LORARegFifoAddrPtr, 0x00);
+    static const u1_t fifoaddr[2] = { 0x00, 0x00 };
+    writeRegs(LORARegFifoAddrPtr, fifoaddr, 2); // LORARegFifoAddrPtr, LORARegFifoTxBaseAddr
     writeReg(LORARegPayloadLength, LMIC.dataLen);
        
     // download buffer to the radio FIFO
@@ -527,6 +598,7 @@ static void txlora () {
 // start transmitter (buf=LMIC.frame, len=LMIC.dataLen)
 static void starttx () {
     ASSERT( (readReg(RegOpMode) & OPMODE_MASK) == OPMODE_SLEEP );
+    hal_countTx();
     if(getSf(LMIC.rps) == FSK) { // FSK modem
         txfsk();
     } else { // LoRa modem
@@ -564,7 +636,7 @@ static void rxlora (u1_t rxmode) {
     // set LNA gain
     writeReg(RegLna, LNA_RX_GAIN); 
     // set max payload size
-    writeReg(LORARegPayloadMaxLength, 64);
+    writeReg(LORARegPayloadMaxLength, MAX_LEN_FRAME);
     // use inverted I/Q signal (prevent mote-to-mote communication)
 
     // XXX: use flag to switch on/off inversion
@@ -591,6 +663,7 @@ static void rxlora (u1_t rxmode) {
 
     // now instruct the radio to receive
     if (rxmode == RXMODE_SINGLE) { // single rx
+        LMIC.rxslack = LMIC.rxtime - os_getTime();
         hal_waitUntil(LMIC.rxtime); // busy wait until exact rx time
         opmode(OPMODE_RX_SINGLE);
     } else { // continous rx (scan or rssi)
@@ -598,6 +671,29 @@ static void rxlora (u1_t rxmode) {
     }
 }
 
+// start channel activity detection (freq=LMIC.freq, result=LMIC.cadBusy)
+static void cadlora () {
+    // select LoRa modem (from sleep mode)
+    opmodeLora();
+    ASSERT((readReg(RegOpMode) & OPMODE_LORA) != 0);
+    // enter standby mode (warm up)
+    opmode(OPMODE_STANDBY);
+    // look for preambles at the TX settings
+    configLoraModem();
+    configChannel();
+    writeReg(RegLna, LNA_RX_GAIN);
+    // configure DIO mapping DIO0=CadDone DIO1=NOP DIO2=NOP
+    writeReg(RegDioMapping1, MAP_DIO0_LORA_CADDONE|MAP_DIO1_LORA_NOP|MAP_DIO2_LORA_NOP);
+    // clear all radio IRQ flags
+    writeReg(LORARegIrqFlags, 0xFF);
+    // mask all IRQs but CadDone and CadDetected
+    writeReg(LORARegIrqFlagsMask, ~(IRQ_LORA_CDDONE_MASK|IRQ_LORA_CDDETD_MASK));
+    // enable antenna switch for RX
+    hal_pin_rxtx(0);
+    // the radio goes back to standby after about two symbols
+    opmode(OPMODE_CAD);
+}
+
 static void rxfsk (u1_t rxmode) {
     // only single rx (no continuous scanning, no noise sampling)
     ASSERT( rxmode == RXMODE_SINGLE );
@@ -645,6 +741,7 @@ static void rxfsk (u1_t rxmode) {
     hal_pin_rxtx(0);
     
     // now instruct the radio to receive
+    LMIC.rxslack = LMIC.rxtime - os_getTime();
     hal_waitUntil(LMIC.rxtime); // busy wait until exact rx time
     opmode(OPMODE_RX); // no single rx mode available in FSK
 }
@@ -677,6 +774,8 @@ void radio_init () {
     hal_pin_rst(0); // drive RST pin low
 #endif
     hal_waitUntil(os_getTime()+ms2osticks(5)); // wait 5ms
+    os_clearMem(&shadow, sizeof(shadow));
+    readReg(RegOpMode); // load the shadow
 
     opmode(OPMODE_SLEEP);
 
@@ -723,7 +822,7 @@ void radio_irq_handler (ostime_t now) {
     opmode(OPMODE_TX);
     return;
 #endif
-    if( (readReg(RegOpMode) & OPMODE_LORA) != 0) { // LORA modem
+    if( (shadow.val[SH_OPMODE] & OPMODE_LORA) != 0) { // LORA modem
         u1_t flags = readReg(LORARegIrqFlags);
         if( flags & IRQ_LORA_TXDONE_MASK ) {
             // save exact tx time
@@ -742,16 +841,20 @@ void radio_irq_handler (ostime_t now) {
             // now read the FIFO
             readBuf(RegFifo, LMIC.frame, LMIC.dataLen);
             // read rx quality parameters
-            LMIC.snr  = readReg(LORARegPktSnrValue); // SNR [dB] * 4
-            LMIC.rssi = (s2_t)readReg(LORARegPktRssiValue) - 164; // RSSI [dBm] (-164...+91)
+            u1_t pkt[2];
+            readBuf(LORARegPktSnrValue, pkt, 2); // LORARegPktSnrValue, LORARegPktRssiValue
+            LMIC.snr  = pkt[0]; // SNR [dB] * 4
+            LMIC.rssi = (s2_t)pkt[1] - 164; // RSSI [dBm] (-164...+91)
         } else if( flags & IRQ_LORA_RXTOUT_MASK ) {
             // indicate timeout
             LMIC.dataLen = 0;
+        } else if( flags & IRQ_LORA_CDDONE_MASK ) {
+            // a preamble was seen during the CAD
+            LMIC.cadBusy = (flags & IRQ_LORA_CDDETD_MASK) != 0;
         }
-        // mask all radio IRQs
-        writeReg(LORARegIrqFlagsMask, 0xFF);
-        // clear radio IRQ flags
-        writeReg(LORARegIrqFlags, 0xFF);
+        // mask all radio IRQs and clear radio IRQ flags
+        static const u1_t irqoff[2] = { 0xFF, 0xFF };
+        writeRegs(LORARegIrqFlagsMask, irqoff, 2); // LORARegIrqFlagsMask, LORARegIrqFlags
     } else { // FSK modem
         u1_t flags1 = readReg(FSKRegIrqFlags1);
         u1_t flags2 = readReg(FSKRegIrqFlags2);
@@ -803,6 +906,11 @@ void os_radio (u1_t mode) {
         // start scanning for beacon now
         startrx(RXMODE_SCAN); // buf=LMIC.frame
         break;
+
+      case RADIO_CAD:
+        // sense the channel for LoRa preambles (freq=LMIC.freq)
+        cadlora();
+        break;
     }
     hal_enableIRQs();
 }
@@ -0,0 +1,151 @@
+/*
+ * ADR on the device.  The network server sees every uplink but answers
+ * few of them, and until it asks for a change the node stays at the
+ * data rate and TX power it has.  With PARAM_DEVICE_ADR set, the node
+ * also picks them itself.  Every downlink heard in RX1, on the channel
+ * of the uplink, gives the path loss to the gateway; the last
+ * ADR_HISTORY of them its mean and spread.  An uplink is taken to get
+ * through if it does at a loss of ADR_Z standard deviations above the
+ * mean, i.e. 99 times out of 100, with ADR_MARGIN to spare.
+ *
+ * Every data rate step halves the airtime, while a TX power step of
+ * 3 dB saves a fifth of the TX current at best.  So the cheapest is the
+ * fastest data rate that gets through at full power, and then the lowest
+ * power that still does at that data rate.
+ *
+ * The network's ADR comes first: after a LinkADRReq the node keeps what
+ * it was given for ADR_HOLD uplinks, learning the path loss meanwhile.
+ *
+ * The node picks them in EU868 only.  The powers below are its, while
+ * gateways elsewhere send at up to 30 dBm, which would make the loss
+ * look that much higher, and only there does the MAC send at the power
+ * it is given rather than at the most the region allows.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lmic/lmic.h"
+#include "lora/adr.h"
+#include "lora/param.h"
+
+#define DEBUG
+
+#define ADR_HISTORY	8
+/* RX1 power of the gateway, the most EU868 sub-bands allow */
+#define ADR_GW_POWER	14	/* dBm */
+/* For the gateway and its antenna not being the node's */
+#define ADR_MARGIN	3	/* dB */
+#define ADR_Z		233	/* Standard deviations * 100, for 99% */
+/* A few samples may agree by chance */
+#define ADR_MIN_SIGMA	(1 * 4)	/* dB * 4 */
+#define ADR_MAX_POW	14	/* dBm */
+#define ADR_MIN_POW	2	/* dBm */
+#define ADR_POW_STEP	3	/* dB */
+/* Uplinks to keep the data rate and power the network set */
+#define ADR_HOLD	ADR_HISTORY
+
+PRIVILEGED_DATA static int16_t	loss[ADR_HISTORY];	/* dB * 4 */
+PRIVILEGED_DATA static uint8_t	nloss;
+PRIVILEGED_DATA static uint8_t	held;		/* The network set them */
+PRIVILEGED_DATA static uint32_t	held_at;	/* Uplink counter then */
+
+static int
+isqrt(uint32_t x)
+{
+	uint32_t	r = 0, b = 1UL << 30;
+
+	while (b > x)
+		b >>= 2;
+	for (; b != 0; b >>= 2) {
+		if (x >= r + b) {
+			x -= r + b;
+			r = (r >> 1) + b;
+		} else {
+			r >>= 1;
+		}
+	}
+	return r;
+}
+
+/* Path loss in dB that uplinks should be ready for */
+static int
+adr_loss(void)
+{
+	int32_t	sum = 0, var = 0;
+	int	i, n, mean, sigma;
+
+	n = nloss < ADR_HISTORY ? nloss : ADR_HISTORY;
+	for (i = 0; i < n; i++)
+		sum += loss[i];
+	mean = sum / n;
+	for (i = 0; i < n; i++)
+		var += (loss[i] - mean) * (loss[i] - mean);
+	sigma = isqrt(var / n);
+	if (sigma < ADR_MIN_SIGMA)
+		sigma = ADR_MIN_SIGMA;
+	return (mean + sigma * ADR_Z / 100 + 3) / 4;
+}
+
+/*
+ * Learn from the downlink just received, if it came in RX1, and set the
+ * data rate and TX power.
+ */
+void
+adr_rx(void)
+{
+	uint8_t	on = 0;
+	int	l, dr, best, pow;
+
+	if ((LMIC.txrxFlags & TXRX_DNW1) == 0)
+		return;
+	/* Below the noise the packet RSSI is that of the noise */
+	loss[nloss++ % ADR_HISTORY] = 4 * (ADR_GW_POWER - LMIC.rssi) -
+	    (LMIC.snr < 0 ? LMIC.snr : 0);
+	if (nloss == 2 * ADR_HISTORY)
+		nloss = ADR_HISTORY;
+	param_get(PARAM_DEVICE_ADR, &on, sizeof(on));
+	if (on != 1 || !LMIC.adrEnabled ||
+	    (LMIC.region & ~REGION_FULL) != REGION_EU)
+		return;
+	/* A LinkADRReq just came with this downlink, its answer pending */
+	if (LMIC.ladrAns) {
+		held = 1;
+		held_at = LMIC.seqnoUp;
+	}
+	if (held && LMIC.seqnoUp - held_at < ADR_HOLD)
+		return;
+	held = 0;
+
+	l = adr_loss() + ADR_MARGIN;
+	/*
+	 * Only speed up: the node cannot tell if its uplinks get through,
+	 * so slowing down is left to the backoff of the MAC when the network
+	 * does not answer them.  The region and PARAM_MIN_SF limit the data
+	 * rates to a range.
+	 */
+	best = LMIC.datarate;
+	for (dr = best + 1; dr < 16; dr++) {
+		if (LMIC_upSensitivity(dr) != 0 &&
+		    ADR_MAX_POW - l >= LMIC_upSensitivity(dr))
+			best = dr;
+	}
+	for (pow = ADR_MIN_POW; pow < ADR_MAX_POW &&
+	    pow - l < LMIC_upSensitivity(best); pow += ADR_POW_STEP)
+		;
+	if (best == LMIC.datarate && pow == LMIC.adrTxPow)
+		return;
+#ifdef DEBUG
+	printf("adr: loss %d dB, dr %d, %d dBm\r\n", l - ADR_MARGIN, best,
+	    pow);
+#endif
+	LMIC_setDrTxpow(best, pow);
+}
+
+/* Forget the path loss, after the link was lost */
+void
+adr_reset(void)
+{
+	nloss = 0;
+	held = 0;
+}
@@ -0,0 +1,7 @@
+#ifndef __ADR_H__
+#define __ADR_H__
+
+void	adr_rx(void);
+void	adr_reset(void);
+
+#endif /* __ADR_H__ */
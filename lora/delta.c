@@ -0,0 +1,172 @@
+/*
+ * Delta coding of a series of integer samples, as sent in
+ * INFO_SENSOR_DELTAS.  The first sample goes as it is, the others as
+ * their differences from the one before, or as the differences of those
+ * (delta-of-delta), whichever takes fewer bits.  The differences are
+ * taken modulo the width of a sample, so the coding holds for signed
+ * and unsigned samples alike.  They are shifted right by the trailing
+ * zero bits they all have, zig-zag coded so that small negative ones
+ * are small as well, and packed at the width of the largest, least
+ * significant bit first.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lora/delta.h"
+
+#define DELTA_HDR_LEN(len)	(DELTA_FIRST + (len) + DELTA_BITS)
+
+struct delta_plan {
+	int	n;		/* Samples coded */
+	int	len;		/* Bytes they take */
+	uint8_t	shift;
+	uint8_t	width;
+};
+
+static uint32_t
+sample(const uint8_t *p, uint8_t fmt)
+{
+	uint32_t	v = 0;
+	int		i, len = fmt & DELTA_LEN_MASK;
+
+	for (i = 0; i < len; i++)
+		v |= (uint32_t)p[fmt & DELTA_LE ? i : len - 1 - i] << (8 * i);
+	return v;
+}
+
+/* The low len bytes of v, sign extended */
+static int32_t
+sext(uint32_t v, int len)
+{
+	int	sh = 32 - 8 * len;
+
+	return (int32_t)(v << sh) >> sh;
+}
+
+/* The value coded for sample i, given the delta before it in *d */
+static int32_t
+value(const uint8_t *s, int i, uint8_t fmt, int32_t *d)
+{
+	int	len = fmt & DELTA_LEN_MASK;
+	int32_t	dn, x;
+
+	dn = sext(sample(s + i * len, fmt) - sample(s + (i - 1) * len, fmt),
+	    len);
+	x = fmt & DELTA_DOD ? sext((uint32_t)dn - (uint32_t)*d, len) : dn;
+	*d = dn;
+	return x;
+}
+
+static uint32_t
+zigzag(int32_t x)
+{
+	return ((uint32_t)x << 1) ^ (uint32_t)(x >> 31);
+}
+
+static uint8_t
+bits(uint32_t v)
+{
+	uint8_t	n = 0;
+
+	for (; v != 0; v >>= 1)
+		n++;
+	return n;
+}
+
+/* The most of the n samples that fit in room bytes when coded in fmt */
+static void
+plan(struct delta_plan *p, const uint8_t *s, int n, uint8_t fmt, int room)
+{
+	uint32_t	or = 0, zmax = 0, z;
+	int32_t		d = 0, x;
+	uint8_t		shift, width;
+	int		i, len;
+
+	p->n = 0;
+	p->len = 0;
+	p->shift = p->width = 0;
+	if (n < 1 || DELTA_HDR_LEN(fmt & DELTA_LEN_MASK) > room)
+		return;
+	p->n = 1;
+	p->len = DELTA_HDR_LEN(fmt & DELTA_LEN_MASK);
+	for (i = 1; i < n; i++) {
+		x = value(s, i, fmt, &d);
+		or |= (uint32_t)x;
+		if ((z = zigzag(x)) > zmax)
+			zmax = z;
+		for (shift = 0; or != 0 && !(or >> shift & 1); shift++)
+			;
+		width = bits(zmax >> shift);
+		len = DELTA_HDR_LEN(fmt & DELTA_LEN_MASK) + (i * width + 7) / 8;
+		if (len > room)
+			break;
+		p->n = i + 1;
+		p->len = len;
+		p->shift = shift;
+		p->width = width;
+	}
+}
+
+/* Pick the mode that fits the most samples, then the fewest bytes */
+static uint8_t
+plan_best(struct delta_plan *p, const uint8_t *s, int n, uint8_t fmt,
+    int room)
+{
+	struct delta_plan	dod;
+
+	fmt &= ~DELTA_DOD;
+	plan(p, s, n, fmt, room);
+	plan(&dod, s, n, fmt | DELTA_DOD, room);
+	if (dod.n > p->n || (dod.n == p->n && dod.len < p->len)) {
+		*p = dod;
+		fmt |= DELTA_DOD;
+	}
+	return fmt;
+}
+
+/* Bytes that all n samples at s take, coded */
+int
+delta_len(const uint8_t *s, int n, uint8_t fmt)
+{
+	struct delta_plan	p;
+
+	plan_best(&p, s, n, fmt, INT16_MAX);
+	return p.len;
+}
+
+/*
+ * Code as many of the n samples at s as fit in room bytes into dst.
+ * fmt gives the length and byte order of a sample, and gets the mode.
+ * Return the length of the coding, 0 if not even the first sample fits.
+ */
+int
+delta_encode(uint8_t *dst, int room, const uint8_t *s, int n, uint8_t *fmt)
+{
+	struct delta_plan	 p;
+	uint8_t			*b;
+	uint32_t		 z;
+	int32_t			 d = 0;
+	int			 i, len, pos = 0;
+
+	*fmt = plan_best(&p, s, n, *fmt, room);
+	if (p.n == 0)
+		return 0;
+	len = *fmt & DELTA_LEN_MASK;
+	dst[DELTA_COUNT] = p.n;
+	memcpy(dst + DELTA_FIRST, s, len);
+	b = dst + DELTA_FIRST + len;
+	b[DELTA_SHIFT] = p.shift;
+	b[DELTA_WIDTH] = p.width;
+	b += DELTA_BITS;
+	memset(b, 0, p.len - DELTA_HDR_LEN(len));
+	for (i = 1; i < p.n; i++) {
+		z = zigzag(value(s, i, *fmt, &d) >> p.shift);
+		for (; z != 0; z >>= 1, pos++) {
+			if (z & 1)
+				b[pos / 8] |= 1 << (pos % 8);
+		}
+		pos = i * p.width;
+	}
+	return p.len;
+}
@@ -0,0 +1,21 @@
+#ifndef __DELTA_H__
+#define __DELTA_H__
+
+/* Format of the samples, as in INFO_SENSOR_DELTAS */
+#define DELTA_LEN_MASK	0x07	/* Bytes per sample, 1-4 */
+#define DELTA_LE	0x08	/* Little-endian, else big-endian */
+#define DELTA_DOD	0x10	/* Coded as deltas of the deltas */
+
+/* The coding, after the format */
+#define DELTA_COUNT	0	/* Samples coded */
+#define DELTA_FIRST	1	/* The first one, as it is */
+/* After the first sample */
+#define DELTA_SHIFT	0	/* Trailing zero bits left out */
+#define DELTA_WIDTH	1	/* Bits per value */
+#define DELTA_BITS	2	/* The values */
+
+int	delta_len(const uint8_t *s, int n, uint8_t fmt);
+int	delta_encode(uint8_t *dst, int room, const uint8_t *s, int n,
+	    uint8_t *fmt);
+
+#endif /* __DELTA_H__ */
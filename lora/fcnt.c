@@ -0,0 +1,175 @@
+/*
+ * Frame counter journal.  The counters of the session are appended as
+ * records to a ring of flash sectors in NVMS_LOG_PART, written only into
+ * erased words so that the flash is erased once per sector of records.
+ * The partition is raw flash; NVMS_GENERIC_PART, where the session is,
+ * goes through VES, which remaps every write and would defeat the ring.
+ *
+ * Each record reserves FCNT_RESERVE uplink counters ahead, so it is
+ * written once every FCNT_RESERVE uplinks; after a reboot the node
+ * carries on from the end of the reservation and never reuses a
+ * counter.  The downlink counter is only as recent as the last record.
+ *
+ * Records go into the sectors in order and a sector is erased before its
+ * first record, so the newest sector is the one whose first record holds
+ * the highest counter, and in it the written records are followed by
+ * erased ones: a binary search finds the last one.
+ */
+
+#include <stdint.h>
+
+#include <ad_nvms.h>
+#include "lmic/lmic.h"
+#include "lora/fcnt.h"
+
+/* Uplink counters reserved by each record */
+#define FCNT_RESERVE		64
+/* The ring, at the start of NVMS_LOG_PART */
+#define FCNT_PART		NVMS_LOG_PART
+#define FCNT_OFF		0
+#define FCNT_SECTOR_SIZE	0x1000
+#define FCNT_SECTORS		2
+
+#define FCNT_ERASED		0xffffffff
+
+struct fcnt_rec {
+	uint32_t	up;		/* Counters below this may be used */
+	uint32_t	dn;
+	uint32_t	check;
+};
+
+#define FCNT_CHECK(up, dn)	(~((up) + (dn)))
+#define FCNT_PER_SECTOR		(FCNT_SECTOR_SIZE / sizeof(struct fcnt_rec))
+#define FCNT_RECS		(FCNT_PER_SECTOR * FCNT_SECTORS)
+
+PRIVILEGED_DATA static uint32_t	reserved;	/* Up of the last record */
+PRIVILEGED_DATA static uint16_t	next;		/* Record to write next */
+
+static uint32_t
+fcnt_addr(int idx)
+{
+	return FCNT_OFF + idx / FCNT_PER_SECTOR * FCNT_SECTOR_SIZE +
+	    idx % FCNT_PER_SECTOR * sizeof(struct fcnt_rec);
+}
+
+static void
+fcnt_read(int idx, struct fcnt_rec *r)
+{
+	if (ad_nvms_read(ad_nvms_open(FCNT_PART), fcnt_addr(idx),
+	    (uint8_t *)r, sizeof(*r)) != (int)sizeof(*r))
+		r->up = r->dn = r->check = FCNT_ERASED;
+}
+
+static int
+fcnt_blank(const struct fcnt_rec *r)
+{
+	return r->up == FCNT_ERASED && r->dn == FCNT_ERASED &&
+	    r->check == FCNT_ERASED;
+}
+
+static int
+fcnt_valid(const struct fcnt_rec *r)
+{
+	return r->up != FCNT_ERASED && r->check == FCNT_CHECK(r->up, r->dn);
+}
+
+/* Erase the sector unless its first record, and so all of it, is blank */
+static void
+fcnt_erase(int sector)
+{
+	struct fcnt_rec	r;
+
+	fcnt_read(sector * FCNT_PER_SECTOR, &r);
+	if (!fcnt_blank(&r))
+		ad_nvms_erase_region(ad_nvms_open(FCNT_PART),
+		    FCNT_OFF + sector * FCNT_SECTOR_SIZE, FCNT_SECTOR_SIZE);
+}
+
+/* Append a record, return -1 if it could not be written */
+static int
+fcnt_append(uint32_t up, uint32_t dn)
+{
+	struct fcnt_rec	r;
+	int		idx;
+
+	if (next % FCNT_PER_SECTOR == 0)
+		fcnt_erase(next / FCNT_PER_SECTOR);
+	r.up = up;
+	r.dn = dn;
+	r.check = FCNT_CHECK(up, dn);
+	/* Written or torn, the slot is used */
+	idx = next;
+	next = (next + 1) % FCNT_RECS;
+	if (ad_nvms_write(ad_nvms_open(FCNT_PART), fcnt_addr(idx),
+	    (uint8_t *)&r, sizeof(r)) != (int)sizeof(r))
+		return -1;
+	reserved = up;
+	return 0;
+}
+
+/* Start the counters of a new session */
+void
+fcnt_reset(void)
+{
+	int	i;
+
+	for (i = 0; i < FCNT_SECTORS; i++)
+		fcnt_erase(i);
+	reserved = 0;
+	next = 0;
+}
+
+/*
+ * Set the counters of the session from the journal.  Return -1 if it
+ * is empty.
+ */
+int
+fcnt_restore(void)
+{
+	struct fcnt_rec	r;
+	int		i, cur = -1, lo, hi, mid;
+	uint32_t	best = 0;
+
+	for (i = 0; i < FCNT_SECTORS; i++) {
+		fcnt_read(i * FCNT_PER_SECTOR, &r);
+		if (fcnt_valid(&r) && (cur == -1 || r.up > best)) {
+			best = r.up;
+			cur = i;
+		}
+	}
+	if (cur == -1) {
+		fcnt_reset();
+		return -1;
+	}
+	/* The first record is written; find the first erased one */
+	lo = 0;
+	hi = FCNT_PER_SECTOR;
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		fcnt_read(cur * FCNT_PER_SECTOR + mid, &r);
+		if (fcnt_blank(&r))
+			hi = mid;
+		else
+			lo = mid;
+	}
+	next = (cur * FCNT_PER_SECTOR + hi) % FCNT_RECS;
+	/* Skip a record torn by a power loss */
+	do {
+		fcnt_read(cur * FCNT_PER_SECTOR + lo, &r);
+	} while (!fcnt_valid(&r) && lo-- > 0);
+	LMIC.seqnoUp = reserved = r.up;
+	LMIC.seqnoDn = r.dn;
+	return 0;
+}
+
+/*
+ * LMIC asks before a frame uses uplink counter up.  Reserve more
+ * counters if it is past the reservation.  If that cannot be written,
+ * the frame must wait: after a reboot its counter would be used again.
+ */
+bit_t
+os_reserveSeqnoUp(u4_t up)
+{
+	return up < reserved || fcnt_append(up + FCNT_RESERVE,
+	    LMIC.seqnoDn) == 0;
+}
@@ -0,0 +1,7 @@
+#ifndef __FCNT_H__
+#define __FCNT_H__
+
+void	fcnt_reset(void);
+int	fcnt_restore(void);
+
+#endif /* __FCNT_H__ */
@@ -9,13 +9,20 @@
 #include "hw/led.h"
 #include "lmic/lmic.h"
 #include "lora/ad_lora.h"
+#include "lora/adr.h"
+#include "lora/fcnt.h"
 #include "lora/lora.h"
 #include "lora/param.h"
 #include "lora/proto.h"
+#include "lora/session.h"
 #include "lora/upgrade.h"
 #include "lora/util.h"
 #include "sensor/sensor.h"
 
+#ifdef FEATURE_BATTERY
+#include <hw_usb_charger.h>
+#endif
+
 #define DEBUG
 #define DEBUG_TIME
 //#define HELLO
@@ -34,6 +41,7 @@ PRIVILEGED_DATA static uint8_t	status;
 
 #define MAX_SENSOR_SAMPLE_TIME	sec2osticks(2)
 PRIVILEGED_DATA static ostime_t	sampling_since;
+PRIVILEGED_DATA static ostime_t	sampling_time;	/* Last time sampling took */
 
 #define JOIN_TIMEOUT		sec2osticks(2 * 60 * 60)
 #define REJOIN_TIMEOUT		sec2osticks(15 * 60)
@@ -41,9 +49,23 @@ PRIVILEGED_DATA static ostime_t	sampling_since;
 #define TX_PERIOD_TIMEOUT	sec2osticks(10 * 60)
 #define ALIVE_TX_PERIOD		sec2osticks(60)
 #define SEND_RETRY_TIME		sec2osticks(10)
+/* Most that lora_schedule_next_send() adds to the delay */
+#define SEND_JITTER		0xffff
 
 #define MAX_RESETS		8
 
+/* PARAM_CLASS_C */
+#define CLASS_C_AUTO		0	/* While on external power */
+#define CLASS_C_OFF		1
+#define CLASS_C_ON		2
+#define CLASS_CHECK_PERIOD	sec2osticks(60)
+
+#ifdef FEATURE_BATTERY
+#define external_power()	hw_charger_check_vbus()
+#else
+#define external_power()	0
+#endif
+
 #ifdef DEBUG
 
 #ifdef DEBUG_TIME
@@ -91,7 +113,7 @@ debug_event(int ev)
 #define debug_event(ev)
 #endif /* DEBUG */
 
-#ifdef HW_IOX_I2C_ADDR
+#if defined(HW_IOX_I2C_ADDR) && !defined(LMIC_REGION)
 
 #define PIN_BIT0_0	0x0f
 #define PIN_BIT0_IN	0x0d
@@ -151,11 +173,11 @@ lora_autodetect_region(void)
 	return region;
 }
 
-#else /* !HW_IOX_I2C_ADDR */
+#else /* !HW_IOX_I2C_ADDR || LMIC_REGION */
 
 #define lora_autodetect_region()	REGION_EU
 
-#endif /* HW_IOX_I2C_ADDR */
+#endif /* HW_IOX_I2C_ADDR && !LMIC_REGION */
 
 static uint8_t
 lora_get_region(void)
@@ -163,23 +185,35 @@ lora_get_region(void)
 	uint8_t	region;
 
 	param_get(PARAM_LORA_REGION, &region, sizeof(region));
+#ifdef LMIC_REGION
+	/* The image is for one region, whatever the board says */
+	if ((region & ~REGION_FULL) != LMIC_REGION)
+		region = LMIC_REGION;
+#else
 	if (region == 0xff)
 		region = lora_autodetect_region();
+#endif
 #ifdef DEBUG
 	printf("region %02x\r\n", region);
 #endif
 	return region;
 }
 
+static void	lora_joined(void);
+
+/* Carry on with the stored session if there is one, or join */
 static void
-lora_start_joining(osjob_t *job)
+lora_start(osjob_t *job)
 {
 	if (!cm_lp_clk_is_avail()) {
 		os_setTimedCallback(job, os_getTime() + sec2osticks(1),
-		    lora_start_joining);
+		    lora_start);
 		return;
 	}
-	LMIC_startJoining();
+	if (session_restore())
+		lora_joined();
+	else
+		LMIC_startJoining();
 }
 
 static void
@@ -196,7 +230,7 @@ lora_reset(osjob_t *job)
 	status = 0;
 	if (LMIC_reset(lora_get_region()) == -1)
 		return;
-	os_setCallback(job, lora_start_joining);
+	os_setCallback(job, lora_start);
 }
 
 static void
@@ -204,7 +238,21 @@ lora_reset_after(ostime_t delay)
 {
 	PRIVILEGED_DATA static osjob_t	reset_job;
 
-	os_setTimedCallback(&reset_job, os_getTime() + delay, lora_reset);
+	os_setTimedCallbackSlack(&reset_job, os_getTime() + delay, delay / 16,
+	    lora_reset);
+}
+
+/*
+ * Longest wait for the next uplink, or the next reading with nothing to
+ * send, before the stack is taken to be stuck.
+ */
+static ostime_t
+lora_tx_timeout(void)
+{
+	ostime_t	delay;
+
+	delay = sensor_period() + SEND_JITTER + sec2osticks(5);
+	return delay < TX_PERIOD_TIMEOUT ? TX_PERIOD_TIMEOUT : delay;
 }
 
 #define lora_init()	lora_reset_after(sec2osticks(1))
@@ -215,8 +263,8 @@ static void	lora_send_init(osjob_t *job);
 static void
 lora_schedule_next_send(osjob_t *job, ostime_t delay)
 {
-	os_setTimedCallback(job, os_getTime() + delay + os_getRndU2(),
-	    lora_send_init);
+	os_setTimedCallbackSlack(job, os_getTime() + delay + os_getRndU2(),
+	    delay / 32, lora_send_init);
 }
 
 static void
@@ -230,9 +278,12 @@ lora_send_wait(osjob_t *job)
 		    lora_send_wait);
 		ad_lora_suspend_sleep(LORA_SUSPEND_LORA, delay + 64);
 	} else {
+		sampling_time = os_getTime() - sampling_since;
 		state = STATE_IDLE;
 		led_notify(LED_STATE_IDLE);
-		proto_send_data();
+		/* With nothing to send, the stack is not stuck on it */
+		if (!proto_send_data())
+			lora_reset_after(lora_tx_timeout());
 		lora_schedule_next_send(job, sensor_period());
 	}
 }
@@ -240,13 +291,26 @@ lora_send_wait(osjob_t *job)
 static void
 lora_send_init(osjob_t *job)
 {
+	ostime_t	delay;
+
 #ifdef DEBUG
 	debug_time();
-	printf("lora_send_init: state %d\r\n", state);
+	printf("lora_send_init: state %d airtime left %lu ms\r\n", state,
+	    osticks2ms(LMIC_airtimeLeft()));
 #endif
 	switch (state) {
 	case STATE_IDLE:
 		if (status & STATUS_LINK_UP) {
+			/*
+			 * Rather than have the data wait for the duty cycle,
+			 * sample so as to be done when it can go.
+			 */
+			delay = LMIC_nextTxTime() - os_getTime() - sampling_time;
+			if (delay > 0) {
+				os_setTimedCallback(job, os_getTime() + delay,
+				    lora_send_init);
+				return;
+			}
 			state = STATE_SAMPLING_SENSOR;
 			sampling_since = os_getTime();
 			led_notify(LED_STATE_SAMPLING_SENSOR);
@@ -274,6 +338,34 @@ lora_send(void)
 	lora_send_init(&sensor_job);
 }
 
+/*
+ * Listen for downlinks between uplinks (class C) if so set, or by default
+ * while on external power, which is checked now and then.
+ */
+static void
+lora_update_class(osjob_t *job)
+{
+	uint8_t	mode = CLASS_C_AUTO;
+
+	param_get(PARAM_CLASS_C, &mode, sizeof(mode));
+	LMIC_setClassC(mode == CLASS_C_ON ||
+	    (mode == CLASS_C_AUTO && external_power()));
+	os_setTimedCallbackSlack(job, os_getTime() + CLASS_CHECK_PERIOD,
+	    CLASS_CHECK_PERIOD / 2, lora_update_class);
+}
+
+static void
+lora_joined(void)
+{
+	PRIVILEGED_DATA static osjob_t	class_job;
+
+	status |= STATUS_JOINED | STATUS_LINK_UP;
+	state = STATE_IDLE;
+	lora_reset_after(lora_tx_timeout());
+	lora_update_class(&class_job);
+	lora_send();
+}
+
 void
 onEvent(ev_t ev)
 {
@@ -281,6 +373,9 @@ onEvent(ev_t ev)
 	switch(ev) {
 	case EV_LINK_DEAD:
 		status &= ~STATUS_LINK_UP;
+		/* The network may have lost the session: join on reset */
+		session_clear();
+		adr_reset();
 		lora_send();
 		/* NO BREAK FALLTHROUGH */
 	case EV_JOINING:
@@ -292,12 +387,17 @@ onEvent(ev_t ev)
 #ifdef DEBUG
 		printf("netid = %06lx\r\n", LMIC.netid);
 #endif
+		adr_rx();
+		/*
+		 * Counters from 0, erased before the new session is stored:
+		 * cut off in between, the old session finds no counters and
+		 * the node joins again.
+		 */
+		fcnt_reset();
+		session_update();
 		/* NO BREAK FALLTHROUGH */
 	case EV_LINK_ALIVE:
-		status |= STATUS_JOINED | STATUS_LINK_UP;
-		state = STATE_IDLE;
-		lora_reset_after(TX_PERIOD_TIMEOUT);
-		lora_send();
+		lora_joined();
 		break;
 	case EV_JOIN_FAILED:
 		lora_reinit();
@@ -319,21 +419,28 @@ onEvent(ev_t ev)
 		break;
 	case EV_TXCOMPLETE:
 		if (status & STATUS_LINK_UP) {
-			ostime_t	delay;
-
-			delay = sensor_period() + sec2osticks(5);
-			if (delay < TX_PERIOD_TIMEOUT)
-				delay = TX_PERIOD_TIMEOUT;
-			lora_reset_after(delay);
+			lora_reset_after(lora_tx_timeout());
 			led_notify(LED_STATE_IDLE);
+			adr_rx();
+			/* After the MAC commands of any downlink */
+			session_update();
 		}
 		if (LMIC.dataLen != 0) {
 			proto_handle(LMIC.frame[LMIC.dataBeg - 1],
 			    LMIC.frame + LMIC.dataBeg, LMIC.dataLen);
 		}
+		proto_txcomplete();
 		state = STATE_IDLE;
 		ad_lora_allow_sleep(LORA_SUSPEND_LORA);
 		break;
+	case EV_RXCOMPLETE:
+		/* In class C, between uplinks */
+		session_update();
+		if (LMIC.dataLen != 0) {
+			proto_handle(LMIC.frame[LMIC.dataBeg - 1],
+			    LMIC.frame + LMIC.dataBeg, LMIC.dataLen);
+		}
+		break;
 	default:
 		break;
 	}
@@ -6,6 +6,7 @@
 #include <platform_nvparam.h>
 #include "lmic/lmic.h"
 #include "lora/param.h"
+#include "lora/session.h"
 #include "lora/util.h"
 
 #define DEBUG
@@ -25,6 +26,12 @@ INITIALISED_PRIVILEGED_DATA static u1_t	devkey[16] = {
 };
 INITIALISED_PRIVILEGED_DATA static uint8_t	lora_region = 0xff;
 PRIVILEGED_DATA static uint8_t			suota, sensor_period, min_sf;
+PRIVILEGED_DATA static uint8_t			device_adr, class_c, sensor_batch;
+PRIVILEGED_DATA static uint8_t			heartbeat;
+/* 0.5 degrees, 10 % and 50 m */
+INITIALISED_PRIVILEGED_DATA static uint8_t	temp_deadband = 5;
+INITIALISED_PRIVILEGED_DATA static uint8_t	light_deadband = 10;
+INITIALISED_PRIVILEGED_DATA static uint8_t	gps_deadband = 5;
 
 /* NVPARAM "ble_platform" */
 #define PARAM_DEV_EUI_OFF	TAG_BLE_PLATFORM_BD_ADDRESS
@@ -50,9 +57,33 @@ PRIVILEGED_DATA static uint8_t			suota, sensor_period, min_sf;
 #define PARAM_LORA_REGION_OFF	(PARAM_MIN_SF_OFF + PARAM_MIN_SF_LEN)
 #define PARAM_LORA_REGION_LEN	sizeof(lora_region)
 
+#define PARAM_DEVICE_ADR_OFF	(PARAM_LORA_REGION_OFF + PARAM_LORA_REGION_LEN)
+#define PARAM_DEVICE_ADR_LEN	sizeof(device_adr)
+
+#define PARAM_CLASS_C_OFF	(PARAM_DEVICE_ADR_OFF + PARAM_DEVICE_ADR_LEN)
+#define PARAM_CLASS_C_LEN	sizeof(class_c)
+
+#define PARAM_SENSOR_BATCH_OFF	(PARAM_CLASS_C_OFF + PARAM_CLASS_C_LEN)
+#define PARAM_SENSOR_BATCH_LEN	sizeof(sensor_batch)
+
+#define PARAM_HEARTBEAT_OFF	(PARAM_SENSOR_BATCH_OFF + PARAM_SENSOR_BATCH_LEN)
+#define PARAM_HEARTBEAT_LEN	sizeof(heartbeat)
+
+#define PARAM_TEMP_DEADBAND_OFF	(PARAM_HEARTBEAT_OFF + PARAM_HEARTBEAT_LEN)
+#define PARAM_TEMP_DEADBAND_LEN	sizeof(temp_deadband)
+
+#define PARAM_LIGHT_DEADBAND_OFF	(PARAM_TEMP_DEADBAND_OFF + \
+					 PARAM_TEMP_DEADBAND_LEN)
+#define PARAM_LIGHT_DEADBAND_LEN	sizeof(light_deadband)
+
+#define PARAM_GPS_DEADBAND_OFF	(PARAM_LIGHT_DEADBAND_OFF + \
+				 PARAM_LIGHT_DEADBAND_LEN)
+#define PARAM_GPS_DEADBAND_LEN	sizeof(gps_deadband)
+
 #define PARAM_FLAG_BLE_NV	0x01	/* Stored in BLE NVPARAM area */
 #define PARAM_FLAG_REVERSE	0x02	/* Reversed in protocol */
 #define PARAM_FLAG_WRITE_ONLY	0x04	/* "Get param" disallowed */
+#define PARAM_FLAG_SESSION	0x08	/* Setting it ends the session */
 
 struct param_def {
 	void		*mem;		/* Location in memory */
@@ -66,19 +97,20 @@ static const struct param_def	params[] = {
 		.mem	= deveui,
 		.offset	= PARAM_DEV_EUI_OFF,
 		.len	= PARAM_DEV_EUI_LEN,
-		.flags	= PARAM_FLAG_BLE_NV | PARAM_FLAG_REVERSE,
+		.flags	= PARAM_FLAG_BLE_NV | PARAM_FLAG_REVERSE |
+		    PARAM_FLAG_SESSION,
 	},
 	[PARAM_APP_EUI] = {
 		.mem	= appeui,
 		.offset	= PARAM_APP_EUI_OFF,
 		.len	= PARAM_APP_EUI_LEN,
-		.flags	= PARAM_FLAG_REVERSE,
+		.flags	= PARAM_FLAG_REVERSE | PARAM_FLAG_SESSION,
 	},
 	[PARAM_DEV_KEY] = {
 		.mem	= devkey,
 		.offset	= PARAM_DEV_KEY_OFF,
 		.len	= PARAM_DEV_KEY_LEN,
-		.flags	= PARAM_FLAG_WRITE_ONLY,
+		.flags	= PARAM_FLAG_WRITE_ONLY | PARAM_FLAG_SESSION,
 	},
 	[PARAM_SENSOR_PERIOD] = {
 		.mem	= &sensor_period,
@@ -94,12 +126,48 @@ static const struct param_def	params[] = {
 		.mem	= &lora_region,
 		.offset	= PARAM_LORA_REGION_OFF,
 		.len	= PARAM_LORA_REGION_LEN,
+		.flags	= PARAM_FLAG_SESSION,
 	},
 	[PARAM_SUOTA] = {
 		.mem	= &suota,
 		.offset	= PARAM_SUOTA_OFF,
 		.len	= PARAM_SUOTA_LEN,
 	},
+	[PARAM_DEVICE_ADR] = {
+		.mem	= &device_adr,
+		.offset	= PARAM_DEVICE_ADR_OFF,
+		.len	= PARAM_DEVICE_ADR_LEN,
+	},
+	[PARAM_CLASS_C] = {
+		.mem	= &class_c,
+		.offset	= PARAM_CLASS_C_OFF,
+		.len	= PARAM_CLASS_C_LEN,
+	},
+	[PARAM_SENSOR_BATCH] = {
+		.mem	= &sensor_batch,
+		.offset	= PARAM_SENSOR_BATCH_OFF,
+		.len	= PARAM_SENSOR_BATCH_LEN,
+	},
+	[PARAM_HEARTBEAT] = {
+		.mem	= &heartbeat,
+		.offset	= PARAM_HEARTBEAT_OFF,
+		.len	= PARAM_HEARTBEAT_LEN,
+	},
+	[PARAM_TEMP_DEADBAND] = {
+		.mem	= &temp_deadband,
+		.offset	= PARAM_TEMP_DEADBAND_OFF,
+		.len	= PARAM_TEMP_DEADBAND_LEN,
+	},
+	[PARAM_LIGHT_DEADBAND] = {
+		.mem	= &light_deadband,
+		.offset	= PARAM_LIGHT_DEADBAND_OFF,
+		.len	= PARAM_LIGHT_DEADBAND_LEN,
+	},
+	[PARAM_GPS_DEADBAND] = {
+		.mem	= &gps_deadband,
+		.offset	= PARAM_GPS_DEADBAND_OFF,
+		.len	= PARAM_GPS_DEADBAND_LEN,
+	},
 };
 
 static inline void
@@ -180,6 +248,8 @@ write_param(const struct param_def *param, void *data)
 	else
 		memcpy(buf, data, param->len);
 	memcpy(param->mem, buf, param->len);
+	if (param->flags & PARAM_FLAG_SESSION)
+		session_clear();
 	if (param->flags & PARAM_FLAG_BLE_NV) {
 		nvparam_t	nvparam;
 		uint16_t	param_len;
@@ -8,6 +8,13 @@
 #define PARAM_MIN_SF		    4
 #define PARAM_LORA_REGION	  5
 #define PARAM_SUOTA		      6
+#define PARAM_DEVICE_ADR	  7
+#define PARAM_CLASS_C		    8
+#define PARAM_SENSOR_BATCH	  9
+#define PARAM_HEARTBEAT		 10
+#define PARAM_TEMP_DEADBAND	 11
+#define PARAM_LIGHT_DEADBAND	 12
+#define PARAM_GPS_DEADBAND	 13
 
 #define PARAM_MAX_LEN	16	/* sizeof(devkey) */
 
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include "hw/led.h"
 #include "lmic/lmic.h"
+#include "lora/delta.h"
 #include "lora/lora.h"
 #include "lora/param.h"
 #include "lora/proto.h"
@@ -26,27 +27,103 @@ typedef enum {
 	INFO_PARAM		= 0x00,
 	INFO_SENSOR_DATA	= 0x10,
 	INFO_BATTERY		= 0x20,
+	INFO_CHANNELS		= 0x30,
+	INFO_SENSOR_SERIES	= 0x40,
+	INFO_SENSOR_DELTAS	= 0x50,
 } uplink_info;
 
 #define STATUS_TX_PENDING	0x01
 PRIVILEGED_DATA static uint8_t	status;
 
-#define MAX_PAYLOAD_LEN		51
-#define MAX_SENSOR_DATA_LEN	32
-#define MAX_BATTERY_DATA_LEN	2
+#define MAX_PAYLOAD_LEN		(MAX_LEN_PAYLOAD - 1)	/* Less the port */
+#define MAX_READING_LEN		16	/* With the type; a GPS fix takes 12 */
+#define CHANNEL_INFO_LEN	8
+#define MAX_CHANNEL_INFOS	4
 
-PRIVILEGED_DATA static uint8_t	pend_tx_data[MAX_PAYLOAD_LEN];
-PRIVILEGED_DATA static uint8_t	sensor_data[MAX_SENSOR_DATA_LEN];
-PRIVILEGED_DATA static uint8_t	battery_data[MAX_BATTERY_DATA_LEN];
-PRIVILEGED_DATA static uint8_t	pend_tx_len, sensor_len, battery_len;
+PRIVILEGED_DATA static uint8_t	frame[MAX_PAYLOAD_LEN];
 
 #define LEN_LEN(len)	(1 + ((len) >= LEN_MASK))
 
+/*
+ * Records wait in a queue until a frame has room for them, those of
+ * higher priority first, in the order queued within one.  A reading or
+ * battery level takes the place of any from the same source not sent
+ * yet.  A full queue drops records of lower priority to make room, never
+ * of higher, so replies are only lost if there are more than it holds.
+ */
+#define PRIO_DATA		0	/* Readings, battery level */
+#define PRIO_ALARM		1	/* Readings that need attention */
+#define PRIO_REPLY		2	/* To commands */
+#define PRIO_MASK		0x7f
+#define PRIO_QUEUED		0x80	/* In the frame set for TX */
+
+#define SRC_NONE		0
+#define SRC_BATTERY		1
+#define SRC_SENSOR(i)		(2 + (i))
+
+/* A record: priority, source, then as it goes in the frame */
+#define REC_PRIO		0
+#define REC_SRC			1
+#define REC_DATA		2
+
+#define QUEUE_LEN		128
+
+PRIVILEGED_DATA static uint8_t	queue[QUEUE_LEN];
+PRIVILEGED_DATA static uint8_t	queue_len;
+
+/*
+ * With PARAM_SENSOR_BATCH above 1, the readings of each sensor are kept
+ * as a series.  It goes as an INFO_SENSOR_SERIES record: the sensor type,
+ * the length of each sample, the interval and the age of the first
+ * sample in seconds, then the samples.  If the sensor reads integers,
+ * they may go as an INFO_SENSOR_DELTAS record instead, with the format of
+ * delta.c in place of the length and the samples delta coded.  Either
+ * way, the series goes with the first frame once one of them is due, as
+ * many of its samples as fit, and the rest with the next one.
+ */
+#define SERIES_TYPE		0
+#define SERIES_SAMPLE_LEN	1
+#define SERIES_INTERVAL		2
+#define SERIES_AGE		4
+#define SERIES_HDR_LEN		6
+#define SERIES_DATA_LEN		120
+/* Oldest data kept, well within the 16-bit age */
+#define SERIES_MAX_AGE		sec2osticks(6 * 60 * 60)
+
+struct series {
+	ostime_t	first;		/* When the first sample was taken */
+	uint8_t		n;		/* Samples held */
+	uint8_t		queued;		/* Of them, in the frame set for TX */
+	uint8_t		format;		/* For delta.c, 0: send as they are */
+	uint8_t		ended;		/* A reading was left out since */
+	uint8_t		hdr[SERIES_HDR_LEN];
+	uint8_t		data[SERIES_DATA_LEN];
+};
+
+PRIVILEGED_DATA static struct series	series[SENSOR_MAX];
+
+/*
+ * With PARAM_HEARTBEAT set, a reading goes only if it differs from the
+ * last one sent of its sensor by more than the deadband of the sensor,
+ * or if no reading has gone for the heartbeat period.  A reading left out
+ * ends the series of its sensor, which then goes.  With no reading to go,
+ * there is no frame, unless for something else.
+ */
+#define MAX_REPORT_LEN		16
+
+struct report {
+	uint8_t	len;
+	char	data[MAX_REPORT_LEN];
+};
+
+PRIVILEGED_DATA static struct report	reported[SENSOR_MAX];
+PRIVILEGED_DATA static ostime_t		reported_at;
+
 static void
 tx_enqueue(uint8_t *dest, uint8_t *dlen, uint8_t maxlen,
-    uint8_t cmd, int len, void *data)
+    uint8_t cmd, int len, const void *data)
 {
-	if (*dlen + LEN_LEN(len) + len > maxlen)
+	if (len > LONG_LEN_MASK || *dlen + LEN_LEN(len) + len > maxlen)
 		return;
 	if (len < LEN_MASK)
 		dest[(*dlen)++] = cmd | len;
@@ -58,47 +135,195 @@ tx_enqueue(uint8_t *dest, uint8_t *dlen, uint8_t maxlen,
 	*dlen += len;
 }
 
-#define ADD_TX(x)	do {						\
-	if (total_len + x ## _len <= (int)ARRAY_SIZE(pend_tx_data)) {	\
-		memcpy(pend_tx_data + total_len, x ## _data, x ## _len);\
-		total_len += x ## _len;					\
-	}								\
-} while (0)
+/* Length of the record at r in the frame */
+static int
+rec_len(const uint8_t *r)
+{
+	r += REC_DATA;
+	if ((r[0] & LEN_MASK) < LEN_MASK)
+		return 1 + (r[0] & LEN_MASK);
+	return 2 + (r[1] & LONG_LEN_MASK);
+}
+
+#define REC_NEXT(r)	((r) + REC_DATA + rec_len(r))
 
+static void
+dequeue(uint8_t *r)
+{
+	uint8_t	*next = REC_NEXT(r);
+
+	memmove(r, next, queue + queue_len - next);
+	queue_len -= next - r;
+}
+
+/*
+ * Queue a record for the next frames.  Return -1 if it would not fit a
+ * frame, or there is no room for it even after dropping those of lower
+ * priority.
+ */
+static int
+enqueue(uint8_t prio, uint8_t src, uint8_t cmd, int len, const void *data)
+{
+	uint8_t	*r, *last, rlen = 0;
+
+	if (len > LONG_LEN_MASK || LEN_LEN(len) + len > (int)sizeof(frame))
+		return -1;
+	for (r = queue; src != SRC_NONE && r < queue + queue_len; ) {
+		if (r[REC_SRC] == src)
+			dequeue(r);
+		else
+			r = REC_NEXT(r);
+	}
+	while (queue_len + REC_DATA + LEN_LEN(len) + len > (int)sizeof(queue)) {
+		for (r = last = queue; r < queue + queue_len; r = REC_NEXT(r))
+			last = r;
+		if (queue_len == 0 || (last[REC_PRIO] & PRIO_MASK) >= prio)
+			return -1;
+		dequeue(last);
+	}
+	for (r = queue; r < queue + queue_len &&
+	    (r[REC_PRIO] & PRIO_MASK) >= prio; r = REC_NEXT(r))
+		;
+	memmove(r + REC_DATA + LEN_LEN(len) + len, r, queue + queue_len - r);
+	r[REC_PRIO] = prio;
+	r[REC_SRC] = src;
+	tx_enqueue(r + REC_DATA, &rlen, LEN_LEN(len) + len, cmd, len, data);
+	queue_len += REC_DATA + rlen;
+	return 0;
+}
+
+/* Bytes that all the records queued take in frames */
+static int
+queued_len(void)
+{
+	uint8_t	*r;
+	int	 len = 0;
+
+	for (r = queue; r < queue + queue_len; r = REC_NEXT(r))
+		len += rec_len(r);
+	return len;
+}
+
+/*
+ * Put as many samples of s, from sample skip on, as fit in room bytes and
+ * one record into the record at buf, delta coded if that fits more or
+ * takes fewer bytes.  Return the length of the record, 0 if none fit,
+ * with its type in *info and the samples it carries in *n.
+ */
+static int
+series_code(const struct series *s, int skip, uint8_t *buf, int room,
+    uint8_t *info, uint8_t *n)
+{
+	const uint8_t	*data;
+	uint8_t		 fmt = s->format, slen = s->hdr[SERIES_SAMPLE_LEN];
+	int		 len = 0, raw, left = s->n - skip;
+
+	if (room > LONG_LEN_MASK)
+		room = LONG_LEN_MASK;
+	data = s->data + skip * slen;
+	raw = room < SERIES_HDR_LEN ? 0 : (room - SERIES_HDR_LEN) / slen;
+	if (raw > left)
+		raw = left;
+	memcpy(buf, s->hdr, SERIES_HDR_LEN);
+	os_wlsbf2(buf + SERIES_AGE, os_rlsbf2(s->hdr + SERIES_AGE) -
+	    skip * os_rlsbf2(s->hdr + SERIES_INTERVAL));
+	if (fmt != 0)
+		len = delta_encode(buf + SERIES_HDR_LEN, room - SERIES_HDR_LEN,
+		    data, left, &fmt);
+	if (len != 0 && (buf[SERIES_HDR_LEN + DELTA_COUNT] > raw ||
+	    (buf[SERIES_HDR_LEN + DELTA_COUNT] == raw && len < raw * slen))) {
+		buf[SERIES_SAMPLE_LEN] = fmt;
+		*info = INFO_SENSOR_DELTAS;
+		*n = buf[SERIES_HDR_LEN + DELTA_COUNT];
+		return SERIES_HDR_LEN + len;
+	}
+	memcpy(buf + SERIES_HDR_LEN, data, raw * slen);
+	*info = INFO_SENSOR_SERIES;
+	*n = raw;
+	return raw ? SERIES_HDR_LEN + raw * slen : 0;
+}
+
+/* Bytes the records that carry all of s take in a frame */
+static int
+series_len(const struct series *s)
+{
+	int	len = s->n * s->hdr[SERIES_SAMPLE_LEN], dlen, per;
+
+	if (s->format != 0 &&
+	    (dlen = delta_len(s->data, s->n, s->format)) < len)
+		len = dlen;
+	if (SERIES_HDR_LEN + len <= LONG_LEN_MASK)
+		return LEN_LEN(SERIES_HDR_LEN + len) + SERIES_HDR_LEN + len;
+	/* About, as the delta coding starts over in every record */
+	per = LONG_LEN_MASK - SERIES_HDR_LEN;
+	return len + (len + per - 1) / per * (LEN_LEN(LONG_LEN_MASK) +
+	    SERIES_HDR_LEN);
+}
+
+/*
+ * Bytes the next frame has room for: fewer than the buffer at slow data
+ * rates, and less the MAC answers that go with it.
+ */
+static int
+frame_room(void)
+{
+	int	room = LMIC_maxPayload();
+
+	return room < (int)sizeof(frame) ? room : (int)sizeof(frame);
+}
+
+/*
+ * Set the frame to go next: as many of the records queued as fit, in
+ * order, then the series.  Those that do not fit wait for the next.
+ */
 static void
 set_tx_data(void)
 {
-	int	total_len = pend_tx_len;
+	struct series	*s;
+	uint8_t		 buf[LONG_LEN_MASK];
+	uint8_t		 total_len = 0, info, n, *r;
+	int		 len, room, max = frame_room();
 
-	ADD_TX(battery);
-	ADD_TX(sensor);
+	for (r = queue; r < queue + queue_len; r = REC_NEXT(r)) {
+		r[REC_PRIO] &= ~PRIO_QUEUED;
+		if (total_len + rec_len(r) > max)
+			continue;
+		memcpy(frame + total_len, r + REC_DATA, rec_len(r));
+		total_len += rec_len(r);
+		r[REC_PRIO] |= PRIO_QUEUED;
+	}
+	for (s = series; s < series + SENSOR_MAX; s++) {
+		s->queued = 0;
+		if (s->n == 0)
+			continue;
+		os_wlsbf2(s->hdr + SERIES_AGE,
+		    (os_getTime() - s->first) / OSTICKS_PER_SEC);
+		/* In as many records as it takes */
+		while (s->queued < s->n) {
+			room = max - total_len;
+			len = series_code(s, s->queued, buf,
+			    room - LEN_LEN(room), &info, &n);
+			if (len == 0)
+				break;
+			tx_enqueue(frame, &total_len, max, info, len, buf);
+			s->queued += n;
+		}
+	}
 #ifdef DEBUG
 	printf("set tx data:");
 	for (int i = 0; i < total_len; i++)
-		printf(" %02x", pend_tx_data[i]);
+		printf(" %02x", frame[i]);
 	printf("\r\n");
 #endif
 	if (total_len) {
-		LMIC_setTxData2(PORT, pend_tx_data, total_len, 0);
+		/* Before, as the frame may start, and be dropped, at once */
 		status |= STATUS_TX_PENDING;
+		LMIC_setTxData2(PORT, frame, total_len, 0);
 	}
 }
 
-#define TX_CLEAR(x)	do {						\
-	x ## _len = 0;							\
-} while (0)
-
-#define TX_ADD(x, cmd, len, data)					\
-	tx_enqueue(x ## _data, &x ## _len, ARRAY_SIZE(x ## _data),	\
-	    cmd, len, data)
-
-#define TX_SET(x, cmd, len, data)	do {				\
-	TX_CLEAR(x);							\
-	TX_ADD(x, cmd, len, data);					\
-} while (0)
-
-#define TX_ENQUEUE(cmd, len, data)	TX_SET(pend_tx, cmd, len, data)
-
+#define TX_ENQUEUE(cmd, len, data)	\
+	enqueue(PRIO_REPLY, SRC_NONE, cmd, len, data)
 
 static void
 handle_params(uint8_t *data, uint8_t len)
@@ -137,14 +362,47 @@ handle_reboot_upgrade(uint8_t *data, uint8_t len)
 	}
 }
 
+static uint8_t
+percent(uint8_t n, uint8_t total)
+{
+	return total ? n * 100 / total : 0xff;
+}
+
+static void
+handle_channels(uint8_t *data, uint8_t len)
+{
+	uint8_t		 buf[CHANNEL_INFO_LEN * MAX_CHANNEL_INFOS], *p = buf;
+	const chstat_t	*cs;
+	uint8_t		 chnl;
+
+	if (len > 1)
+		return;
+	for (chnl = len ? data[0] : 0; (cs = LMIC_chStats(chnl)) != NULL &&
+	    p < buf + sizeof(buf); chnl++) {
+		if (cs->tx == 0 && cs->sensed == 0)
+			continue;
+		*p++ = chnl;
+		*p++ = cs->tx;
+		*p++ = cs->tx >> 8;
+		*p++ = percent(cs->ok, cs->ask);
+		*p++ = percent(cs->busy, cs->sensed);
+		*p++ = LMIC_chWeight(chnl) - 1;
+		*p++ = cs->rssi < -128 ? -128 : cs->rssi;
+		*p++ = cs->snr;
+	}
+	TX_ENQUEUE(INFO_CHANNELS, p - buf, buf);
+}
+
 typedef enum {
 	CMD_GET_SET_PARAMS	= 0x0,
 	CMD_REBOOT_UPGRADE	= 0x1,
+	CMD_GET_CHANNELS	= 0x2,
 } downlink_cmd;
 
 static void	(* const downlink_handlers[])(uint8_t *, uint8_t) = {
 	[CMD_GET_SET_PARAMS]	= handle_params,
 	[CMD_REBOOT_UPGRADE]	= handle_reboot_upgrade,
+	[CMD_GET_CHANNELS]	= handle_channels,
 };
 
 void
@@ -183,35 +441,197 @@ proto_handle(uint8_t port, uint8_t *data, uint8_t len)
 	set_tx_data();
 }
 
-void
+/* Samples per uplink */
+static uint8_t
+batch_size(void)
+{
+	uint8_t	n = 0;
+
+	param_get(PARAM_SENSOR_BATCH, &n, sizeof(n));
+	return n ? n : 1;
+}
+
+/* Queue the reading in buf of sensor i, as an alarm if the sensor says */
+static int
+queue_reading(int i, const char *buf, size_t len)
+{
+	return enqueue(sensor_alarm(i, buf + 1, len - 1) ? PRIO_ALARM :
+	    PRIO_DATA, SRC_SENSOR(i), INFO_SENSOR_DATA, len, buf);
+}
+
+/* Whether every reading is to go, as with no heartbeat set */
+static int
+heartbeat_due(void)
+{
+	ostime_t	heartbeat = sensor_heartbeat();
+
+	return heartbeat == 0 || os_getTime() - reported_at >= heartbeat;
+}
+
+/*
+ * Whether the reading in buf of sensor i is to go, being due anyway or
+ * news.  If so, it counts as sent.
+ */
+static int
+reading_due(int i, const char *buf, size_t len, int due)
+{
+	buf++;
+	len--;
+	if (!due && len <= MAX_REPORT_LEN &&
+	    !sensor_changed(i, reported[i].data, reported[i].len, buf, len))
+		return 0;
+	reported[i].len = len <= MAX_REPORT_LEN ? len : 0;
+	memcpy(reported[i].data, buf, reported[i].len);
+	reported_at = os_getTime();
+	return 1;
+}
+
+/* Add the reading in buf to s; return -1 if it does not fit the series */
+static int
+series_add(struct series *s, const char *buf, size_t len, ostime_t period,
+    uint8_t format)
+{
+	uint8_t	slen = len - 1;
+
+	if (s->n != 0 && (s->ended || s->hdr[SERIES_SAMPLE_LEN] != slen ||
+	    os_rlsbf2(s->hdr + SERIES_INTERVAL) != period / OSTICKS_PER_SEC))
+		return -1;
+	if ((s->n + 1) * slen > (int)sizeof(s->data))
+		return -1;
+	if (s->n == 0) {
+		s->hdr[SERIES_TYPE] = buf[0];
+		s->hdr[SERIES_SAMPLE_LEN] = slen;
+		os_wlsbf2(s->hdr + SERIES_INTERVAL, period / OSTICKS_PER_SEC);
+		s->format = (format & DELTA_LEN_MASK) == slen ? format : 0;
+		s->first = os_getTime();
+		s->ended = 0;
+	}
+	memcpy(s->data + s->n++ * slen, buf + 1, slen);
+	return 0;
+}
+
+/*
+ * Whether the series have to go now: one is full or would be too old
+ * with the next reading, or they no longer all fit in the frame.
+ */
+static int
+series_due(uint8_t n, ostime_t period)
+{
+	struct series	*s;
+	int		 len = queued_len();
+
+	for (s = series; s < series + SENSOR_MAX; s++) {
+		if (s->n == 0)
+			continue;
+		if (s->n >= n ||
+		    os_getTime() - s->first > SERIES_MAX_AGE - period)
+			return 1;
+		len += series_len(s);
+	}
+	return len > frame_room();
+}
+
+/*
+ * Read the sensors and set the frame to send, if one is due.  Return
+ * whether a frame waits to go.
+ */
+int
 proto_send_data(void)
 {
 	PRIVILEGED_DATA static uint8_t	last_bat_level;
-	int				i;
-	char				buf[MAX_LEN_PAYLOAD];
+	int				i, due = 0, all, queued = 0;
+	char				buf[MAX_READING_LEN];
 	size_t				len;
-	uint8_t				cur_bat_level;
+	ostime_t			period;
+	uint8_t				cur_bat_level, n;
 
 	cur_bat_level = bat_level();
 	if (cur_bat_level != last_bat_level) {
 		last_bat_level = cur_bat_level;
-		TX_SET(battery, INFO_BATTERY, 1, &cur_bat_level);
+		enqueue(PRIO_DATA, SRC_BATTERY, INFO_BATTERY, 1,
+		    &cur_bat_level);
+	}
+	all = heartbeat_due();
+	if ((n = batch_size()) == 1) {
+		for (i = 0; i < SENSOR_MAX; i++) {
+			len = sensor_get_data(i, buf, sizeof(buf));
+			if (len > 1 && !reading_due(i, buf, len, all))
+				continue;
+			if (len != 0 && queue_reading(i, buf, len) == 0)
+				queued = 1;
+		}
+		if (all || queued)
+			set_tx_data();
+		return status & STATUS_TX_PENDING;
 	}
-	TX_CLEAR(sensor);
+	/* Readings that do not fit their series go on their own, now */
+	period = sensor_period();
 	for (i = 0; i < SENSOR_MAX; i++) {
 		len = sensor_get_data(i, buf, sizeof(buf));
-		if (len != 0)
-			TX_ADD(sensor, INFO_SENSOR_DATA, len, buf);
+		if (len <= 1)
+			continue;
+		if (!reading_due(i, buf, len, all)) {
+			if (series[i].n != 0)
+				series[i].ended = due = 1;
+			continue;
+		}
+		if (series_add(series + i, buf, len, period,
+		    sensor_format(i)) == -1) {
+			queue_reading(i, buf, len);
+			due = 1;
+		}
 	}
-	set_tx_data();
+	if (due || series_due(n, period))
+		set_tx_data();
+	return status & STATUS_TX_PENDING;
 }
 
+/* Drop what the frame going out carries */
 void
 proto_txstart(void)
 {
-	status &= ~STATUS_TX_PENDING;
-	TX_CLEAR(pend_tx);
-	TX_CLEAR(sensor);
-	TX_CLEAR(battery);
+	struct series	*s;
+	uint8_t		*r, slen;
+
 	sensor_txstart();
+	/* Only MAC answers had room, the frame goes with the next */
+	if (LMIC.pendTxDelayed)
+		return;
+	status &= ~STATUS_TX_PENDING;
+	/* The data rate dropped below the frame: set it anew, later */
+	if (LMIC.pendTxDropped) {
+		for (r = queue; r < queue + queue_len; r = REC_NEXT(r))
+			r[REC_PRIO] &= ~PRIO_QUEUED;
+		for (s = series; s < series + SENSOR_MAX; s++)
+			s->queued = 0;
+		return;
+	}
+	for (r = queue; r < queue + queue_len; ) {
+		if (r[REC_PRIO] & PRIO_QUEUED)
+			dequeue(r);
+		else
+			r = REC_NEXT(r);
+	}
+	for (s = series; s < series + SENSOR_MAX; s++) {
+		if (s->queued == 0)
+			continue;
+		slen = s->hdr[SERIES_SAMPLE_LEN];
+		s->n -= s->queued;
+		memmove(s->data, s->data + s->queued * slen, s->n * slen);
+		s->first += s->queued *
+		    os_rlsbf2(s->hdr + SERIES_INTERVAL) * OSTICKS_PER_SEC;
+		s->queued = 0;
+	}
+}
+
+/*
+ * Send what is left of the replies and alarms at once, unless a frame is
+ * on its way: the stack forgets any set during a TX once it completes.
+ */
+void
+proto_txcomplete(void)
+{
+	if (queue_len != 0 && (queue[REC_PRIO] & PRIO_MASK) > PRIO_DATA &&
+	    !(LMIC.opmode & (OP_TXDATA | OP_TXRXPEND)))
+		set_tx_data();
 }
@@ -2,7 +2,8 @@
 #define __PROTO_H__
 
 void	proto_handle(uint8_t port, uint8_t *data, uint8_t len);
-void	proto_send_data(void);
+int	proto_send_data(void);
 void	proto_txstart(void);
+void	proto_txcomplete(void);
 
 #endif /* __PROTO_H__ */
@@ -0,0 +1,166 @@
+/*
+ * LoRaWAN session in permanent storage.  After a reboot or a reset of
+ * the stack the node carries on with the session it had instead of
+ * joining again.  The frame counters, which change with every frame,
+ * are kept apart in the journal of fcnt.c.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <ad_nvms.h>
+#include "lmic/lmic.h"
+#include "lora/fcnt.h"
+#include "lora/session.h"
+#include "lora/util.h"
+
+#define DEBUG
+
+/* In NVMS_GENERIC_PART, after the parameters */
+#define SESSION_OFF		0x100
+#define SESSION_MAGIC		0x5e52
+
+struct session {
+	uint16_t	magic;
+	uint16_t	crc;		/* Of the rest */
+	uint8_t		region;
+	uint8_t		datarate;
+	int8_t		txpow;
+	uint8_t		dn2_dr;
+	uint32_t	dn2_freq;
+	uint8_t		up_repeat;
+	uint8_t		duty_rate;
+	uint16_t	chnl_map[ARRAY_SIZE(LMIC.channelMap)];
+	uint32_t	netid;
+	uint32_t	devaddr;
+	uint8_t		nwk_key[16];
+	uint8_t		art_key[16];
+	uint32_t	chnl_freq[MAX_CHANNELS_EU];
+	uint16_t	chnl_drmap[MAX_CHANNELS_EU];
+	uint32_t	xch_freq[MAX_XCHANNELS_US];
+	uint16_t	xch_drmap[MAX_XCHANNELS_US];
+};
+
+#define SESSION_BODY(s)		((uint8_t *)(s) + \
+				 offsetof(struct session, region))
+#define SESSION_BODY_LEN	(sizeof(struct session) - \
+				 offsetof(struct session, region))
+
+/* As last written */
+PRIVILEGED_DATA static struct session	saved;
+
+static void
+session_fill(struct session *s)
+{
+	memset(s, 0, sizeof(*s));
+	s->magic = SESSION_MAGIC;
+	s->region = LMIC.region;
+	s->datarate = LMIC.datarate;
+	s->txpow = LMIC.adrTxPow;
+	s->dn2_dr = LMIC.dn2Dr;
+	s->dn2_freq = LMIC.dn2Freq;
+	s->up_repeat = LMIC.upRepeat;
+	s->duty_rate = LMIC.globalDutyRate;
+	memcpy(s->chnl_map, LMIC.channelMap, sizeof(s->chnl_map));
+	s->netid = LMIC.netid;
+	s->devaddr = LMIC.devaddr;
+	memcpy(s->nwk_key, LMIC.nwkKey, sizeof(s->nwk_key));
+	memcpy(s->art_key, LMIC.artKey, sizeof(s->art_key));
+	memcpy(s->chnl_freq, LMIC.channelFreq, sizeof(s->chnl_freq));
+	memcpy(s->chnl_drmap, LMIC.channelDrMap, sizeof(s->chnl_drmap));
+	memcpy(s->xch_freq, LMIC.xchFreq, sizeof(s->xch_freq));
+	memcpy(s->xch_drmap, LMIC.xchDrMap, sizeof(s->xch_drmap));
+	s->crc = os_crc16(SESSION_BODY(s), SESSION_BODY_LEN);
+}
+
+/*
+ * Set up the stack, just reset for the region, with the stored session.
+ * Return 1 if there was one, 0 with the stack left as it was if there
+ * was none or its frame counters are lost, so that the node joins.
+ */
+int
+session_restore(void)
+{
+	struct session	s;
+	nvms_t		nvms;
+
+	nvms = ad_nvms_open(NVMS_GENERIC_PART);
+	if (ad_nvms_read(nvms, SESSION_OFF, (uint8_t *)&s, sizeof(s)) !=
+	    (int)sizeof(s) || s.magic != SESSION_MAGIC ||
+	    s.crc != os_crc16(SESSION_BODY(&s), SESSION_BODY_LEN) ||
+	    s.region != LMIC.region)
+		return 0;
+	/* Sets up the default channels and dn2 settings, so go first */
+	LMIC_setSession(s.netid, s.devaddr, s.nwk_key, s.art_key);
+	LMIC_setDrTxpow(s.datarate, s.txpow);
+	LMIC.dn2Dr = s.dn2_dr;
+	LMIC.dn2Freq = s.dn2_freq;
+	LMIC.upRepeat = s.up_repeat;
+	LMIC.globalDutyRate = s.duty_rate;
+	memcpy(LMIC.channelMap, s.chnl_map, sizeof(s.chnl_map));
+	memcpy(LMIC.channelFreq, s.chnl_freq, sizeof(s.chnl_freq));
+	memcpy(LMIC.channelDrMap, s.chnl_drmap, sizeof(s.chnl_drmap));
+	memcpy(LMIC.xchFreq, s.xch_freq, sizeof(s.xch_freq));
+	memcpy(LMIC.xchDrMap, s.xch_drmap, sizeof(s.xch_drmap));
+	/* Without the counters the network would drop uplinks as replays */
+	if (fcnt_restore() == -1) {
+#ifdef DEBUG
+		printf("session %08lx without frame counters\r\n",
+		    (unsigned long)s.devaddr);
+#endif
+		LMIC_reset(LMIC.region);
+		return 0;
+	}
+	saved = s;
+	/*
+	 * Ask the network to answer from the first uplink on, so that
+	 * if it has forgotten the session, EV_LINK_DEAD comes after
+	 * LINK_CHECK_DEAD uplinks and not the usual 36.
+	 */
+	if (LMIC.adrAckReq != LINK_CHECK_OFF)
+		LMIC.adrAckReq = 0;
+#ifdef DEBUG
+	printf("session %08lx restored at seqno %lu\r\n",
+	    (unsigned long)s.devaddr, (unsigned long)LMIC.seqnoUp);
+#endif
+	return 1;
+}
+
+/* Write the session if it is new or the MAC commands have changed it */
+void
+session_update(void)
+{
+	struct session	s;
+	nvms_t		nvms;
+
+	if (LMIC.devaddr == 0)
+		return;
+	session_fill(&s);
+	if (memcmp(&s, &saved, sizeof(s)) == 0)
+		return;
+	nvms = ad_nvms_open(NVMS_GENERIC_PART);
+	if (ad_nvms_write(nvms, SESSION_OFF, (uint8_t *)&s, sizeof(s)) ==
+	    (int)sizeof(s))
+		saved = s;
+}
+
+/* Forget the session, so that the next reset joins again */
+void
+session_clear(void)
+{
+	uint16_t	magic = 0;
+	nvms_t		nvms;
+
+	if (saved.magic != SESSION_MAGIC) {
+		nvms = ad_nvms_open(NVMS_GENERIC_PART);
+		ad_nvms_read(nvms, SESSION_OFF, (uint8_t *)&magic,
+		    sizeof(magic));
+		if (magic != SESSION_MAGIC)
+			return;
+		magic = 0;
+	}
+	memset(&saved, 0, sizeof(saved));
+	nvms = ad_nvms_open(NVMS_GENERIC_PART);
+	ad_nvms_write(nvms, SESSION_OFF, (uint8_t *)&magic, sizeof(magic));
+}
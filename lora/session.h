@@ -0,0 +1,8 @@
+#ifndef __SESSION_H__
+#define __SESSION_H__
+
+int	session_restore(void);
+void	session_update(void);
+void	session_clear(void);
+
+#endif /* __SESSION_H__ */
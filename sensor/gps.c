@@ -9,6 +9,7 @@
 #include "hw/hw.h"
 #include "hw/power.h"
 #include "lmic/oslmic.h"
+#include "lora/param.h"
 #include "lora/util.h"
 #include "accel.h"
 #include "gps.h"
@@ -299,6 +300,46 @@ gps_read(char *buf, int len)
 	return sizeof(last_fix);
 }
 
+/* The node has moved, and waits for a fix */
+int
+gps_alarm(const char *buf, int len)
+{
+	return len == 1 && buf[0] != 0;
+}
+
+/* 1/10000 minutes of latitude, in 1/10 mm */
+#define LATLON_MM10	1852
+
+/*
+ * Whether the fixes are further apart than the deadband, or either reading
+ * is no fix.  Longitude is scaled by the cosine of the latitude, as
+ * approximated by Bhaskara I to within 0.002.
+ */
+int
+gps_changed(const char *old, const char *cur, int len)
+{
+	struct gps_fix	a, b;
+	int64_t		dlat, dlon, r;
+	int32_t		deg;
+	uint8_t		db = 0;
+
+	if (len < (int)sizeof(a))
+		return memcmp(old, cur, len) != 0;
+	memcpy(&a, old, sizeof(a));
+	memcpy(&b, cur, sizeof(b));
+	dlat = (int64_t)b.lat - a.lat;
+	dlon = (int64_t)b.lon - a.lon;
+	/* Far enough for any deadband, and for the squares to fit */
+	if (dlat > 1 << 24 || dlat < -(1 << 24) ||
+	    dlon > 1 << 24 || dlon < -(1 << 24))
+		return 1;
+	deg = (b.lat < 0 ? -b.lat : b.lat) / (60 * 10000);
+	dlon = dlon * (32400 - 4 * deg * deg) / (32400 + deg * deg);
+	param_get(PARAM_GPS_DEADBAND, &db, sizeof(db));
+	r = db * 10 * 10000 / LATLON_MM10;
+	return dlat * dlat + dlon * dlon > r * r;
+}
+
 #ifdef FEATURE_SENSOR_GPS_ACCEL
 void
 gps_txstart()
@@ -5,6 +5,8 @@ void		gps_init(void);
 void		gps_prepare(void);
 ostime_t	gps_data_ready(void);
 int		gps_read(char *, int);
+int		gps_changed(const char *, const char *, int);
+int		gps_alarm(const char *, int);
 void		gps_txstart(void);
 
 #endif /* __GPS_H__ */
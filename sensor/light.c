@@ -2,6 +2,7 @@
 #include <limits.h>
 
 #include "lmic/oslmic.h"
+#include "lora/param.h"
 #include "lora/util.h"
 #include "hw/hw.h"
 #include "hw/i2c.h"
@@ -200,6 +201,25 @@ light_read(char *buf, int len)
 	return SZ;
 }
 
+static uint32_t
+lux_of(const char *buf)
+{
+	return (uint8_t)buf[0] | (uint8_t)buf[1] << 8 |
+	    (uint32_t)(uint8_t)buf[2] << 16;
+}
+
+/* Whether the illuminances differ by more than the deadband, in percent */
+int
+light_changed(const char *old, const char *cur, int len)
+{
+	uint8_t		pct = 0;
+	uint32_t	a = lux_of(old), b = lux_of(cur);
+
+	(void)len;
+	param_get(PARAM_LIGHT_DEADBAND, &pct, sizeof(pct));
+	return (a > b ? a - b : b - a) * 100 > pct * a;
+}
+
 void
 light_init()
 {
@@ -3,5 +3,6 @@
 
 void	light_init(void);
 int	light_read(char *buf, int len);
+int	light_changed(const char *old, const char *cur, int len);
 
 #endif /* __LIGHT_H__ */
@@ -1,8 +1,10 @@
 #include <sys/types.h>
+#include <string.h>
 #include <FreeRTOS.h>
 #include <hw_gpio.h>
 #include "hw/hw.h"
 #include "lmic/oslmic.h"
+#include "lora/delta.h"
 #include "lora/param.h"
 #include "lora/util.h"
 #include "gps.h"
@@ -41,6 +43,11 @@ struct sensor_callbacks {
 	ostime_t	(*data_ready)(void);
 	int		(*read)(char *, int);
 	void		(*txstart)(void);
+	uint8_t		format;		/* If one integer, as for delta.c */
+	/* Whether a reading differs from another of its length by much */
+	int		(*changed)(const char *, const char *, int);
+	/* Whether a reading needs attention before others */
+	int		(*alarm)(const char *, int);
 };
 
 const struct sensor_callbacks	sensor_cb[] = {
@@ -52,6 +59,8 @@ const struct sensor_callbacks	sensor_cb[] = {
 		.prepare	= gps_prepare,
 		.data_ready	= gps_data_ready,
 		.read		= gps_read,
+		.changed	= gps_changed,
+		.alarm		= gps_alarm,
 #ifdef FEATURE_SENSOR_GPS_ACCEL
 		.txstart	= gps_txstart,
 #endif
@@ -60,12 +69,20 @@ const struct sensor_callbacks	sensor_cb[] = {
 #ifdef FEATURE_SENSOR_TEMP
 	[SENSOR_TYPE_TEMP]	= {
 		.read		= temp_read,
+		.changed	= temp_changed,
+#ifdef FEATURE_SENSOR_TEMP_PCT2075
+		.format		= 2,
+#else
+		.format		= 1,
+#endif
 	},
 #endif
 #ifdef FEATURE_SENSOR_LIGHT
 	[SENSOR_TYPE_LIGHT]	= {
 		.init		= light_init,
 		.read		= light_read,
+		.changed	= light_changed,
+		.format		= 3 | DELTA_LE,
 	},
 #endif
 };
@@ -134,6 +151,37 @@ sensor_get_data(int idx, char *buf, int len)
 	return 1 + sensor_cb[sensor_type[idx]].read(buf + 1, len - 1);
 }
 
+/* How the readings of the sensor may be delta coded, 0 if they may not */
+uint8_t
+sensor_format(int idx)
+{
+	return sensor_cb[sensor_type[idx]].format;
+}
+
+/*
+ * Whether reading cur, of len bytes, differs from old by more than the
+ * deadband of the sensor; any difference counts if it has none.
+ */
+int
+sensor_changed(int idx, const char *old, size_t oldlen, const char *cur,
+    size_t len)
+{
+	if (oldlen != len)
+		return 1;
+	if (sensor_cb[sensor_type[idx]].changed)
+		return sensor_cb[sensor_type[idx]].changed(old, cur, len);
+	return memcmp(old, cur, len) != 0;
+}
+
+/* Whether the reading in buf, of len bytes, needs attention */
+int
+sensor_alarm(int idx, const char *buf, size_t len)
+{
+	if (!sensor_cb[sensor_type[idx]].alarm)
+		return 0;
+	return sensor_cb[sensor_type[idx]].alarm(buf, len);
+}
+
 void
 sensor_txstart(void)
 {
@@ -158,3 +206,15 @@ sensor_period(void)
 	}
 	return sensor_periods[idx];
 }
+
+/* Longest time without sensor data going, 0: it goes with every reading */
+ostime_t
+sensor_heartbeat(void)
+{
+	uint8_t	idx = 0;
+
+	if (param_get(PARAM_HEARTBEAT, &idx, sizeof(idx)) == 0 || idx == 0 ||
+	    idx >= ARRAY_SIZE(sensor_periods))
+		return 0;
+	return sensor_periods[idx];
+}
@@ -4,6 +4,7 @@
 #include "hw/hw.h"
 
 ostime_t	sensor_period(void);
+ostime_t	sensor_heartbeat(void);
 
 #ifdef FEATURE_SENSOR
 
@@ -13,6 +14,10 @@ void		sensor_init(void);
 void		sensor_prepare(void);
 ostime_t	sensor_data_ready(void);
 size_t		sensor_get_data(int idx, char *buf, int len);
+uint8_t		sensor_format(int idx);
+int		sensor_changed(int idx, const char *old, size_t oldlen,
+		    const char *cur, size_t len);
+int		sensor_alarm(int idx, const char *buf, size_t len);
 void		sensor_txstart(void);
 
 #else /* !FEATURE_SENSOR */
@@ -23,6 +28,9 @@ void		sensor_txstart(void);
 #define sensor_prepare()
 #define sensor_data_ready()		((ostime_t)0)
 #define sensor_get_data(idx, buf, len)	((size_t)0)
+#define sensor_format(idx)		((uint8_t)0)
+#define sensor_changed(idx, old, oldlen, cur, len)	((int)0)
+#define sensor_alarm(idx, buf, len)	((int)0)
 #define sensor_txstart()
 
 #endif /* FEATURE_SENSOR */
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <limits.h>
@@ -6,6 +7,7 @@
 
 #include "hw/hw.h"
 #include "hw/i2c.h"
+#include "lora/param.h"
 #include "temp.h"
 
 #ifdef FEATURE_SENSOR_TEMP
@@ -25,6 +27,21 @@ temp_read(char *buf, int len)
 	return SZ;
 }
 
+/* Whether the temperatures differ by more than the deadband */
+int
+temp_changed(const char *old, const char *cur, int len)
+{
+	uint8_t	db = 0;
+	int	d;
+
+	(void)len;
+	param_get(PARAM_TEMP_DEADBAND, &db, sizeof(db));
+	/* In 1/256th degrees, against the deadband in 1/10th */
+	d = (int16_t)((uint8_t)cur[0] << 8 | (uint8_t)cur[1]) -
+	    (int16_t)((uint8_t)old[0] << 8 | (uint8_t)old[1]);
+	return abs(d) * 10 > db * 256;
+}
+
 #elif defined(FEATURE_SENSOR_TEMP_INTERNAL)
 
 int
@@ -44,6 +61,17 @@ temp_read(char *buf, int len)
 	return 1;
 }
 
+/* Whether the temperatures differ by more than the deadband */
+int
+temp_changed(const char *old, const char *cur, int len)
+{
+	uint8_t	db = 0;
+
+	(void)len;
+	param_get(PARAM_TEMP_DEADBAND, &db, sizeof(db));
+	return abs((int8_t)cur[0] - (int8_t)old[0]) * 10 > db;
+}
+
 #else
 #error "Unknown FEATURE_SENSOR_TEMP_*"
 #endif
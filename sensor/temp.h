@@ -2,5 +2,6 @@
 #define __TEMP_H__
 
 int	temp_read(char *buf, int len);
+int	temp_changed(const char *old, const char *cur, int len);
 
 #endif /* __TEMP_H__ */